@@ -1,6 +1,5 @@
 // My library
 #include "OsteotomyModelToModelDistanceCLP.h"
-#include <vtkDistancePolyDataFilter.h>
 #include <vtkVersion.h>
 #include <vtkPolyDataWriter.h>
 #include <vtkXMLPolyDataWriter.h>
@@ -10,16 +9,28 @@
 #include <vtkCommand.h>
 #include <vtkPoints.h>
 #include <vtkSmartPointer.h>
-#include <vtkCleanPolyData.h>
-#include <vtkTriangleFilter.h>
 #include <vtkCellData.h>
 #include <vtkPointData.h>
 #include <vtkDoubleArray.h>
 #include <vtkMath.h>
 #include <vtkPolyDataNormals.h>
 #include <vtkFloatArray.h>
+#include <vtkCellArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkIdList.h>
+#include <vtkPolygon.h>
+#include <vtkSMPTools.h>
+#include <vtkByteSwap.h>
 #include <vtksys/SystemTools.hxx>
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <utility>
+#include <vector>
+
 //class ErrorObserver copied from http://www.vtk.org/Wiki/VTK/Examples/Cxx/Utilities/ObserveError
 class ErrorObserver : public vtkCommand
 {
@@ -80,20 +91,265 @@ private:
 };
 
 
-int TriangulateAndClean(vtkSmartPointer<vtkPolyData> &polyData )
+//Hash of the exact coordinates of a point, used to find the coincident points
+vtkTypeUInt64 HashPoint( const double p[] )
+{
+    vtkTypeUInt64 hash = 14695981039346656037ULL ;
+    for( int i = 0 ; i < 3 ; i++ )
+    {
+        //Adding 0 turns -0 into 0 so that both get the same hash
+        double x = p[ i ] + 0.0 ;
+        vtkTypeUInt64 bits ;
+        std::memcpy( &bits , &x , sizeof( bits ) ) ;
+        hash = ( hash ^ bits ) * 1099511628211ULL ;
+        hash ^= hash >> 32 ;
+    }
+    return hash ;
+}
+
+typedef std::pair< vtkTypeUInt64 , vtkIdType > PointKey ;
+
+class PointHashFunctor
+{
+public:
+    PointHashFunctor( vtkPoints* points , std::vector< PointKey > &keys ) :
+        Points( points ) ,
+        Keys( keys ) {}
+    void operator()( vtkIdType begin , vtkIdType end )
+    {
+        double p[ 3 ] ;
+        for( vtkIdType id = begin ; id < end ; id++ )
+        {
+            this->Points->GetPoint( id , p ) ;
+            this->Keys[ id ] = PointKey( HashPoint( p ) , id ) ;
+        }
+    }
+private:
+    vtkPoints* Points ;
+    std::vector< PointKey > &Keys ;
+};
+
+//Renumbers the point ids of the triangles once the points have been compacted
+class RemapFunctor
+{
+public:
+    RemapFunctor( vtkIdType* connectivity , const std::vector< vtkIdType > &newIds ) :
+        Connectivity( connectivity ) ,
+        NewIds( newIds ) {}
+    void operator()( vtkIdType begin , vtkIdType end )
+    {
+        for( vtkIdType t = begin ; t < end ; t++ )
+        {
+            vtkIdType* triangle = this->Connectivity + 4 * t + 1 ;
+            for( int v = 0 ; v < 3 ; v++ )
+            {
+                triangle[ v ] = this->NewIds[ triangle[ v ] ] ;
+            }
+        }
+    }
+private:
+    vtkIdType* Connectivity ;
+    const std::vector< vtkIdType > &NewIds ;
+};
+
+void InsertTriangle( vtkIdType a , vtkIdType b , vtkIdType c , vtkIdType sourceCellId ,
+                     vtkIdTypeArray* connectivity , std::vector< vtkIdType > &sourceCellIds )
+{
+    if( a == b || b == c || a == c )
+    {
+        return ;
+    }
+    connectivity->InsertNextValue( 3 ) ;
+    connectivity->InsertNextValue( a ) ;
+    connectivity->InsertNextValue( b ) ;
+    connectivity->InsertNextValue( c ) ;
+    sourceCellIds.push_back( sourceCellId ) ;
+}
+
+//Triangulates the polygons and triangle strips of polyData, merges the points that have
+//the same coordinates and removes the points that are not used anymore. This does the work
+//of vtkCleanPolyData followed by vtkTriangleFilter in a single stage: the coincident points
+//are found with a hash of their coordinates that is computed and sorted in parallel, and the
+//points and point data are compacted in place instead of being copied by each filter.
+//Vertices, lines and degenerate triangles are dropped since they play no part in the distance.
+int PreprocessMesh( vtkSmartPointer< vtkPolyData > &polyData )
 {
-    vtkSmartPointer <vtkCleanPolyData> Cleaner = vtkSmartPointer <vtkCleanPolyData>::New() ;
-    Cleaner->SetInputData( polyData ) ;
-    Cleaner->Update() ;
-    vtkSmartPointer <vtkTriangleFilter> Triangler = vtkSmartPointer <vtkTriangleFilter>::New() ;
-    Triangler->SetInputData( Cleaner->GetOutput() ) ;
-    Triangler->Update() ;
-    polyData = Triangler->GetOutput() ;
+    vtkPoints* points = polyData->GetPoints() ;
+    vtkIdType numberOfPoints = polyData->GetNumberOfPoints() ;
+    if( !points || numberOfPoints == 0 )
+    {
+        return 0 ;
+    }
+    //Each point is mapped to the point with the lowest id among the ones with the same coordinates
+    std::vector< PointKey > keys( numberOfPoints ) ;
+    PointHashFunctor hashFunctor( points , keys ) ;
+    vtkSMPTools::For( 0 , numberOfPoints , hashFunctor ) ;
+    vtkSMPTools::Sort( keys.begin() , keys.end() ) ;
+    std::vector< vtkIdType > mergedIds( numberOfPoints ) ;
+    vtkIdType runStart = 0 ;
+    while( runStart < numberOfPoints )
+    {
+        vtkIdType runEnd = runStart + 1 ;
+        while( runEnd < numberOfPoints && keys[ runEnd ].first == keys[ runStart ].first )
+        {
+            runEnd++ ;
+        }
+        //Within a run the ids are sorted, so the first match is the lowest id
+        for( vtkIdType i = runStart ; i < runEnd ; i++ )
+        {
+            vtkIdType id = keys[ i ].second ;
+            mergedIds[ id ] = id ;
+            double p[ 3 ] ;
+            points->GetPoint( id , p ) ;
+            for( vtkIdType j = runStart ; j < i ; j++ )
+            {
+                vtkIdType candidate = keys[ j ].second ;
+                if( mergedIds[ candidate ] != candidate )
+                {
+                    continue ;
+                }
+                double q[ 3 ] ;
+                points->GetPoint( candidate , q ) ;
+                if( p[ 0 ] == q[ 0 ] && p[ 1 ] == q[ 1 ] && p[ 2 ] == q[ 2 ] )
+                {
+                    mergedIds[ id ] = candidate ;
+                    break ;
+                }
+            }
+        }
+        runStart = runEnd ;
+    }
+    std::vector< PointKey >().swap( keys ) ;
+    //Triangulate the polygons by ear cutting, which handles concave ones, and the strips
+    //with alternating orientation, keeping track of the cell each triangle comes from to
+    //pass the cell data
+    vtkCellArray* polys = polyData->GetPolys() ;
+    vtkCellArray* strips = polyData->GetStrips() ;
+    vtkIdType numberOfTriangles = polys->GetNumberOfConnectivityEntries() - 3 * polys->GetNumberOfCells()
+                                + strips->GetNumberOfConnectivityEntries() - 3 * strips->GetNumberOfCells() ;
+    vtkSmartPointer< vtkIdTypeArray > connectivity = vtkSmartPointer< vtkIdTypeArray >::New() ;
+    connectivity->Allocate( 4 * std::max( numberOfTriangles , static_cast< vtkIdType >( 1 ) ) ) ;
+    std::vector< vtkIdType > sourceCellIds ;
+    sourceCellIds.reserve( numberOfTriangles ) ;
+    vtkIdType cellId = polyData->GetNumberOfVerts() + polyData->GetNumberOfLines() ;
+    vtkIdType npts ;
+    vtkIdType* pts ;
+    vtkSmartPointer< vtkPolygon > polygon = vtkSmartPointer< vtkPolygon >::New() ;
+    vtkSmartPointer< vtkIdList > polygonTriangles = vtkSmartPointer< vtkIdList >::New() ;
+    for( polys->InitTraversal() ; polys->GetNextCell( npts , pts ) ; cellId++ )
+    {
+        if( npts == 3 )
+        {
+            InsertTriangle( mergedIds[ pts[ 0 ] ] , mergedIds[ pts[ 1 ] ] , mergedIds[ pts[ 2 ] ] ,
+                            cellId , connectivity , sourceCellIds ) ;
+            continue ;
+        }
+        if( npts < 3 )
+        {
+            continue ;
+        }
+        //The triangles come as ids local to the polygon
+        polygon->GetPointIds()->SetNumberOfIds( npts ) ;
+        polygon->GetPoints()->SetNumberOfPoints( npts ) ;
+        for( vtkIdType k = 0 ; k < npts ; k++ )
+        {
+            polygon->GetPointIds()->SetId( k , k ) ;
+            polygon->GetPoints()->SetPoint( k , points->GetPoint( pts[ k ] ) ) ;
+        }
+        polygonTriangles->Reset() ;
+        if( polygon->Triangulate( polygonTriangles ) )
+        {
+            for( vtkIdType k = 0 ; k + 2 < polygonTriangles->GetNumberOfIds() ; k += 3 )
+            {
+                InsertTriangle( mergedIds[ pts[ polygonTriangles->GetId( k ) ] ] ,
+                                mergedIds[ pts[ polygonTriangles->GetId( k + 1 ) ] ] ,
+                                mergedIds[ pts[ polygonTriangles->GetId( k + 2 ) ] ] ,
+                                cellId , connectivity , sourceCellIds ) ;
+            }
+            continue ;
+        }
+        //Degenerate polygons that cannot be ear cut are split as fans
+        for( vtkIdType k = 1 ; k + 1 < npts ; k++ )
+        {
+            InsertTriangle( mergedIds[ pts[ 0 ] ] , mergedIds[ pts[ k ] ] , mergedIds[ pts[ k + 1 ] ] ,
+                            cellId , connectivity , sourceCellIds ) ;
+        }
+    }
+    for( strips->InitTraversal() ; strips->GetNextCell( npts , pts ) ; cellId++ )
+    {
+        for( vtkIdType k = 0 ; k + 2 < npts ; k++ )
+        {
+            vtkIdType first = k % 2 ? k + 1 : k ;
+            vtkIdType second = k % 2 ? k : k + 1 ;
+            InsertTriangle( mergedIds[ pts[ first ] ] , mergedIds[ pts[ second ] ] , mergedIds[ pts[ k + 2 ] ] ,
+                            cellId , connectivity , sourceCellIds ) ;
+        }
+    }
+    numberOfTriangles = static_cast< vtkIdType >( sourceCellIds.size() ) ;
+    //Compact the used points in place. The new ids are given in increasing order of the
+    //old ids, so a point is never overwritten before it has been moved.
+    std::vector< vtkIdType > &newIds = mergedIds ;
+    std::fill( newIds.begin() , newIds.end() , -1 ) ;
+    vtkIdType* triangleIds = connectivity->GetPointer( 0 ) ;
+    for( vtkIdType t = 0 ; t < numberOfTriangles ; t++ )
+    {
+        for( int v = 1 ; v < 4 ; v++ )
+        {
+            newIds[ triangleIds[ 4 * t + v ] ] = 0 ;
+        }
+    }
+    vtkDataArray* coordinates = points->GetData() ;
+    vtkPointData* pointData = polyData->GetPointData() ;
+    vtkIdType numberOfUsedPoints = 0 ;
+    for( vtkIdType id = 0 ; id < numberOfPoints ; id++ )
+    {
+        if( newIds[ id ] < 0 )
+        {
+            continue ;
+        }
+        if( numberOfUsedPoints != id )
+        {
+            coordinates->SetTuple( numberOfUsedPoints , id , coordinates ) ;
+            for( int a = 0 ; a < pointData->GetNumberOfArrays() ; a++ )
+            {
+                vtkAbstractArray* array = pointData->GetAbstractArray( a ) ;
+                array->SetTuple( numberOfUsedPoints , id , array ) ;
+            }
+        }
+        newIds[ id ] = numberOfUsedPoints++ ;
+    }
+    points->SetNumberOfPoints( numberOfUsedPoints ) ;
+    points->Squeeze() ;
+    for( int a = 0 ; a < pointData->GetNumberOfArrays() ; a++ )
+    {
+        vtkAbstractArray* array = pointData->GetAbstractArray( a ) ;
+        array->SetNumberOfTuples( numberOfUsedPoints ) ;
+        array->Squeeze() ;
+    }
+    RemapFunctor remapFunctor( triangleIds , newIds ) ;
+    vtkSMPTools::For( 0 , numberOfTriangles , remapFunctor ) ;
+    vtkSmartPointer< vtkCellArray > triangles = vtkSmartPointer< vtkCellArray >::New() ;
+    triangles->SetCells( numberOfTriangles , connectivity ) ;
+    vtkSmartPointer< vtkPolyData > preprocessed = vtkSmartPointer< vtkPolyData >::New() ;
+    preprocessed->SetPoints( points ) ;
+    preprocessed->GetPointData()->ShallowCopy( pointData ) ;
+    preprocessed->SetPolys( triangles ) ;
+    vtkCellData* cellData = polyData->GetCellData() ;
+    if( cellData->GetNumberOfArrays() > 0 )
+    {
+        vtkCellData* outCellData = preprocessed->GetCellData() ;
+        outCellData->CopyAllocate( cellData , numberOfTriangles ) ;
+        for( vtkIdType t = 0 ; t < numberOfTriangles ; t++ )
+        {
+            outCellData->CopyData( cellData , sourceCellIds[ t ] , t ) ;
+        }
+    }
+    polyData = preprocessed ;
     return 0 ;
 }
 
 
-void PointsToVec( double p1[] , double p2[] , double vec[] )
+void PointsToVec( const double p1[] , const double p2[] , double vec[] )
 {
     for( int i = 0 ; i < 3 ; i++ )
     {
@@ -103,45 +359,741 @@ void PointsToVec( double p1[] , double p2[] , double vec[] )
 
 
 
+//Closest point to p on the triangle (a,b,c), from Ericson, Real-Time Collision Detection.
+//The barycentric weights of the closest point are returned in weights.
+void ClosestPointOnTriangle( const double p[] , const double a[] , const double b[] , const double c[] ,
+                             double closest[] , double weights[] )
+{
+    double ab[ 3 ] , ac[ 3 ] , ap[ 3 ] ;
+    PointsToVec( a , b , ab ) ;
+    PointsToVec( a , c , ac ) ;
+    PointsToVec( a , p , ap ) ;
+    double d1 = vtkMath::Dot( ab , ap ) ;
+    double d2 = vtkMath::Dot( ac , ap ) ;
+    if( d1 <= 0.0 && d2 <= 0.0 )
+    {
+        weights[ 0 ] = 1.0 ; weights[ 1 ] = 0.0 ; weights[ 2 ] = 0.0 ;
+    }
+    else
+    {
+        double bp[ 3 ] ;
+        PointsToVec( b , p , bp ) ;
+        double d3 = vtkMath::Dot( ab , bp ) ;
+        double d4 = vtkMath::Dot( ac , bp ) ;
+        double cp[ 3 ] ;
+        PointsToVec( c , p , cp ) ;
+        double d5 = vtkMath::Dot( ab , cp ) ;
+        double d6 = vtkMath::Dot( ac , cp ) ;
+        double vc = d1 * d4 - d3 * d2 ;
+        double vb = d5 * d2 - d1 * d6 ;
+        double va = d3 * d6 - d5 * d4 ;
+        if( d3 >= 0.0 && d4 <= d3 )
+        {
+            weights[ 0 ] = 0.0 ; weights[ 1 ] = 1.0 ; weights[ 2 ] = 0.0 ;
+        }
+        else if( d6 >= 0.0 && d5 <= d6 )
+        {
+            weights[ 0 ] = 0.0 ; weights[ 1 ] = 0.0 ; weights[ 2 ] = 1.0 ;
+        }
+        else if( vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0 )
+        {
+            double v = d1 / ( d1 - d3 ) ;
+            weights[ 0 ] = 1.0 - v ; weights[ 1 ] = v ; weights[ 2 ] = 0.0 ;
+        }
+        else if( vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0 )
+        {
+            double w = d2 / ( d2 - d6 ) ;
+            weights[ 0 ] = 1.0 - w ; weights[ 1 ] = 0.0 ; weights[ 2 ] = w ;
+        }
+        else if( va <= 0.0 && ( d4 - d3 ) >= 0.0 && ( d5 - d6 ) >= 0.0 )
+        {
+            double w = ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) ) ;
+            weights[ 0 ] = 0.0 ; weights[ 1 ] = 1.0 - w ; weights[ 2 ] = w ;
+        }
+        else
+        {
+            double denom = va + vb + vc ;
+            if( denom == 0.0 ) //degenerate triangle
+            {
+                weights[ 0 ] = 1.0 ; weights[ 1 ] = 0.0 ; weights[ 2 ] = 0.0 ;
+            }
+            else
+            {
+                weights[ 1 ] = vb / denom ;
+                weights[ 2 ] = vc / denom ;
+                weights[ 0 ] = 1.0 - weights[ 1 ] - weights[ 2 ] ;
+            }
+        }
+    }
+    for( int i = 0 ; i < 3 ; i++ )
+    {
+        closest[ i ] = weights[ 0 ] * a[ i ] + weights[ 1 ] * b[ i ] + weights[ 2 ] * c[ i ] ;
+    }
+}
+
+//Squared distance from p to an axis aligned box (0 if p is inside)
+template< typename TReal >
+double DistanceToBounds2( const double p[] , const TReal bounds[] )
+{
+    double dist2 = 0.0 ;
+    for( int i = 0 ; i < 3 ; i++ )
+    {
+        double d = 0.0 ;
+        if( p[ i ] < bounds[ 2 * i ] )
+        {
+            d = bounds[ 2 * i ] - p[ i ] ;
+        }
+        else if( p[ i ] > bounds[ 2 * i + 1 ] )
+        {
+            d = p[ i ] - bounds[ 2 * i + 1 ] ;
+        }
+        dist2 += d * d ;
+    }
+    return dist2 ;
+}
+
+//Raw copies of the vectors of the target structures, used by the target cache
+template< typename T >
+void WriteVector( std::ostream &stream , const std::vector< T > &values )
+{
+    vtkTypeUInt64 size = values.size() ;
+    stream.write( reinterpret_cast< const char* >( &size ) , sizeof( size ) ) ;
+    if( size > 0 )
+    {
+        stream.write( reinterpret_cast< const char* >( &values[ 0 ] ) , size * sizeof( T ) ) ;
+    }
+}
+
+template< typename T >
+bool ReadVector( std::istream &stream , std::vector< T > &values )
+{
+    vtkTypeUInt64 size = 0 ;
+    if( !stream.read( reinterpret_cast< char* >( &size ) , sizeof( size ) ) )
+    {
+        return false ;
+    }
+    //A damaged file may give any size, which must fit in what is left of the file
+    std::streampos position = stream.tellg() ;
+    if( position < 0 || !stream.seekg( 0 , std::ios::end ) )
+    {
+        return false ;
+    }
+    std::streamoff remaining = stream.tellg() - position ;
+    if( !stream.seekg( position ) || remaining < 0
+     || size > static_cast< vtkTypeUInt64 >( remaining ) / sizeof( T ) )
+    {
+        return false ;
+    }
+    values.resize( size ) ;
+    if( size > 0 )
+    {
+        stream.read( reinterpret_cast< char* >( &values[ 0 ] ) , size * sizeof( T ) ) ;
+    }
+    return !stream.fail() ;
+}
+
+//Bounding volume hierarchy over the triangles of a surface. Unlike vtkCellLocator,
+//the tree is not modified by queries once built, so several threads can share it.
+//TReal is the type of the internal copy of the points and of the node bounds, the
+//closest point computations themselves are done in double precision.
+template< typename TReal >
+class TriangleBVH
+{
+public:
+    //Build the tree over the polygons of polyData, which must be triangles
+    void Build( vtkPolyData* polyData )
+    {
+        this->Points.clear() ;
+        this->Triangles.clear() ;
+        this->PolygonIds.clear() ;
+        this->Nodes.clear() ;
+        vtkIdType numberOfPoints = polyData->GetNumberOfPoints() ;
+        this->Points.resize( 3 * numberOfPoints ) ;
+        for( vtkIdType i = 0 ; i < numberOfPoints ; i++ )
+        {
+            double p[ 3 ] ;
+            polyData->GetPoint( i , p ) ;
+            for( int j = 0 ; j < 3 ; j++ )
+            {
+                this->Points[ 3 * i + j ] = static_cast< TReal >( p[ j ] ) ;
+            }
+        }
+        vtkCellArray* polys = polyData->GetPolys() ;
+        vtkIdType npts ;
+        vtkIdType* pts ;
+        vtkIdType polygonId = 0 ;
+        for( polys->InitTraversal() ; polys->GetNextCell( npts , pts ) ; polygonId++ )
+        {
+            if( npts != 3 )
+            {
+                continue ;
+            }
+            this->Triangles.insert( this->Triangles.end() , pts , pts + 3 ) ;
+            this->PolygonIds.push_back( polygonId ) ;
+        }
+        vtkIdType numberOfTriangles = static_cast< vtkIdType >( this->PolygonIds.size() ) ;
+        if( numberOfTriangles == 0 )
+        {
+            return ;
+        }
+        std::vector< double > centroids( 3 * numberOfTriangles ) ;
+        std::vector< vtkIdType > order( numberOfTriangles ) ;
+        for( vtkIdType t = 0 ; t < numberOfTriangles ; t++ )
+        {
+            order[ t ] = t ;
+            for( int i = 0 ; i < 3 ; i++ )
+            {
+                centroids[ 3 * t + i ] = ( this->Points[ 3 * this->Triangles[ 3 * t ] + i ]
+                                         + this->Points[ 3 * this->Triangles[ 3 * t + 1 ] + i ]
+                                         + this->Points[ 3 * this->Triangles[ 3 * t + 2 ] + i ] ) / 3.0 ;
+            }
+        }
+        //Top-down median split on the longest axis of the centroids
+        this->Nodes.reserve( 2 * ( numberOfTriangles / LeafSize + 1 ) ) ;
+        this->Nodes.push_back( Node() ) ;
+        std::vector< std::pair< vtkIdType , std::pair< vtkIdType , vtkIdType > > > stack ;
+        stack.push_back( std::make_pair( 0 , std::make_pair( 0 , numberOfTriangles ) ) ) ;
+        while( !stack.empty() )
+        {
+            vtkIdType nodeId = stack.back().first ;
+            vtkIdType begin = stack.back().second.first ;
+            vtkIdType end = stack.back().second.second ;
+            stack.pop_back() ;
+            double centroidBounds[ 6 ] ;
+            TReal* bounds = this->Nodes[ nodeId ].Bounds ;
+            for( int i = 0 ; i < 3 ; i++ )
+            {
+                centroidBounds[ 2 * i ] = std::numeric_limits< double >::max() ;
+                centroidBounds[ 2 * i + 1 ] = -std::numeric_limits< double >::max() ;
+                bounds[ 2 * i ] = std::numeric_limits< TReal >::max() ;
+                bounds[ 2 * i + 1 ] = -std::numeric_limits< TReal >::max() ;
+            }
+            for( vtkIdType t = begin ; t < end ; t++ )
+            {
+                for( int i = 0 ; i < 3 ; i++ )
+                {
+                    double c = centroids[ 3 * order[ t ] + i ] ;
+                    centroidBounds[ 2 * i ] = std::min( centroidBounds[ 2 * i ] , c ) ;
+                    centroidBounds[ 2 * i + 1 ] = std::max( centroidBounds[ 2 * i + 1 ] , c ) ;
+                    for( int v = 0 ; v < 3 ; v++ )
+                    {
+                        TReal x = this->Points[ 3 * this->Triangles[ 3 * order[ t ] + v ] + i ] ;
+                        bounds[ 2 * i ] = std::min( bounds[ 2 * i ] , x ) ;
+                        bounds[ 2 * i + 1 ] = std::max( bounds[ 2 * i + 1 ] , x ) ;
+                    }
+                }
+            }
+            if( end - begin <= LeafSize )
+            {
+                this->Nodes[ nodeId ].Start = begin ;
+                this->Nodes[ nodeId ].Count = end - begin ;
+                continue ;
+            }
+            int axis = 0 ;
+            for( int i = 1 ; i < 3 ; i++ )
+            {
+                if( centroidBounds[ 2 * i + 1 ] - centroidBounds[ 2 * i ] >
+                    centroidBounds[ 2 * axis + 1 ] - centroidBounds[ 2 * axis ] )
+                {
+                    axis = i ;
+                }
+            }
+            vtkIdType middle = begin + ( end - begin ) / 2 ;
+            std::nth_element( order.begin() + begin , order.begin() + middle , order.begin() + end ,
+                              CentroidLess( centroids , axis ) ) ;
+            vtkIdType left = static_cast< vtkIdType >( this->Nodes.size() ) ;
+            this->Nodes[ nodeId ].Start = left ;
+            this->Nodes[ nodeId ].Count = 0 ;
+            this->Nodes.push_back( Node() ) ;
+            this->Nodes.push_back( Node() ) ;
+            stack.push_back( std::make_pair( left , std::make_pair( begin , middle ) ) ) ;
+            stack.push_back( std::make_pair( left + 1 , std::make_pair( middle , end ) ) ) ;
+        }
+        //Store the triangles in tree order so that leaves are contiguous
+        std::vector< vtkIdType > triangles( 3 * numberOfTriangles ) ;
+        std::vector< vtkIdType > polygonIds( numberOfTriangles ) ;
+        for( vtkIdType t = 0 ; t < numberOfTriangles ; t++ )
+        {
+            std::copy( &this->Triangles[ 3 * order[ t ] ] , &this->Triangles[ 3 * order[ t ] ] + 3 , &triangles[ 3 * t ] ) ;
+            polygonIds[ t ] = this->PolygonIds[ order[ t ] ] ;
+        }
+        this->Triangles.swap( triangles ) ;
+        this->PolygonIds.swap( polygonIds ) ;
+    }
+
+    bool IsEmpty() const
+    {
+        return this->Nodes.empty() ;
+    }
+
+    void Write( std::ostream &stream ) const
+    {
+        WriteVector( stream , this->Points ) ;
+        WriteVector( stream , this->Triangles ) ;
+        WriteVector( stream , this->PolygonIds ) ;
+        WriteVector( stream , this->Nodes ) ;
+    }
+
+    //Returns false if the stream is damaged or holds ids out of range, numberOfPolygons
+    //bounds the polygon ids
+    bool Read( std::istream &stream , vtkIdType numberOfPolygons )
+    {
+        if( !ReadVector( stream , this->Points ) || !ReadVector( stream , this->Triangles )
+         || !ReadVector( stream , this->PolygonIds ) || !ReadVector( stream , this->Nodes ) )
+        {
+            return false ;
+        }
+        if( !this->IsValid( numberOfPolygons ) )
+        {
+            this->Nodes.clear() ;
+            return false ;
+        }
+        return true ;
+    }
+
+    vtkIdType GetNumberOfPoints() const
+    {
+        return static_cast< vtkIdType >( this->Points.size() / 3 ) ;
+    }
+
+    //Find the closest point of the surface to x. The index of the triangle containing it
+    //among the polygons, its point ids and the barycentric weights of the closest point
+    //are returned as well.
+    bool FindClosestPoint( const double x[] , double closestPoint[] , vtkIdType &polygonId ,
+                           vtkIdType pointIds[] , double weights[] , double &dist2 ) const
+    {
+        if( this->IsEmpty() )
+        {
+            return false ;
+        }
+        dist2 = std::numeric_limits< double >::max() ;
+        vtkIdType stack[ MaximumStackSize ] ;
+        int stackSize = 0 ;
+        stack[ stackSize++ ] = 0 ;
+        while( stackSize > 0 )
+        {
+            vtkIdType nodeId = stack[ --stackSize ] ;
+            const Node &node = this->Nodes[ nodeId ] ;
+            if( DistanceToBounds2( x , node.Bounds ) >= dist2 )
+            {
+                continue ;
+            }
+            if( node.Count > 0 )
+            {
+                this->SearchTriangles( x , node.Start , node.Start + node.Count ,
+                                       closestPoint , polygonId , pointIds , weights , dist2 ) ;
+            }
+            else if( stackSize + 2 > MaximumStackSize )
+            {
+                //A node that would overflow the stack is searched through, its triangles
+                //are contiguous in tree order
+                vtkIdType begin ;
+                vtkIdType end ;
+                this->GetTriangleRange( nodeId , begin , end ) ;
+                this->SearchTriangles( x , begin , end , closestPoint , polygonId , pointIds , weights , dist2 ) ;
+            }
+            else
+            {
+                //Visit the nearest child first
+                double leftDist2 = DistanceToBounds2( x , this->Nodes[ node.Start ].Bounds ) ;
+                double rightDist2 = DistanceToBounds2( x , this->Nodes[ node.Start + 1 ].Bounds ) ;
+                if( leftDist2 < rightDist2 )
+                {
+                    stack[ stackSize++ ] = node.Start + 1 ;
+                    stack[ stackSize++ ] = node.Start ;
+                }
+                else
+                {
+                    stack[ stackSize++ ] = node.Start ;
+                    stack[ stackSize++ ] = node.Start + 1 ;
+                }
+            }
+        }
+        return true ;
+    }
+
+private:
+    static const vtkIdType LeafSize = 8 ;
+
+    //Nodes left to visit by a closest point query. The median split keeps the depth of
+    //the tree well below it.
+    static const int MaximumStackSize = 128 ;
+
+    //Checks every id of a tree read from a file, so that queries stay in the vectors:
+    //point ids against the points, polygon ids against numberOfPolygons, and the
+    //triangles and children of the nodes against the triangles and nodes. Children come
+    //after their parent, which keeps the walks down the tree finite.
+    bool IsValid( vtkIdType numberOfPolygons ) const
+    {
+        vtkIdType numberOfPoints = this->GetNumberOfPoints() ;
+        vtkIdType numberOfTriangles = static_cast< vtkIdType >( this->PolygonIds.size() ) ;
+        vtkIdType numberOfNodes = static_cast< vtkIdType >( this->Nodes.size() ) ;
+        if( this->Points.size() % 3 != 0 || this->Triangles.size() != 3 * this->PolygonIds.size()
+         || ( numberOfNodes == 0 ) != ( numberOfTriangles == 0 ) )
+        {
+            return false ;
+        }
+        for( size_t i = 0 ; i < this->Triangles.size() ; i++ )
+        {
+            if( this->Triangles[ i ] < 0 || this->Triangles[ i ] >= numberOfPoints )
+            {
+                return false ;
+            }
+        }
+        for( vtkIdType t = 0 ; t < numberOfTriangles ; t++ )
+        {
+            if( this->PolygonIds[ t ] < 0 || this->PolygonIds[ t ] >= numberOfPolygons )
+            {
+                return false ;
+            }
+        }
+        for( vtkIdType n = 0 ; n < numberOfNodes ; n++ )
+        {
+            const Node &node = this->Nodes[ n ] ;
+            if( node.Count < 0 || node.Start < 0 )
+            {
+                return false ;
+            }
+            if( node.Count > 0 ? node.Count > numberOfTriangles - node.Start
+                               : node.Start <= n || node.Start >= numberOfNodes - 1 )
+            {
+                return false ;
+            }
+        }
+        return true ;
+    }
+
+    //Triangles of the subtree of a node, from its leftmost and rightmost leaves
+    void GetTriangleRange( vtkIdType nodeId , vtkIdType &begin , vtkIdType &end ) const
+    {
+        vtkIdType first = nodeId ;
+        while( this->Nodes[ first ].Count == 0 )
+        {
+            first = this->Nodes[ first ].Start ;
+        }
+        vtkIdType last = nodeId ;
+        while( this->Nodes[ last ].Count == 0 )
+        {
+            last = this->Nodes[ last ].Start + 1 ;
+        }
+        begin = this->Nodes[ first ].Start ;
+        end = this->Nodes[ last ].Start + this->Nodes[ last ].Count ;
+    }
+
+    //Update the closest point with the triangles [begin, end) of the tree order
+    void SearchTriangles( const double x[] , vtkIdType begin , vtkIdType end , double closestPoint[] ,
+                          vtkIdType &polygonId , vtkIdType pointIds[] , double weights[] , double &dist2 ) const
+    {
+        for( vtkIdType t = begin ; t < end ; t++ )
+        {
+            const vtkIdType* tri = &this->Triangles[ 3 * t ] ;
+            double vertices[ 3 ][ 3 ] ;
+            for( int v = 0 ; v < 3 ; v++ )
+            {
+                for( int i = 0 ; i < 3 ; i++ )
+                {
+                    vertices[ v ][ i ] = this->Points[ 3 * tri[ v ] + i ] ;
+                }
+            }
+            double candidate[ 3 ] ;
+            double candidateWeights[ 3 ] ;
+            ClosestPointOnTriangle( x , vertices[ 0 ] , vertices[ 1 ] , vertices[ 2 ] , candidate , candidateWeights ) ;
+            double candidateDist2 = vtkMath::Distance2BetweenPoints( x , candidate ) ;
+            if( candidateDist2 < dist2 )
+            {
+                dist2 = candidateDist2 ;
+                polygonId = this->PolygonIds[ t ] ;
+                for( int i = 0 ; i < 3 ; i++ )
+                {
+                    closestPoint[ i ] = candidate[ i ] ;
+                    weights[ i ] = candidateWeights[ i ] ;
+                    pointIds[ i ] = tri[ i ] ;
+                }
+            }
+        }
+    }
+
+    struct Node
+    {
+        TReal Bounds[ 6 ] ;
+        vtkIdType Start ; //first triangle of a leaf, or first child of an inner node
+        vtkIdType Count ; //number of triangles of a leaf, 0 for inner nodes
+    };
+
+    struct CentroidLess
+    {
+        CentroidLess( const std::vector< double > &centroids , int axis ) : Centroids( centroids ) , Axis( axis ) {}
+        bool operator()( vtkIdType a , vtkIdType b ) const
+        {
+            return this->Centroids[ 3 * a + this->Axis ] < this->Centroids[ 3 * b + this->Axis ] ;
+        }
+        const std::vector< double > &Centroids ;
+        int Axis ;
+    };
+
+    std::vector< TReal > Points ;
+    std::vector< vtkIdType > Triangles ;
+    std::vector< vtkIdType > PolygonIds ;
+    std::vector< Node > Nodes ;
+};
+
+//A target surface of the distance computation, with the normals needed for the sign
+template< typename TReal >
+class DistanceTarget
+{
+public:
+    void Initialize( vtkPolyData* polyData )
+    {
+        //Same normals as vtkImplicitPolyDataDistance uses to sign the distance
+        vtkSmartPointer< vtkPolyDataNormals > normals = vtkSmartPointer< vtkPolyDataNormals >::New() ;
+        normals->SetInputData( polyData ) ;
+        normals->ComputePointNormalsOn() ;
+        normals->ComputeCellNormalsOn() ;
+        normals->SplittingOff() ;
+        normals->ConsistencyOn() ;
+        normals->Update() ;
+        vtkPolyData* output = normals->GetOutput() ;
+        CopyTuples( output->GetPointData()->GetNormals() , this->PointNormals ) ;
+        CopyTuples( output->GetCellData()->GetNormals() , this->CellNormals ) ;
+        this->Tree.Build( output ) ;
+    }
+
+    bool IsEmpty() const
+    {
+        return this->Tree.IsEmpty() ;
+    }
+
+    //Saves the target so that it can be loaded without reading and processing the
+    //original surface again. The key identifies the surface the target was built from.
+    bool Write( const std::string &fileName , const std::string &key ) const
+    {
+        std::ofstream stream( fileName.c_str() , std::ios::binary ) ;
+        if( !stream )
+        {
+            return false ;
+        }
+        WriteHeader( stream , key ) ;
+        WriteVector( stream , this->PointNormals ) ;
+        WriteVector( stream , this->CellNormals ) ;
+        this->Tree.Write( stream ) ;
+        return !stream.fail() ;
+    }
+
+    //Returns false if the file does not exist, is damaged or was saved for another surface,
+    //and the target is then built again from the surface
+    bool Read( const std::string &fileName , const std::string &key )
+    {
+        std::ifstream stream( fileName.c_str() , std::ios::binary ) ;
+        if( !stream )
+        {
+            return false ;
+        }
+        std::stringstream expectedHeader ;
+        WriteHeader( expectedHeader , key ) ;
+        std::string header = expectedHeader.str() ;
+        std::vector< char > fileHeader( header.size() ) ;
+        if( !stream.read( &fileHeader[ 0 ] , fileHeader.size() )
+         || !std::equal( fileHeader.begin() , fileHeader.end() , header.begin() ) )
+        {
+            return false ;
+        }
+        if( !ReadVector( stream , this->PointNormals ) || !ReadVector( stream , this->CellNormals )
+         || this->PointNormals.size() % 3 != 0 || this->CellNormals.size() % 3 != 0
+         || !this->Tree.Read( stream , static_cast< vtkIdType >( this->CellNormals.size() / 3 ) ) )
+        {
+            return false ;
+        }
+        //The point normals are looked up by the point ids of the triangles
+        return this->Tree.IsEmpty()
+            || static_cast< vtkIdType >( this->PointNormals.size() / 3 ) == this->Tree.GetNumberOfPoints() ;
+    }
+
+    double Distance( const double x[] , bool signedDistance ) const
+    {
+        double closestPoint[ 3 ] ;
+        double weights[ 3 ] ;
+        double dist2 ;
+        vtkIdType polygonId ;
+        vtkIdType pointIds[ 3 ] ;
+        this->Tree.FindClosestPoint( x , closestPoint , polygonId , pointIds , weights , dist2 ) ;
+        double distance = std::sqrt( dist2 ) ;
+        if( !signedDistance )
+        {
+            return distance ;
+        }
+        //Inside the triangle the face normal gives the side, on its edges and
+        //vertices the interpolated point normals are used instead
+        double normal[ 3 ] = { 0.0 , 0.0 , 0.0 } ;
+        const double tolerance = 1e-6 ;
+        if( weights[ 0 ] > tolerance && weights[ 1 ] > tolerance && weights[ 2 ] > tolerance )
+        {
+            for( int i = 0 ; i < 3 ; i++ )
+            {
+                normal[ i ] = this->CellNormals[ 3 * polygonId + i ] ;
+            }
+        }
+        else
+        {
+            for( int v = 0 ; v < 3 ; v++ )
+            {
+                for( int i = 0 ; i < 3 ; i++ )
+                {
+                    normal[ i ] += weights[ v ] * this->PointNormals[ 3 * pointIds[ v ] + i ] ;
+                }
+            }
+        }
+        double direction[ 3 ] ;
+        PointsToVec( closestPoint , x , direction ) ;
+        return vtkMath::Dot( direction , normal ) < 0.0 ? -distance : distance ;
+    }
+
+private:
+    static void CopyTuples( vtkDataArray* normals , std::vector< TReal > &values )
+    {
+        vtkIdType numberOfTuples = normals ? normals->GetNumberOfTuples() : 0 ;
+        values.resize( 3 * numberOfTuples ) ;
+        for( vtkIdType i = 0 ; i < numberOfTuples ; i++ )
+        {
+            double normal[ 3 ] ;
+            normals->GetTuple( i , normal ) ;
+            for( int j = 0 ; j < 3 ; j++ )
+            {
+                values[ 3 * i + j ] = static_cast< TReal >( normal[ j ] ) ;
+            }
+        }
+    }
+
+    static void WriteHeader( std::ostream &stream , const std::string &key )
+    {
+        stream << "OsteotomyModelToModelDistance target 1 " << sizeof( TReal ) << " " << sizeof( vtkIdType )
+               << " " << key << "\n" ;
+    }
+
+    std::vector< TReal > PointNormals ;
+    std::vector< TReal > CellNormals ;
+    TriangleBVH< TReal > Tree ;
+};
+
+//Computes the distance of each source point to every target in a single pass,
+//so that the source points are visited only once whatever the number of targets
+template< typename TReal , typename TArray >
+class DistanceFunctor
+{
+public:
+    DistanceFunctor( vtkPoints* sourcePoints , const std::vector< DistanceTarget< TReal > > &targets ,
+                     std::vector< vtkSmartPointer< TArray > > &distances , bool signedDistance ) :
+        SourcePoints( sourcePoints ) , Targets( targets ) , Distances( distances ) , SignedDistance( signedDistance ) {}
+
+    void operator()( vtkIdType begin , vtkIdType end )
+    {
+        for( vtkIdType id = begin ; id < end ; id++ )
+        {
+            double x[ 3 ] ;
+            this->SourcePoints->GetPoint( id , x ) ;
+            for( size_t t = 0 ; t < this->Targets.size() ; t++ )
+            {
+                this->Distances[ t ]->SetValue( id , this->Targets[ t ].Distance( x , this->SignedDistance ) ) ;
+            }
+        }
+    }
+
+private:
+    vtkPoints* SourcePoints ;
+    const std::vector< DistanceTarget< TReal > > &Targets ;
+    std::vector< vtkSmartPointer< TArray > > &Distances ;
+    bool SignedDistance ;
+};
+
+//Computes the distances with TReal working copies of the targets and TArray output fields
+template< typename TReal , typename TArray >
+int ComputeDistances( vtkPolyData* distancePolyData ,
+                      std::vector< vtkSmartPointer< vtkPolyData > > &targetPolyDatas ,
+                      bool signedDistance ,
+                      const std::vector< std::string > &outputFieldSuffixes
+                      )
+{
+    std::vector< DistanceTarget< TReal > > targets( targetPolyDatas.size() ) ;
+    for( size_t t = 0 ; t < targetPolyDatas.size() ; t++ )
+    {
+        targets[ t ].Initialize( targetPolyDatas[ t ] ) ;
+        if( targets[ t ].IsEmpty() )
+        {
+            std::cerr << "Target model " << t + 1 << " does not contain any triangle" << std::endl ;
+            return 1 ;
+        }
+    }
+    vtkIdType numberOfPoints = distancePolyData->GetNumberOfPoints() ;
+    //We name the output arrays to match the expected names in 3DMeshMetric
+    std::vector< vtkSmartPointer< TArray > > distances( targets.size() ) ;
+    for( size_t t = 0 ; t < targets.size() ; t++ )
+    {
+        std::string distanceName ;
+        if( signedDistance )
+        {
+            distanceName = "Signed" + outputFieldSuffixes[ t ] ;
+        }
+        else
+        {
+            distanceName = "Absolute" + outputFieldSuffixes[ t ] ;
+        }
+        distances[ t ] = vtkSmartPointer< TArray >::New() ;
+        distances[ t ]->SetName( distanceName.c_str() ) ;
+        distances[ t ]->SetNumberOfValues( numberOfPoints ) ;
+    }
+    if( numberOfPoints > 0 )
+    {
+        DistanceFunctor< TReal , TArray > functor( distancePolyData->GetPoints() , targets , distances , signedDistance ) ;
+        vtkSMPTools::For( 0 , numberOfPoints , functor ) ;
+    }
+    for( size_t t = 0 ; t < distances.size() ; t++ )
+    {
+        distancePolyData->GetPointData()->AddArray( distances[ t ] ) ;
+    }
+    return 0 ;
+}
+
 int ClosestPointDistance( vtkSmartPointer< vtkPolyData > &inPolyData1 ,
-                          vtkSmartPointer< vtkPolyData > &inPolyData2 ,
+                          std::vector< vtkSmartPointer< vtkPolyData > > &targetPolyDatas ,
                           bool signedDistance ,
+                          bool singlePrecision ,
+                          bool originalField ,
                           vtkSmartPointer< vtkPolyData > &outPolyData ,
-                          std::string outputFieldSuffix
+                          const std::vector< std::string > &outputFieldSuffixes
                           )
 {
-    vtkSmartPointer<vtkDistancePolyDataFilter> distanceFilter =
-            vtkSmartPointer<vtkDistancePolyDataFilter>::New();
-    distanceFilter->SetInputData( 0, inPolyData1 ) ;
-    distanceFilter->SetInputData( 1, inPolyData2 ) ;
-    distanceFilter->SetSignedDistance( signedDistance ) ;
-    distanceFilter->Update();
-    //We are only interested in the point distance, not in the cell distance, so we remove the cell distance
-    distanceFilter->GetOutput()->GetCellData()->RemoveArray("Distance") ;
-    //We rename the output array name to match the expected names in 3DMeshMetric
-    std::string distanceName ;
-    if( signedDistance )
-    {
-        distanceName = "Signed" + outputFieldSuffix ;
+    vtkSmartPointer<vtkPolyData> distancePolyData = vtkSmartPointer<vtkPolyData>::New() ;
+    distancePolyData->ShallowCopy( inPolyData1 ) ;
+    int status ;
+    if( singlePrecision )
+    {
+        status = ComputeDistances< float , vtkFloatArray >( distancePolyData , targetPolyDatas , signedDistance , outputFieldSuffixes ) ;
     }
     else
     {
-        distanceName = "Absolute" + outputFieldSuffix;
+        status = ComputeDistances< double , vtkDoubleArray >( distancePolyData , targetPolyDatas , signedDistance , outputFieldSuffixes ) ;
+    }
+    if( status )
+    {
+        return status ;
     }
-    distanceFilter->GetOutput()->GetPointData()->GetArray("Distance")->SetName(distanceName.c_str()) ;
     //We add a constant field that we call "original" that allows to show easily the model with no color map (constant color)
-    vtkSmartPointer<vtkPolyData> distancePolyData = distanceFilter->GetOutput() ;
-    vtkSmartPointer <vtkDoubleArray> ScalarsConst = vtkSmartPointer <vtkDoubleArray>::New();
-    for( vtkIdType Id = 0 ; Id < distancePolyData->GetNumberOfPoints() ; Id++ )
-    {
-        ScalarsConst->InsertTuple1( Id , 1.0 );
-    }
-    ScalarsConst->SetName( "Original" );
-    distancePolyData->GetPointData()->AddArray( ScalarsConst );
-    vtkSmartPointer <vtkCleanPolyData> Cleaner = vtkSmartPointer <vtkCleanPolyData>::New() ;
-    Cleaner->SetInputData( distancePolyData ) ;
-    Cleaner->Update() ;
-    outPolyData = Cleaner->GetOutput() ;
+    if( originalField )
+    {
+        vtkSmartPointer< vtkDataArray > ScalarsConst ;
+        if( singlePrecision )
+        {
+            ScalarsConst = vtkSmartPointer< vtkFloatArray >::New() ;
+        }
+        else
+        {
+            ScalarsConst = vtkSmartPointer< vtkDoubleArray >::New() ;
+        }
+        ScalarsConst->SetNumberOfTuples( distancePolyData->GetNumberOfPoints() ) ;
+        ScalarsConst->FillComponent( 0 , 1.0 ) ;
+        ScalarsConst->SetName( "Original" );
+        distancePolyData->GetPointData()->AddArray( ScalarsConst );
+    }
+    outPolyData = distancePolyData ;
     return 0 ;
 }
 
@@ -211,6 +1163,360 @@ int WriteVTK( std::string output , vtkSmartPointer<vtkPolyData> &polyData )
     return 0 ;
 }
 
+//Key of the target cache: the cached structure is reused only for the same file, unchanged
+std::string TargetCacheKey( const std::string &fileName )
+{
+    std::stringstream key ;
+    key << vtksys::SystemTools::CollapseFullPath( fileName ) << " "
+        << vtksys::SystemTools::FileLength( fileName ) << " "
+        << vtksys::SystemTools::ModifiedTime( fileName ) ;
+    return key.str() ;
+}
+
+//Loads the target from the cache directory if it has been saved there by a previous run,
+//otherwise reads and processes the surface and saves the result to the cache directory
+template< typename TReal >
+int LoadTarget( const std::string &fileName , const std::string &cacheDirectory , DistanceTarget< TReal > &target )
+{
+    std::string cacheFile ;
+    std::string key = TargetCacheKey( fileName ) ;
+    if( !cacheDirectory.empty() )
+    {
+        cacheFile = cacheDirectory + "/" + vtksys::SystemTools::GetFilenameWithoutExtension( fileName ) + ".distancecache" ;
+        if( target.Read( cacheFile , key ) )
+        {
+            return 0 ;
+        }
+    }
+    vtkSmartPointer< vtkPolyData > polyData = vtkSmartPointer< vtkPolyData >::New() ;
+    if( ReadVTK( fileName , polyData ) || PreprocessMesh( polyData ) )
+    {
+        return 1 ;
+    }
+    target.Initialize( polyData ) ;
+    if( !cacheFile.empty() && !target.Write( cacheFile , key ) )
+    {
+        std::cerr << "Could not save the target cache " << cacheFile << std::endl ;
+    }
+    return 0 ;
+}
+
+//Reads the points of a legacy VTK polydata file by chunks. Only the header of each
+//section is parsed when the file is opened, the points are read when requested.
+class LegacyPointReader
+{
+public:
+    LegacyPointReader() :
+        NumberOfPoints( 0 ) ,
+        Binary( false ) ,
+        ValueSize( 0 ) ,
+        PointsOffset( 0 ) ,
+        GeometryEnd( 0 ) {}
+
+    bool Open( const std::string &fileName )
+    {
+        this->File.open( fileName.c_str() , std::ios::binary ) ;
+        std::string line ;
+        if( !std::getline( this->File , line ) || line.find( "vtk DataFile" ) == std::string::npos )
+        {
+            std::cerr << fileName << " is not a legacy VTK file" << std::endl ;
+            return false ;
+        }
+        //Version 5 files store the cells as offsets and connectivity arrays
+        if( line.find( "Version 5" ) != std::string::npos )
+        {
+            std::cerr << "Version 5 legacy VTK files are not handled in streaming mode" << std::endl ;
+            return false ;
+        }
+        std::getline( this->File , line ) ;
+        std::getline( this->File , line ) ;
+        this->Binary = vtksys::SystemTools::UpperCase( line ).find( "BINARY" ) != std::string::npos ;
+        std::string keyword ;
+        std::string type ;
+        this->File >> keyword >> type ;
+        if( vtksys::SystemTools::UpperCase( type ) != "POLYDATA" )
+        {
+            std::cerr << fileName << " does not contain a polydata" << std::endl ;
+            return false ;
+        }
+        //Walk through the geometry sections until the attributes or the end of the file
+        while( true )
+        {
+            this->File >> std::ws ;
+            std::streamoff position = this->File.tellg() ;
+            if( !( this->File >> keyword ) )
+            {
+                this->File.clear() ;
+                this->File.seekg( 0 , std::ios::end ) ;
+                this->GeometryEnd = this->File.tellg() ;
+                break ;
+            }
+            keyword = vtksys::SystemTools::UpperCase( keyword ) ;
+            if( keyword == "POINT_DATA" || keyword == "CELL_DATA" )
+            {
+                this->GeometryEnd = position ;
+                break ;
+            }
+            if( keyword == "POINTS" )
+            {
+                this->File >> this->NumberOfPoints >> type ;
+                if( type == "float" )
+                {
+                    this->ValueSize = 4 ;
+                }
+                else if( type == "double" )
+                {
+                    this->ValueSize = 8 ;
+                }
+                else
+                {
+                    std::cerr << "Points of type " << type << " are not handled in streaming mode" << std::endl ;
+                    return false ;
+                }
+                this->File.ignore( std::numeric_limits< std::streamsize >::max() , '\n' ) ;
+                this->PointsOffset = this->File.tellg() ;
+                this->SkipValues( 3 * this->NumberOfPoints , this->ValueSize ) ;
+            }
+            else if( keyword == "VERTICES" || keyword == "LINES" || keyword == "POLYGONS" || keyword == "TRIANGLE_STRIPS" )
+            {
+                vtkIdType numberOfCells ;
+                vtkIdType size ;
+                this->File >> numberOfCells >> size ;
+                this->File.ignore( std::numeric_limits< std::streamsize >::max() , '\n' ) ;
+                this->SkipValues( size , 4 ) ;
+            }
+            else if( keyword == "METADATA" )
+            {
+                //Information entries, ended by an empty line
+                this->File.ignore( std::numeric_limits< std::streamsize >::max() , '\n' ) ;
+                while( std::getline( this->File , line ) && !vtksys::SystemTools::TrimWhitespace( line ).empty() )
+                {
+                }
+            }
+            else
+            {
+                std::cerr << "Section " << keyword << " of " << fileName << " is not handled in streaming mode" << std::endl ;
+                return false ;
+            }
+            if( !this->File )
+            {
+                std::cerr << "Could not read section " << keyword << " of " << fileName << std::endl ;
+                return false ;
+            }
+        }
+        if( this->ValueSize == 0 )
+        {
+            std::cerr << fileName << " does not contain any point" << std::endl ;
+            return false ;
+        }
+        return true ;
+    }
+
+    vtkIdType GetNumberOfPoints() const
+    {
+        return this->NumberOfPoints ;
+    }
+
+    bool IsBinary() const
+    {
+        return this->Binary ;
+    }
+
+    //Offset of the first attribute section, or size of the file if there is none
+    std::streamoff GetGeometryEnd() const
+    {
+        return this->GeometryEnd ;
+    }
+
+    void Rewind()
+    {
+        this->File.clear() ;
+        this->File.seekg( this->PointsOffset ) ;
+    }
+
+    //Reads the next count points into points, returns false at the end of the file
+    bool ReadPoints( vtkIdType count , double* points )
+    {
+        vtkIdType numberOfValues = 3 * count ;
+        if( !this->Binary )
+        {
+            for( vtkIdType i = 0 ; i < numberOfValues ; i++ )
+            {
+                this->File >> points[ i ] ;
+            }
+            return !this->File.fail() ;
+        }
+        this->Buffer.resize( numberOfValues * this->ValueSize ) ;
+        if( numberOfValues == 0 || !this->File.read( &this->Buffer[ 0 ] , this->Buffer.size() ) )
+        {
+            return numberOfValues == 0 ;
+        }
+        if( this->ValueSize == 4 )
+        {
+            vtkByteSwap::Swap4BERange( &this->Buffer[ 0 ] , numberOfValues ) ;
+            const float* values = reinterpret_cast< const float* >( &this->Buffer[ 0 ] ) ;
+            std::copy( values , values + numberOfValues , points ) ;
+        }
+        else
+        {
+            vtkByteSwap::Swap8BERange( &this->Buffer[ 0 ] , numberOfValues ) ;
+            const double* values = reinterpret_cast< const double* >( &this->Buffer[ 0 ] ) ;
+            std::copy( values , values + numberOfValues , points ) ;
+        }
+        return true ;
+    }
+
+private:
+    void SkipValues( vtkIdType count , int binarySize )
+    {
+        if( this->Binary )
+        {
+            this->File.seekg( static_cast< std::streamoff >( count ) * binarySize , std::ios::cur ) ;
+            return ;
+        }
+        double value ;
+        for( vtkIdType i = 0 ; i < count && this->File ; i++ )
+        {
+            this->File >> value ;
+        }
+    }
+
+    std::ifstream File ;
+    vtkIdType NumberOfPoints ;
+    bool Binary ;
+    int ValueSize ;
+    std::streamoff PointsOffset ;
+    std::streamoff GeometryEnd ;
+    std::vector< char > Buffer ;
+};
+
+//Appends a scalar field to a legacy VTK file, in the format of the rest of the file
+template< typename TReal >
+void WriteLegacyValues( std::ostream &stream , const TReal* values , vtkIdType count , bool binary )
+{
+    if( binary )
+    {
+        if( sizeof( TReal ) == 4 )
+        {
+            vtkByteSwap::SwapWrite4BERange( values , count , &stream ) ;
+        }
+        else
+        {
+            vtkByteSwap::SwapWrite8BERange( values , count , &stream ) ;
+        }
+        return ;
+    }
+    for( vtkIdType i = 0 ; i < count ; i++ )
+    {
+        stream << values[ i ] << "\n" ;
+    }
+}
+
+//Out-of-core version of ClosestPointDistance for legacy VTK files. The source points are
+//read and processed by chunks of chunkSize points and the distances are appended to the
+//output file as they are computed, so only one chunk of the source is in memory at a time.
+//The targets are processed one after the other, each from its compact cached structure.
+//The output contains the geometry of the source as is, followed by the distance fields.
+template< typename TReal , typename TArray >
+int StreamingDistance( const std::string &sourceFile ,
+                       const std::vector< std::string > &targetFiles ,
+                       bool signedDistance ,
+                       bool originalField ,
+                       vtkIdType chunkSize ,
+                       const std::string &cacheDirectory ,
+                       const std::string &outputFile ,
+                       const std::vector< std::string > &outputFieldSuffixes
+                       )
+{
+    LegacyPointReader reader ;
+    if( !reader.Open( sourceFile ) )
+    {
+        return 1 ;
+    }
+    std::ofstream output( outputFile.c_str() , std::ios::binary ) ;
+    if( !output )
+    {
+        std::cerr << "Could not open " << outputFile << std::endl ;
+        return 1 ;
+    }
+    if( !reader.IsBinary() )
+    {
+        output.precision( std::numeric_limits< TReal >::digits10 + 2 ) ;
+    }
+    //Copy the geometry of the source as is
+    {
+        std::ifstream source( sourceFile.c_str() , std::ios::binary ) ;
+        std::vector< char > buffer( 1 << 20 ) ;
+        std::streamoff remaining = reader.GetGeometryEnd() ;
+        while( remaining > 0 )
+        {
+            std::streamsize size = static_cast< std::streamsize >( std::min< std::streamoff >( remaining , buffer.size() ) ) ;
+            source.read( &buffer[ 0 ] , size ) ;
+            output.write( &buffer[ 0 ] , size ) ;
+            remaining -= size ;
+        }
+    }
+    vtkIdType numberOfPoints = reader.GetNumberOfPoints() ;
+    chunkSize = std::max( chunkSize , static_cast< vtkIdType >( 1 ) ) ;
+    std::string typeName = sizeof( TReal ) == 4 ? "float" : "double" ;
+    output << "\nPOINT_DATA " << numberOfPoints << "\n" ;
+    vtkSmartPointer< vtkPoints > chunkPoints = vtkSmartPointer< vtkPoints >::New() ;
+    chunkPoints->SetDataTypeToDouble() ;
+    std::vector< vtkSmartPointer< TArray > > distances( 1 ) ;
+    distances[ 0 ] = vtkSmartPointer< TArray >::New() ;
+    for( size_t t = 0 ; t < targetFiles.size() ; t++ )
+    {
+        std::vector< DistanceTarget< TReal > > targets( 1 ) ;
+        if( LoadTarget( targetFiles[ t ] , cacheDirectory , targets[ 0 ] ) )
+        {
+            return 1 ;
+        }
+        if( targets[ 0 ].IsEmpty() )
+        {
+            std::cerr << "Target model " << t + 1 << " does not contain any triangle" << std::endl ;
+            return 1 ;
+        }
+        //We name the output arrays to match the expected names in 3DMeshMetric
+        std::string distanceName = ( signedDistance ? "Signed" : "Absolute" ) + outputFieldSuffixes[ t ] ;
+        output << "SCALARS " << distanceName << " " << typeName << " 1\nLOOKUP_TABLE default\n" ;
+        reader.Rewind() ;
+        for( vtkIdType chunkStart = 0 ; chunkStart < numberOfPoints ; chunkStart += chunkSize )
+        {
+            vtkIdType count = std::min( chunkSize , numberOfPoints - chunkStart ) ;
+            chunkPoints->SetNumberOfPoints( count ) ;
+            double* points = static_cast< double* >( chunkPoints->GetVoidPointer( 0 ) ) ;
+            if( !reader.ReadPoints( count , points ) )
+            {
+                std::cerr << "Could not read the points of " << sourceFile << std::endl ;
+                return 1 ;
+            }
+            chunkPoints->Modified() ;
+            distances[ 0 ]->SetNumberOfValues( count ) ;
+            DistanceFunctor< TReal , TArray > functor( chunkPoints , targets , distances , signedDistance ) ;
+            vtkSMPTools::For( 0 , count , functor ) ;
+            WriteLegacyValues( output , distances[ 0 ]->GetPointer( 0 ) , count , reader.IsBinary() ) ;
+        }
+        output << "\n" ;
+    }
+    //We add a constant field that we call "original" that allows to show easily the model with no color map (constant color)
+    if( originalField )
+    {
+        output << "SCALARS Original " << typeName << " 1\nLOOKUP_TABLE default\n" ;
+        std::vector< TReal > ones( std::min( chunkSize , numberOfPoints ) , 1 ) ;
+        for( vtkIdType chunkStart = 0 ; chunkStart < numberOfPoints ; chunkStart += chunkSize )
+        {
+            WriteLegacyValues( output , &ones[ 0 ] , std::min( chunkSize , numberOfPoints - chunkStart ) , reader.IsBinary() ) ;
+        }
+        output << "\n" ;
+    }
+    if( !output )
+    {
+        std::cerr << "Caught error saving " << outputFile << std::endl ;
+        return 1 ;
+    }
+    return 0 ;
+}
+
 int main( int argc , char* argv[] )
 {
     PARSE_ARGS ;
@@ -224,37 +1530,78 @@ int main( int argc , char* argv[] )
         std::cout << "Specify an output file name" << std::endl ;
         return 1 ;
     }
-    vtkSmartPointer<vtkPolyData> inPolyData1 = vtkSmartPointer<vtkPolyData>::New() ;
-    if( ReadVTK( vtkFile1 , inPolyData1 ) )
+    //All the targets are processed in the same pass over the source points. The command
+    //line takes at most two of them, the target and the optional second target
+    std::vector< std::string > targetFiles ;
+    targetFiles.push_back( vtkFile2 ) ;
+    if( !vtkFile3.empty() )
     {
-        return 1 ;
+        targetFiles.push_back( vtkFile3 ) ;
     }
-    vtkSmartPointer<vtkPolyData> inPolyData2 = vtkSmartPointer<vtkPolyData>::New() ;
-    if( ReadVTK( vtkFile2 , inPolyData2 ) )
+    std::vector< std::string > outputFieldSuffixes ;
+    for( size_t t = 0 ; t < targetFiles.size() ; t++ )
     {
-        return 1 ;
+        std::string outputFieldSuffix ;
+        if( targetInFields )
+        {
+            outputFieldSuffix = "_to_" + vtksys::SystemTools::GetFilenameWithoutExtension( targetFiles[ t ] ) ;
+        }
+        else if( t > 0 )
+        {
+            std::stringstream suffix ;
+            suffix << "_" << t + 1 ;
+            outputFieldSuffix = suffix.str() ;
+        }
+        outputFieldSuffixes.push_back( outputFieldSuffix ) ;
     }
-    if( TriangulateAndClean( inPolyData1 ) )
+    bool signedDistance = false ;
+    if( distanceType == "signed_closest_point" )
     {
-        return EXIT_FAILURE ;
+        signedDistance = true ;
     }
-    if( TriangulateAndClean( inPolyData2 ) )
+    if( streaming )
     {
-        return EXIT_FAILURE ;
+        if( vtksys::SystemTools::GetFilenameLastExtension( vtkFile1 ) != ".vtk"
+         || vtksys::SystemTools::GetFilenameLastExtension( vtkOutput ) != ".vtk" )
+        {
+            std::cerr << "Streaming mode requires legacy .vtk source and output files" << std::endl ;
+            return 1 ;
+        }
+        if( singlePrecision )
+        {
+            return StreamingDistance< float , vtkFloatArray >( vtkFile1 , targetFiles , signedDistance , !dropOriginalField ,
+                                                               chunkSize , cacheDirectory , vtkOutput , outputFieldSuffixes ) ;
+        }
+        return StreamingDistance< double , vtkDoubleArray >( vtkFile1 , targetFiles , signedDistance , !dropOriginalField ,
+                                                             chunkSize , cacheDirectory , vtkOutput , outputFieldSuffixes ) ;
     }
-    std::string outputFieldSuffix ;
-    if( targetInFields )
+    vtkSmartPointer<vtkPolyData> inPolyData1 = vtkSmartPointer<vtkPolyData>::New() ;
+    if( ReadVTK( vtkFile1 , inPolyData1 ) )
     {
-      outputFieldSuffix = "_to_" + vtksys::SystemTools::GetFilenameWithoutExtension( vtkFile2 ) ;
+        return 1 ;
     }
-    vtkSmartPointer< vtkPolyData > outPolyData ;
-
-    bool signedDistance = false ;
-    if( distanceType == "signed_closest_point" )
+    std::vector< vtkSmartPointer< vtkPolyData > > targetPolyDatas ;
+    for( size_t t = 0 ; t < targetFiles.size() ; t++ )
     {
-        signedDistance = true ;
+        vtkSmartPointer<vtkPolyData> inPolyData2 = vtkSmartPointer<vtkPolyData>::New() ;
+        if( ReadVTK( targetFiles[ t ] , inPolyData2 ) )
+        {
+            return 1 ;
+        }
+        if( PreprocessMesh( inPolyData2 ) )
+        {
+            return EXIT_FAILURE ;
+        }
+        targetPolyDatas.push_back( inPolyData2 ) ;
+    }
+    if( PreprocessMesh( inPolyData1 ) )
+    {
+        return EXIT_FAILURE ;
     }
-    if( ClosestPointDistance( inPolyData1 , inPolyData2 , signedDistance , outPolyData , outputFieldSuffix ) )
+    vtkSmartPointer< vtkPolyData > outPolyData ;
+
+    if( ClosestPointDistance( inPolyData1 , targetPolyDatas , signedDistance , singlePrecision , !dropOriginalField ,
+                              outPolyData , outputFieldSuffixes ) )
     {
         return EXIT_FAILURE ;
     }
@@ -0,0 +1,216 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Planner Logic includes
+#include "vtkPlannerBendSweep.h"
+
+// VTK includes
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkSMPTools.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkPlannerBendSweep);
+
+//----------------------------------------------------------------------------
+//Copy a range of bent points of one sample, for vtkSMPTools
+class vtkPlannerBendSweepStoreFunctor
+{
+public:
+  vtkPoints* BentPoints;
+  float* Positions;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    double p[3];
+    for (vtkIdType i = begin; i < end; i++)
+    {
+      this->BentPoints->GetPoint(i, p);
+      this->Positions[3 * i] = static_cast<float>(p[0]);
+      this->Positions[3 * i + 1] = static_cast<float>(p[1]);
+      this->Positions[3 * i + 2] = static_cast<float>(p[2]);
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+//Blend a range of points of four samples, for vtkSMPTools
+class vtkPlannerBendSweepInterpolateFunctor
+{
+public:
+  const float* Samples[4];
+  double Weights[4];
+  float* Output;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    for (vtkIdType i = 3 * begin; i < 3 * end; i++)
+    {
+      this->Output[i] = static_cast<float>(this->Weights[0] * this->Samples[0][i] +
+        this->Weights[1] * this->Samples[1][i] + this->Weights[2] * this->Samples[2][i] +
+        this->Weights[3] * this->Samples[3][i]);
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+//Constructor
+vtkPlannerBendSweep::vtkPlannerBendSweep()
+{
+  this->Minimum = 0;
+  this->Maximum = 1;
+  this->Aborted = false;
+  this->Complete = false;
+}
+
+//----------------------------------------------------------------------------
+//Destructor
+vtkPlannerBendSweep::~vtkPlannerBendSweep()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendSweep::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "Minimum: " << this->Minimum << "\n";
+  os << indent << "Maximum: " << this->Maximum << "\n";
+  os << indent << "NumberOfSamples: " << this->Transforms.size() << "\n";
+  os << indent << "Complete: " << (this->Complete ? "true" : "false") << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendSweep::SetSampling(double minimum, double maximum, int numberOfSamples)
+{
+  this->Minimum = minimum;
+  this->Maximum = maximum;
+  numberOfSamples = std::max(numberOfSamples, 2);
+  this->Transforms.assign(numberOfSamples, NULL);
+  this->Areas.assign(numberOfSamples, 0);
+  this->Positions.clear();
+  this->Complete = false;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+double vtkPlannerBendSweep::GetSampleMagnitude(int sample)
+{
+  return this->Minimum + (this->Maximum - this->Minimum) * sample / (this->GetNumberOfSamples() - 1);
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendSweep::SetSampleTransform(int sample, vtkAbstractTransform* transform)
+{
+  this->Transforms[sample] = transform;
+}
+
+//----------------------------------------------------------------------------
+vtkAbstractTransform* vtkPlannerBendSweep::GetSampleTransform(int sample)
+{
+  return this->Transforms[sample];
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendSweep::SetSampleArea(int sample, double area)
+{
+  this->Areas[sample] = area;
+}
+
+//----------------------------------------------------------------------------
+bool vtkPlannerBendSweep::Compute()
+{
+  this->Complete = false;
+  vtkIdType numberOfPoints = this->Points ? this->Points->GetNumberOfPoints() : 0;
+  this->Positions.resize(3 * numberOfPoints * this->Transforms.size());
+  for (int sample = 0; sample < this->GetNumberOfSamples(); sample++)
+  {
+    if (this->Aborted || !this->Transforms[sample])
+    {
+      return false;
+    }
+    vtkNew<vtkPoints> bent;
+    bent->SetDataTypeToDouble();
+    this->Transforms[sample]->TransformPoints(this->Points, bent.GetPointer());
+    vtkPlannerBendSweepStoreFunctor functor;
+    functor.BentPoints = bent.GetPointer();
+    functor.Positions = &this->Positions[3 * numberOfPoints * sample];
+    vtkSMPTools::For(0, numberOfPoints, functor);
+  }
+  this->Complete = true;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Uniform Catmull-Rom spline through the samples, repeating the end samples
+int vtkPlannerBendSweep::GetInterpolation(double magnitude, double weights[4])
+{
+  int last = this->GetNumberOfSamples() - 1;
+  double position = (magnitude - this->Minimum) / (this->Maximum - this->Minimum) * last;
+  position = std::min(std::max(position, 0.0), static_cast<double>(last));
+  int sample = std::min(static_cast<int>(std::floor(position)), last - 1);
+  double t = position - sample;
+  double t2 = t * t;
+  double t3 = t2 * t;
+  weights[0] = 0.5 * (-t3 + 2 * t2 - t);
+  weights[1] = 0.5 * (3 * t3 - 5 * t2 + 2);
+  weights[2] = 0.5 * (-3 * t3 + 4 * t2 + t);
+  weights[3] = 0.5 * (t3 - t2);
+  return sample;
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendSweep::InterpolatePoints(double magnitude, vtkPoints* points)
+{
+  if (!this->Complete)
+  {
+    vtkErrorMacro("InterpolatePoints: the sweep is not computed");
+    return;
+  }
+  vtkIdType numberOfPoints = this->Points->GetNumberOfPoints();
+  int last = this->GetNumberOfSamples() - 1;
+  vtkPlannerBendSweepInterpolateFunctor functor;
+  int sample = this->GetInterpolation(magnitude, functor.Weights);
+  for (int j = 0; j < 4; j++)
+  {
+    int neighbor = std::min(std::max(sample - 1 + j, 0), last);
+    functor.Samples[j] = &this->Positions[3 * numberOfPoints * neighbor];
+  }
+  points->SetDataTypeToFloat();
+  points->SetNumberOfPoints(numberOfPoints);
+  functor.Output = static_cast<float*>(points->GetVoidPointer(0));
+  vtkSMPTools::For(0, numberOfPoints, functor);
+  points->Modified();
+}
+
+//----------------------------------------------------------------------------
+double vtkPlannerBendSweep::InterpolateArea(double magnitude)
+{
+  int last = this->GetNumberOfSamples() - 1;
+  double weights[4];
+  int sample = this->GetInterpolation(magnitude, weights);
+  double area = 0;
+  for (int j = 0; j < 4; j++)
+  {
+    area += weights[j] * this->Areas[std::min(std::max(sample - 1 + j, 0), last)];
+  }
+  return area;
+}
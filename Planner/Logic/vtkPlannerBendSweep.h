@@ -0,0 +1,101 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkPlannerBendSweep - bent positions of a model over a range of bend magnitudes
+// .SECTION Description
+// Stores the points of a model bent by one transform per sample magnitude, evenly
+// spaced over a range.  Once computed, the points for any magnitude in the range are
+// interpolated from the samples with a Catmull-Rom spline, in parallel over the points.
+// The bent area of the model can be stored per sample and is interpolated the same way.
+// Compute may run on another thread, it only reads the points and the transforms.
+
+#ifndef __vtkPlannerBendSweep_h
+#define __vtkPlannerBendSweep_h
+
+// VTK includes
+#include "vtkObject.h"
+#include "vtkAbstractTransform.h"
+#include "vtkPoints.h"
+#include "vtkSmartPointer.h"
+
+// STD includes
+#include <atomic>
+#include <vector>
+
+//Self includes
+#include "vtkSlicerPlannerModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_PLANNER_MODULE_LOGIC_EXPORT vtkPlannerBendSweep :
+  public vtkObject
+{
+public:
+
+  static vtkPlannerBendSweep* New();
+  vtkTypeMacro(vtkPlannerBendSweep, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Points to bend, they are not copied and must not change until Compute is done
+  void SetPoints(vtkPoints* points) { this->Points = points; }
+
+  // Range of magnitudes and number of samples over it, at least 2.  Clears the samples.
+  void SetSampling(double minimum, double maximum, int numberOfSamples);
+  int GetNumberOfSamples() { return static_cast<int>(this->Transforms.size()); }
+  double GetSampleMagnitude(int sample);
+
+  // Transform bending the points at a sample
+  void SetSampleTransform(int sample, vtkAbstractTransform* transform);
+  vtkAbstractTransform* GetSampleTransform(int sample);
+
+  // Bent area at a sample
+  void SetSampleArea(int sample, double area);
+
+  // Bend the points by all the sample transforms.  Returns false if aborted, a sweep
+  // cannot be computed again after being aborted.
+  bool Compute();
+  void AbortCompute() { this->Aborted = true; }
+  bool GetAborted() { return this->Aborted; }
+  bool GetComplete() { return this->Complete; }
+
+  // Interpolate the bent points at a magnitude, clamped to the range, into points
+  void InterpolatePoints(double magnitude, vtkPoints* points);
+  double InterpolateArea(double magnitude);
+
+protected:
+  vtkPlannerBendSweep();
+  virtual ~vtkPlannerBendSweep();
+
+  //sample before the magnitude and the Catmull-Rom weights of the samples around it
+  int GetInterpolation(double magnitude, double weights[4]);
+
+  vtkSmartPointer<vtkPoints> Points;
+  double Minimum;
+  double Maximum;
+  std::vector<vtkSmartPointer<vtkAbstractTransform> > Transforms;
+  std::vector<double> Areas;
+  //bent points of every sample, one after the other
+  std::vector<float> Positions;
+  std::atomic<bool> Aborted;
+  std::atomic<bool> Complete;
+
+private:
+  vtkPlannerBendSweep(const vtkPlannerBendSweep&); // Not implemented
+  void operator=(const vtkPlannerBendSweep&); // Not implemented
+};
+
+#endif
@@ -0,0 +1,522 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Planner Logic includes
+#include "vtkPlannerBendTransform.h"
+#include "vtkPlannerTransformPoints.h"
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkPlannerBendTransform);
+
+//----------------------------------------------------------------------------
+//Constructor
+vtkPlannerBendTransform::vtkPlannerBendTransform()
+{
+  this->Sigma = 1.0;
+  this->SupportRadius = 0;
+  this->NumberOfLandmarks = 0;
+  this->Center[0] = this->Center[1] = this->Center[2] = 0;
+  this->Scale = 1;
+  this->GridOrigin[0] = this->GridOrigin[1] = this->GridOrigin[2] = 0;
+  this->GridSpacing = 1;
+  this->GridDimensions[0] = this->GridDimensions[1] = this->GridDimensions[2] = 0;
+}
+
+//----------------------------------------------------------------------------
+//Destructor
+vtkPlannerBendTransform::~vtkPlannerBendTransform()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendTransform::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "Sigma: " << this->Sigma << "\n";
+  os << indent << "SupportRadius: " << this->SupportRadius << "\n";
+  os << indent << "NumberOfLandmarks: " << this->NumberOfLandmarks << "\n";
+}
+
+//----------------------------------------------------------------------------
+//Basis over a distance between normalized points: the R basis r, or the Wendland basis
+//(1 - r)^4 (4r + 1) with r relative to the support radius.  Dividing the R basis by Sigma
+//would only divide the radial weights by it, so it is left out of the system.
+void vtkPlannerBendTransform::EvaluateBasis(double distance, double& value, double& derivative) const
+{
+  if (this->SupportRadius <= 0)
+  {
+    value = distance;
+    derivative = 1.0;
+    return;
+  }
+  double radius = this->SupportRadius / this->Scale;
+  double r = distance / radius;
+  if (r >= 1)
+  {
+    value = derivative = 0;
+    return;
+  }
+  double s = 1 - r;
+  value = s * s * s * s * (4 * r + 1);
+  derivative = -20 * r * s * s * s / radius;
+}
+
+//----------------------------------------------------------------------------
+//Sort the landmarks into a grid with cells at least as large as the support radius, so
+//the landmarks supporting a point are all in the 27 cells around it
+void vtkPlannerBendTransform::BuildLandmarkGrid()
+{
+  this->GridStarts.clear();
+  this->GridLandmarks.clear();
+  vtkIdType n = this->NumberOfLandmarks;
+  if (this->SupportRadius <= 0 || n == 0)
+  {
+    return;
+  }
+  double bounds[6] = { VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX };
+  for (vtkIdType i = 0; i < n; i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      bounds[2 * k] = std::min(bounds[2 * k], this->Sources[3 * i + k]);
+      bounds[2 * k + 1] = std::max(bounds[2 * k + 1], this->Sources[3 * i + k]);
+    }
+  }
+  double extent = std::max(bounds[1] - bounds[0], std::max(bounds[3] - bounds[2], bounds[5] - bounds[4]));
+  this->GridSpacing = std::max(this->SupportRadius / this->Scale, extent / 64);
+  for (int k = 0; k < 3; k++)
+  {
+    this->GridOrigin[k] = bounds[2 * k];
+    this->GridDimensions[k] = static_cast<int>((bounds[2 * k + 1] - bounds[2 * k]) / this->GridSpacing) + 1;
+  }
+  vtkIdType numberOfCells = static_cast<vtkIdType>(this->GridDimensions[0]) * this->GridDimensions[1] * this->GridDimensions[2];
+  std::vector<vtkIdType> cells(n);
+  this->GridStarts.assign(numberOfCells + 1, 0);
+  for (vtkIdType i = 0; i < n; i++)
+  {
+    int c[3];
+    for (int k = 0; k < 3; k++)
+    {
+      c[k] = std::min(static_cast<int>((this->Sources[3 * i + k] - this->GridOrigin[k]) / this->GridSpacing), this->GridDimensions[k] - 1);
+    }
+    cells[i] = c[0] + this->GridDimensions[0] * (c[1] + static_cast<vtkIdType>(this->GridDimensions[1]) * c[2]);
+    this->GridStarts[cells[i] + 1]++;
+  }
+  for (vtkIdType c = 0; c < numberOfCells; c++)
+  {
+    this->GridStarts[c + 1] += this->GridStarts[c];
+  }
+  this->GridLandmarks.resize(n);
+  std::vector<vtkIdType> next(this->GridStarts.begin(), this->GridStarts.end() - 1);
+  for (vtkIdType i = 0; i < n; i++)
+  {
+    this->GridLandmarks[next[cells[i]]++] = i;
+  }
+}
+
+//----------------------------------------------------------------------------
+//Only the landmarks in the grid cells around the point are visited with the compact basis.
+//The point is normalized as the landmarks, and so is the derivative.
+void vtkPlannerBendTransform::AddRadialPart(const double in[3], double out[3], double (*derivative)[3]) const
+{
+  vtkIdType first = 0;
+  vtkIdType last = this->NumberOfLandmarks;
+  int low[3] = { 0, 0, 0 };
+  int high[3] = { 0, 0, 0 };
+  if (this->SupportRadius > 0)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      double c = std::floor((in[k] - this->GridOrigin[k]) / this->GridSpacing);
+      if (c < -1 || c > this->GridDimensions[k])
+      {
+        return;
+      }
+      low[k] = std::max(static_cast<int>(c) - 1, 0);
+      high[k] = std::min(static_cast<int>(c) + 1, this->GridDimensions[k] - 1);
+    }
+  }
+  for (int z = low[2]; z <= high[2]; z++)
+  {
+    for (int y = low[1]; y <= high[1]; y++)
+    {
+      for (int x = low[0]; x <= high[0]; x++)
+      {
+        if (this->SupportRadius > 0)
+        {
+          vtkIdType cell = x + this->GridDimensions[0] * (y + static_cast<vtkIdType>(this->GridDimensions[1]) * z);
+          first = this->GridStarts[cell];
+          last = this->GridStarts[cell + 1];
+        }
+        for (vtkIdType j = first; j < last; j++)
+        {
+          vtkIdType i = this->SupportRadius > 0 ? this->GridLandmarks[j] : j;
+          const double* s = &this->Sources[3 * i];
+          double d[3] = { in[0] - s[0], in[1] - s[1], in[2] - s[2] };
+          double distance = vtkMath::Norm(d);
+          double value;
+          double slope;
+          this->EvaluateBasis(distance, value, slope);
+          const double* w = &this->Coefficients[3 * i];
+          out[0] += w[0] * value;
+          out[1] += w[1] * value;
+          out[2] += w[2] * value;
+          if (derivative && distance > 0)
+          {
+            for (int k = 0; k < 3; k++)
+            {
+              double scale = slope * d[k] / distance;
+              derivative[0][k] += w[0] * scale;
+              derivative[1][k] += w[1] * scale;
+              derivative[2][k] += w[2] * scale;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//Build and decompose the landmark system [K P; P^T 0], where K holds the radial
+//basis between source landmarks and P their homogeneous coordinates.  The system
+//is symmetric but indefinite, and singular when the landmarks are coplanar, so it
+//is decomposed into eigenvectors and the null space is left out of its inverse.
+//The landmarks are centered and scaled to unit size first: in millimeters K and P
+//differ by orders of magnitude, and the eigenvalues of the affine constraints would
+//fall under the cutoff of the null space along with it.
+void vtkPlannerBendTransform::SetSourceLandmarks(vtkPoints* source)
+{
+  vtkIdType n = source ? source->GetNumberOfPoints() : 0;
+  this->NumberOfLandmarks = n;
+  this->Sources.resize(3 * n);
+  this->Center[0] = this->Center[1] = this->Center[2] = 0;
+  for (vtkIdType i = 0; i < n; i++)
+  {
+    source->GetPoint(i, &this->Sources[3 * i]);
+    for (int k = 0; k < 3; k++)
+    {
+      this->Center[k] += this->Sources[3 * i + k] / n;
+    }
+  }
+  double spread = 0;
+  for (vtkIdType i = 0; i < n; i++)
+  {
+    spread += vtkMath::Distance2BetweenPoints(&this->Sources[3 * i], this->Center) / n;
+  }
+  this->Scale = spread > 0 ? std::sqrt(spread) : 1;
+  for (vtkIdType i = 0; i < 3 * n; i++)
+  {
+    this->Sources[i] = (this->Sources[i] - this->Center[i % 3]) / this->Scale;
+  }
+  this->Coefficients.assign(3 * (n + 4), 0);
+  if (n == 0)
+  {
+    this->Eigenvectors.clear();
+    this->InverseEigenvalues.clear();
+    this->BuildLandmarkGrid();
+    this->Modified();
+    return;
+  }
+
+  int size = static_cast<int>(n + 4);
+  std::vector<double> system(size * size, 0);
+  std::vector<double*> systemRows(size);
+  this->Eigenvectors.assign(size * size, 0);
+  std::vector<double*> eigenvectorRows(size);
+  for (int i = 0; i < size; i++)
+  {
+    systemRows[i] = &system[i * size];
+    eigenvectorRows[i] = &this->Eigenvectors[i * size];
+  }
+  for (vtkIdType i = 0; i < n; i++)
+  {
+    const double* p = &this->Sources[3 * i];
+    for (vtkIdType j = 0; j <= i; j++)
+    {
+      double value;
+      double slope;
+      this->EvaluateBasis(std::sqrt(vtkMath::Distance2BetweenPoints(p, &this->Sources[3 * j])), value, slope);
+      systemRows[i][j] = systemRows[j][i] = value;
+    }
+    systemRows[i][n] = systemRows[n][i] = 1;
+    for (int k = 0; k < 3; k++)
+    {
+      systemRows[i][n + 1 + k] = systemRows[n + 1 + k][i] = p[k];
+    }
+  }
+  std::vector<double> eigenvalues(size);
+  if (!vtkMath::JacobiN(&systemRows[0], size, &eigenvalues[0], &eigenvectorRows[0]))
+  {
+    vtkWarningMacro("SetSourceLandmarks: decomposition of the landmark system did not converge");
+  }
+
+  double largest = 0;
+  for (int i = 0; i < size; i++)
+  {
+    largest = std::max(largest, std::fabs(eigenvalues[i]));
+  }
+  this->InverseEigenvalues.assign(size, 0);
+  for (int i = 0; i < size; i++)
+  {
+    if (std::fabs(eigenvalues[i]) > 1e-10 * largest)
+    {
+      this->InverseEigenvalues[i] = 1.0 / eigenvalues[i];
+    }
+  }
+  this->BuildLandmarkGrid();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+//Coefficients = V * diag(1/w) * V^T * [targets; 0]
+bool vtkPlannerBendTransform::ComputeCoefficients(vtkPoints* target, std::vector<double>& coefficients)
+{
+  vtkIdType n = this->NumberOfLandmarks;
+  if (!target || target->GetNumberOfPoints() != n)
+  {
+    vtkErrorMacro("ComputeCoefficients: expected " << n << " target landmarks");
+    return false;
+  }
+  vtkIdType size = n + 4;
+  if (n > 0 && static_cast<vtkIdType>(this->Eigenvectors.size()) != size * size)
+  {
+    vtkErrorMacro("ComputeCoefficients: the landmark system is not decomposed");
+    return false;
+  }
+  coefficients.assign(3 * size, 0);
+  if (n == 0)
+  {
+    return true;
+  }
+  std::vector<double> projection(3 * size, 0);
+  for (vtkIdType i = 0; i < n; i++)
+  {
+    double q[3];
+    target->GetPoint(i, q);
+    const double* row = &this->Eigenvectors[i * size];
+    for (vtkIdType j = 0; j < size; j++)
+    {
+      projection[3 * j] += row[j] * q[0];
+      projection[3 * j + 1] += row[j] * q[1];
+      projection[3 * j + 2] += row[j] * q[2];
+    }
+  }
+  for (vtkIdType j = 0; j < size; j++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      projection[3 * j + k] *= this->InverseEigenvalues[j];
+    }
+  }
+  for (vtkIdType i = 0; i < size; i++)
+  {
+    const double* row = &this->Eigenvectors[i * size];
+    double c[3] = { 0, 0, 0 };
+    for (vtkIdType j = 0; j < size; j++)
+    {
+      c[0] += row[j] * projection[3 * j];
+      c[1] += row[j] * projection[3 * j + 1];
+      c[2] += row[j] * projection[3 * j + 2];
+    }
+    for (int k = 0; k < 3; k++)
+    {
+      coefficients[3 * i + k] = c[k];
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendTransform::SetTargetLandmarks(vtkPoints* target)
+{
+  if (this->ComputeCoefficients(target, this->Coefficients))
+  {
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+//Only what evaluating the spline needs is copied, the decomposition is left out
+void vtkPlannerBendTransform::ComputeSpline(vtkPoints* target, vtkPlannerBendTransform* spline)
+{
+  if (!this->ComputeCoefficients(target, spline->Coefficients))
+  {
+    return;
+  }
+  spline->Sigma = this->Sigma;
+  spline->SupportRadius = this->SupportRadius;
+  spline->NumberOfLandmarks = this->NumberOfLandmarks;
+  spline->Scale = this->Scale;
+  spline->Sources = this->Sources;
+  spline->Eigenvectors.clear();
+  spline->InverseEigenvalues.clear();
+  for (int k = 0; k < 3; k++)
+  {
+    spline->Center[k] = this->Center[k];
+    spline->GridOrigin[k] = this->GridOrigin[k];
+    spline->GridDimensions[k] = this->GridDimensions[k];
+  }
+  spline->GridSpacing = this->GridSpacing;
+  spline->GridStarts = this->GridStarts;
+  spline->GridLandmarks = this->GridLandmarks;
+  spline->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendTransform::ForwardTransformPoint(const double in[3], double out[3])
+{
+  vtkIdType n = this->NumberOfLandmarks;
+  if (n == 0)
+  {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+    return;
+  }
+  double p[3];
+  for (int k = 0; k < 3; k++)
+  {
+    p[k] = (in[k] - this->Center[k]) / this->Scale;
+  }
+  const double* affine = &this->Coefficients[3 * n];
+  for (int k = 0; k < 3; k++)
+  {
+    out[k] = affine[k] + p[0] * affine[3 + k] + p[1] * affine[6 + k] + p[2] * affine[9 + k];
+  }
+  this->AddRadialPart(p, out, NULL);
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendTransform::ForwardTransformPoint(const float in[3], float out[3])
+{
+  double p[3] = { in[0], in[1], in[2] };
+  double q[3];
+  this->ForwardTransformPoint(p, q);
+  out[0] = static_cast<float>(q[0]);
+  out[1] = static_cast<float>(q[1]);
+  out[2] = static_cast<float>(q[2]);
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendTransform::ForwardTransformDerivative(const double in[3], double out[3], double derivative[3][3])
+{
+  vtkIdType n = this->NumberOfLandmarks;
+  if (n == 0)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      out[j] = in[j];
+      derivative[j][0] = derivative[j][1] = derivative[j][2] = 0;
+      derivative[j][j] = 1;
+    }
+    return;
+  }
+  double p[3];
+  for (int k = 0; k < 3; k++)
+  {
+    p[k] = (in[k] - this->Center[k]) / this->Scale;
+  }
+  const double* affine = &this->Coefficients[3 * n];
+  for (int j = 0; j < 3; j++)
+  {
+    out[j] = affine[j] + p[0] * affine[3 + j] + p[1] * affine[6 + j] + p[2] * affine[9 + j];
+    for (int k = 0; k < 3; k++)
+    {
+      derivative[j][k] = affine[3 * (k + 1) + j];
+    }
+  }
+  this->AddRadialPart(p, out, derivative);
+
+  //the derivative is over the normalized point
+  for (int j = 0; j < 3; j++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      derivative[j][k] /= this->Scale;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendTransform::ForwardTransformDerivative(const float in[3], float out[3], float derivative[3][3])
+{
+  double p[3] = { in[0], in[1], in[2] };
+  double q[3];
+  double d[3][3];
+  this->ForwardTransformDerivative(p, q, d);
+  for (int j = 0; j < 3; j++)
+  {
+    out[j] = static_cast<float>(q[j]);
+    for (int k = 0; k < 3; k++)
+    {
+      derivative[j][k] = static_cast<float>(d[j][k]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//Same as vtkAbstractTransform::TransformPoints, with the points split between threads
+void vtkPlannerBendTransform::TransformPoints(vtkPoints* inPts, vtkPoints* outPts)
+{
+  vtkPlannerTransformPoints(this, inPts, outPts);
+}
+
+//----------------------------------------------------------------------------
+//Same as vtkAbstractTransform::TransformPointsNormalsVectors without vectors, in parallel
+void vtkPlannerBendTransform::TransformPointsNormals(vtkPoints* inPts, vtkPoints* outPts, vtkDataArray* inNms, vtkDataArray* outNms)
+{
+  vtkPlannerTransformPoints(this, inPts, outPts, inNms, outNms);
+}
+
+//----------------------------------------------------------------------------
+vtkAbstractTransform* vtkPlannerBendTransform::MakeTransform()
+{
+  return vtkPlannerBendTransform::New();
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBendTransform::InternalDeepCopy(vtkAbstractTransform* transform)
+{
+  vtkPlannerBendTransform* bendTransform = static_cast<vtkPlannerBendTransform*>(transform);
+  this->Superclass::InternalDeepCopy(transform);
+  this->Sigma = bendTransform->Sigma;
+  this->SupportRadius = bendTransform->SupportRadius;
+  this->NumberOfLandmarks = bendTransform->NumberOfLandmarks;
+  this->Scale = bendTransform->Scale;
+  this->Sources = bendTransform->Sources;
+  this->Eigenvectors = bendTransform->Eigenvectors;
+  this->InverseEigenvalues = bendTransform->InverseEigenvalues;
+  this->Coefficients = bendTransform->Coefficients;
+  for (int k = 0; k < 3; k++)
+  {
+    this->Center[k] = bendTransform->Center[k];
+    this->GridOrigin[k] = bendTransform->GridOrigin[k];
+    this->GridDimensions[k] = bendTransform->GridDimensions[k];
+  }
+  this->GridSpacing = bendTransform->GridSpacing;
+  this->GridStarts = bendTransform->GridStarts;
+  this->GridLandmarks = bendTransform->GridLandmarks;
+}
@@ -0,0 +1,127 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkPlannerBendTransform - thin plate spline with fixed source landmarks
+// .SECTION Description
+// Thin plate spline warp with the R basis, as vtkThinPlateSplineTransform, for the
+// case where the source landmarks stay the same while the target landmarks change.
+// The landmark system only depends on the source landmarks, so it is decomposed once
+// when they are set and each new set of target landmarks only costs a product with
+// the decomposition, instead of a full solve.
+// Optionally the R basis is replaced by a compactly supported Wendland basis, so that
+// each point is only influenced by the landmarks within the support radius, which are
+// found through a grid over the landmarks.  Points are transformed in parallel.
+
+#ifndef __vtkPlannerBendTransform_h
+#define __vtkPlannerBendTransform_h
+
+// VTK includes
+#include "vtkWarpTransform.h"
+#include "vtkDataArray.h"
+#include "vtkPoints.h"
+#include "vtkSmartPointer.h"
+
+// STD includes
+#include <vector>
+
+//Self includes
+#include "vtkSlicerPlannerModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_PLANNER_MODULE_LOGIC_EXPORT vtkPlannerBendTransform :
+  public vtkWarpTransform
+{
+public:
+
+  static vtkPlannerBendTransform* New();
+  vtkTypeMacro(vtkPlannerBendTransform, vtkWarpTransform);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Scale of the R basis, as in vtkThinPlateSplineTransform.  The warp does not depend
+  // on it: the system is solved on landmarks centered and scaled to unit size.
+  vtkSetMacro(Sigma, double);
+  vtkGetMacro(Sigma, double);
+
+  // Radius of the compactly supported basis, or 0 for the R basis.  Must be set before
+  // the source landmarks.
+  vtkSetClampMacro(SupportRadius, double, 0, VTK_DOUBLE_MAX);
+  vtkGetMacro(SupportRadius, double);
+
+  // Set the source landmarks and decompose the landmark system.  The points are copied.
+  void SetSourceLandmarks(vtkPoints* source);
+  vtkIdType GetNumberOfLandmarks() { return this->NumberOfLandmarks; }
+
+  // Compute the spline coefficients for new target landmarks, one per source landmark
+  void SetTargetLandmarks(vtkPoints* target);
+
+  // Give spline the source landmarks of this one and the coefficients for new target
+  // landmarks, without the decomposition, so it cannot be given other targets.  This
+  // spline is left unchanged, and spline shares no data with it.
+  void ComputeSpline(vtkPoints* target, vtkPlannerBendTransform* spline);
+
+  // Transform the points in parallel
+  void TransformPoints(vtkPoints* inPts, vtkPoints* outPts);
+
+  // Transform the points and their normals in parallel.  The normals go through the
+  // derivative of the transform, so their order and orientation are kept.
+  void TransformPointsNormals(vtkPoints* inPts, vtkPoints* outPts, vtkDataArray* inNms, vtkDataArray* outNms);
+
+  vtkAbstractTransform* MakeTransform();
+
+protected:
+  vtkPlannerBendTransform();
+  virtual ~vtkPlannerBendTransform();
+
+  void InternalDeepCopy(vtkAbstractTransform* transform);
+
+  void ForwardTransformPoint(const float in[3], float out[3]);
+  void ForwardTransformPoint(const double in[3], double out[3]);
+  void ForwardTransformDerivative(const float in[3], float out[3], float derivative[3][3]);
+  void ForwardTransformDerivative(const double in[3], double out[3], double derivative[3][3]);
+
+  //basis value and its derivative over the distance
+  void EvaluateBasis(double distance, double& value, double& derivative) const;
+  //add the radial part of the spline at in to out, and its derivative if given
+  void AddRadialPart(const double in[3], double out[3], double (*derivative)[3]) const;
+  void BuildLandmarkGrid();
+  bool ComputeCoefficients(vtkPoints* target, std::vector<double>& coefficients);
+
+  double Sigma;
+  double SupportRadius;
+  vtkIdType NumberOfLandmarks;
+  //source landmarks centered on Center and divided by Scale, as the points evaluated
+  double Center[3];
+  double Scale;
+  std::vector<double> Sources;
+  //eigen decomposition of the landmark system, by columns, and inverted eigenvalues
+  std::vector<double> Eigenvectors;
+  std::vector<double> InverseEigenvalues;
+  //radial weights of the landmarks followed by the affine part, 3 values per row
+  std::vector<double> Coefficients;
+  //landmarks sorted by grid cell, used with the compact basis
+  double GridOrigin[3];
+  double GridSpacing;
+  int GridDimensions[3];
+  std::vector<vtkIdType> GridStarts;
+  std::vector<vtkIdType> GridLandmarks;
+
+private:
+  vtkPlannerBendTransform(const vtkPlannerBendTransform&); // Not implemented
+  void operator=(const vtkPlannerBendTransform&); // Not implemented
+};
+
+#endif
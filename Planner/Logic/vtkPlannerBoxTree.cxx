@@ -0,0 +1,143 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Planner Logic includes
+#include "vtkPlannerBoxTree.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+//Order of items by their centers along an axis
+struct vtkPlannerBoxCenterLess
+{
+  const double* Centers;
+  int Axis;
+
+  bool operator()(vtkIdType a, vtkIdType b) const
+  {
+    return this->Centers[3 * a + this->Axis] < this->Centers[3 * b + this->Axis];
+  }
+};
+
+//----------------------------------------------------------------------------
+void vtkPlannerBoxTree::Build(vtkIdType numberOfItems, const double* bounds, std::vector<vtkIdType>& order)
+{
+  this->Nodes.clear();
+  order.resize(numberOfItems);
+  if (numberOfItems == 0)
+  {
+    return;
+  }
+  std::vector<double> centers(3 * numberOfItems);
+  for (vtkIdType i = 0; i < numberOfItems; i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      centers[3 * i + k] = 0.5 * (bounds[6 * i + 2 * k] + bounds[6 * i + 2 * k + 1]);
+    }
+    order[i] = i;
+  }
+  this->Nodes.reserve(2 * numberOfItems / LeafSize + 1);
+  this->BuildNode(0, numberOfItems, bounds, centers, order);
+}
+
+//----------------------------------------------------------------------------
+//Bound the items of the range and split them at the median of their centers along the
+//longest side of the box
+int vtkPlannerBoxTree::BuildNode(vtkIdType begin, vtkIdType end, const double* bounds,
+  const std::vector<double>& centers, std::vector<vtkIdType>& order)
+{
+  int index = static_cast<int>(this->Nodes.size());
+  this->Nodes.push_back(Node());
+  Node node;
+  node.Begin = begin;
+  node.End = end;
+  node.Children[0] = -1;
+  node.Children[1] = -1;
+  for (int k = 0; k < 3; k++)
+  {
+    node.Bounds[2 * k] = VTK_DOUBLE_MAX;
+    node.Bounds[2 * k + 1] = -VTK_DOUBLE_MAX;
+  }
+  for (vtkIdType i = begin; i < end; i++)
+  {
+    const double* item = bounds + 6 * order[i];
+    for (int k = 0; k < 3; k++)
+    {
+      node.Bounds[2 * k] = std::min(node.Bounds[2 * k], item[2 * k]);
+      node.Bounds[2 * k + 1] = std::max(node.Bounds[2 * k + 1], item[2 * k + 1]);
+    }
+  }
+
+  if (end - begin > LeafSize)
+  {
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+    {
+      if (node.Bounds[2 * k + 1] - node.Bounds[2 * k] > node.Bounds[2 * axis + 1] - node.Bounds[2 * axis])
+      {
+        axis = k;
+      }
+    }
+    vtkIdType middle = begin + (end - begin) / 2;
+    vtkPlannerBoxCenterLess less = { &centers[0], axis };
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, less);
+    node.Children[0] = this->BuildNode(begin, middle, bounds, centers, order);
+    node.Children[1] = this->BuildNode(middle, end, bounds, centers, order);
+  }
+  this->Nodes[index] = node;
+  return index;
+}
+
+//----------------------------------------------------------------------------
+double vtkPlannerBoxTree::BoxDistance2(const double bounds[6], const double x[3])
+{
+  double dist2 = 0;
+  for (int k = 0; k < 3; k++)
+  {
+    double d = std::max(std::max(bounds[2 * k] - x[k], x[k] - bounds[2 * k + 1]), 0.0);
+    dist2 += d * d;
+  }
+  return dist2;
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerBoxTree::TransformBounds(const double bounds[6], const double m[12], double transformed[6])
+{
+  for (int k = 0; k < 3; k++)
+  {
+    //the extent along each axis adds up from the extents of the box along the rows
+    double center = m[4 * k + 3];
+    double radius = 0;
+    for (int j = 0; j < 3; j++)
+    {
+      center += m[4 * k + j] * 0.5 * (bounds[2 * j] + bounds[2 * j + 1]);
+      radius += std::fabs(m[4 * k + j]) * 0.5 * (bounds[2 * j + 1] - bounds[2 * j]);
+    }
+    transformed[2 * k] = center - radius;
+    transformed[2 * k + 1] = center + radius;
+  }
+}
+
+//----------------------------------------------------------------------------
+bool vtkPlannerBoxTree::BoundsOverlap(const double a[6], const double b[6], double tolerance)
+{
+  return a[0] <= b[1] + tolerance && b[0] <= a[1] + tolerance && a[2] <= b[3] + tolerance &&
+    b[2] <= a[3] + tolerance && a[4] <= b[5] + tolerance && b[4] <= a[5] + tolerance;
+}
@@ -0,0 +1,197 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkPlannerBoxTree - bounding volume hierarchy of the planner surface indices
+// .SECTION Description
+// Binary tree of axis aligned boxes over items given by their bounds: the triangles of
+// vtkPlannerTriangleIndex and the segments of vtkPlannerPlaneSection.  Each node splits
+// its items at the median of their centers along its longest side, so the depth of the
+// tree is logarithmic in the number of items, and the items of a node are a range of the
+// leaf order.  The walks are templates over the test of the items of a leaf, which the
+// owner of the items provides.
+
+#ifndef __vtkPlannerBoxTree_h
+#define __vtkPlannerBoxTree_h
+
+// VTK includes
+#include "vtkType.h"
+
+// STD includes
+#include <utility>
+#include <vector>
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class vtkPlannerBoxTree
+{
+public:
+
+  //box of the items [Begin, End) of the leaf order, a leaf when it has no children
+  struct Node
+  {
+    double Bounds[6];
+    int Children[2];
+    vtkIdType Begin;
+    vtkIdType End;
+  };
+
+  // Leaves hold at most this many items
+  static const vtkIdType LeafSize = 4;
+
+  // Nodes left to visit by a closest point query.  A deeper node is searched through
+  // instead of split, its range holds all its items.
+  static const int MaximumStackSize = 128;
+
+  // Build the tree over numberOfItems items with six packed bounds each.  order is set
+  // to the ids of the items in leaf order.
+  void Build(vtkIdType numberOfItems, const double* bounds, std::vector<vtkIdType>& order);
+
+  void Clear() { this->Nodes.clear(); }
+  bool IsEmpty() const { return this->Nodes.empty(); }
+  vtkIdType GetNumberOfNodes() const { return static_cast<vtkIdType>(this->Nodes.size()); }
+
+  // Bounds of all the items, the root box.  The tree must not be empty.
+  const double* GetBounds() const { return this->Nodes[0].Bounds; }
+
+  // Squared distance from a point to a box, 0 inside
+  static double BoxDistance2(const double bounds[6], const double x[3]);
+
+  // Bounds of a box moved by an affine matrix, given by its first three rows
+  static void TransformBounds(const double bounds[6], const double m[12], double transformed[6]);
+
+  // True if the boxes are closer than tolerance along each axis
+  static bool BoundsOverlap(const double a[6], const double b[6], double tolerance = 0);
+
+  // Smallest squared distance to x of the items, or VTK_DOUBLE_MAX.  The boxes are
+  // visited nearest first, skipping those farther than the closest item so far.
+  // search(begin, end, best) tests the items [begin, end) of a leaf and returns the
+  // smaller of best and their squared distance to x.
+  template <class LeafSearch>
+  double FindClosest(const double x[3], LeafSearch& search) const;
+
+  // Walk this tree and other together, splitting the larger box of each pair closer than
+  // tolerance until both are leaves.  The boxes of other are moved into this tree by the
+  // first three rows m of an affine matrix as they are visited.  visit(node, otherNode)
+  // tests the items of two leaves and returns true to stop the walk, which is then
+  // returned.
+  template <class LeafVisit>
+  bool VisitOverlappingLeaves(const vtkPlannerBoxTree& other, const double m[12], double tolerance,
+    LeafVisit& visit) const;
+
+protected:
+  int BuildNode(vtkIdType begin, vtkIdType end, const double* bounds, const std::vector<double>& centers,
+    std::vector<vtkIdType>& order);
+
+  std::vector<Node> Nodes;
+};
+
+//----------------------------------------------------------------------------
+template <class LeafSearch>
+double vtkPlannerBoxTree::FindClosest(const double x[3], LeafSearch& search) const
+{
+  double best = VTK_DOUBLE_MAX;
+  if (this->Nodes.empty())
+  {
+    return best;
+  }
+
+  int stack[MaximumStackSize];
+  int size = 0;
+  stack[size++] = 0;
+  while (size > 0)
+  {
+    const Node& node = this->Nodes[stack[--size]];
+    if (BoxDistance2(node.Bounds, x) >= best)
+    {
+      continue;
+    }
+    if (node.Children[0] >= 0 && size + 2 <= MaximumStackSize)
+    {
+      int nearChild = node.Children[0];
+      int farChild = node.Children[1];
+      if (BoxDistance2(this->Nodes[farChild].Bounds, x) < BoxDistance2(this->Nodes[nearChild].Bounds, x))
+      {
+        std::swap(nearChild, farChild);
+      }
+      stack[size++] = farChild;
+      stack[size++] = nearChild;
+      continue;
+    }
+    best = search(node.Begin, node.End, best);
+  }
+  return best;
+}
+
+//----------------------------------------------------------------------------
+template <class LeafVisit>
+bool vtkPlannerBoxTree::VisitOverlappingLeaves(const vtkPlannerBoxTree& other, const double m[12],
+  double tolerance, LeafVisit& visit) const
+{
+  if (this->Nodes.empty() || other.Nodes.empty())
+  {
+    return false;
+  }
+
+  std::vector<std::pair<int, int> > stack;
+  stack.push_back(std::make_pair(0, 0));
+  while (!stack.empty())
+  {
+    std::pair<int, int> pair = stack.back();
+    stack.pop_back();
+    const Node& node = this->Nodes[pair.first];
+    const Node& otherNode = other.Nodes[pair.second];
+    double otherBounds[6];
+    TransformBounds(otherNode.Bounds, m, otherBounds);
+    if (!BoundsOverlap(node.Bounds, otherBounds, tolerance))
+    {
+      continue;
+    }
+
+    bool leaf = node.Children[0] < 0;
+    bool otherLeaf = otherNode.Children[0] < 0;
+    if (!leaf && !otherLeaf)
+    {
+      double size = 0;
+      double otherSize = 0;
+      for (int k = 0; k < 3; k++)
+      {
+        size += node.Bounds[2 * k + 1] - node.Bounds[2 * k];
+        otherSize += otherBounds[2 * k + 1] - otherBounds[2 * k];
+      }
+      leaf = size < otherSize;
+      otherLeaf = !leaf;
+    }
+    if (!leaf)
+    {
+      stack.push_back(std::make_pair(node.Children[0], pair.second));
+      stack.push_back(std::make_pair(node.Children[1], pair.second));
+      continue;
+    }
+    if (!otherLeaf)
+    {
+      stack.push_back(std::make_pair(pair.first, otherNode.Children[0]));
+      stack.push_back(std::make_pair(pair.first, otherNode.Children[1]));
+      continue;
+    }
+    if (visit(node, otherNode))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Planner Logic includes
+#include "vtkPlannerHingeTransform.h"
+#include "vtkPlannerTransformPoints.h"
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkPlannerHingeTransform);
+
+//----------------------------------------------------------------------------
+//Constructor
+vtkPlannerHingeTransform::vtkPlannerHingeTransform()
+{
+  for (int k = 0; k < 3; k++)
+  {
+    this->AxisOrigin[k] = this->AxisDirection[k] = 0;
+    this->PlaneOrigin[k] = this->PlaneNormal[k] = 0;
+  }
+  this->AxisDirection[2] = 1;
+  this->PlaneNormal[0] = 1;
+  this->Angles[0] = this->Angles[1] = 0;
+  this->BlendWidth = 1.0;
+}
+
+//----------------------------------------------------------------------------
+//Destructor
+vtkPlannerHingeTransform::~vtkPlannerHingeTransform()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerHingeTransform::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "AxisOrigin: " << this->AxisOrigin[0] << " " << this->AxisOrigin[1] << " " << this->AxisOrigin[2] << "\n";
+  os << indent << "AxisDirection: " << this->AxisDirection[0] << " " << this->AxisDirection[1] << " " << this->AxisDirection[2] << "\n";
+  os << indent << "PlaneOrigin: " << this->PlaneOrigin[0] << " " << this->PlaneOrigin[1] << " " << this->PlaneOrigin[2] << "\n";
+  os << indent << "PlaneNormal: " << this->PlaneNormal[0] << " " << this->PlaneNormal[1] << " " << this->PlaneNormal[2] << "\n";
+  os << indent << "Angles: " << this->Angles[0] << " " << this->Angles[1] << "\n";
+  os << indent << "BlendWidth: " << this->BlendWidth << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerHingeTransform::SetAxis(const double origin[3], const double direction[3])
+{
+  for (int k = 0; k < 3; k++)
+  {
+    this->AxisOrigin[k] = origin[k];
+    this->AxisDirection[k] = direction[k];
+  }
+  vtkMath::Normalize(this->AxisDirection);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerHingeTransform::SetPlane(const double origin[3], const double normal[3])
+{
+  for (int k = 0; k < 3; k++)
+  {
+    this->PlaneOrigin[k] = origin[k];
+    this->PlaneNormal[k] = normal[k];
+  }
+  vtkMath::Normalize(this->PlaneNormal);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+//Rotate about the axis by angle * w, where w goes smoothly (smoothstep) from 0 on the
+//plane to 1 at the blend width, so x' = o + R(angle * w) (x - o)
+void vtkPlannerHingeTransform::ForwardTransformDerivative(const double in[3], double out[3], double derivative[3][3])
+{
+  double side = (in[0] - this->PlaneOrigin[0]) * this->PlaneNormal[0] +
+    (in[1] - this->PlaneOrigin[1]) * this->PlaneNormal[1] +
+    (in[2] - this->PlaneOrigin[2]) * this->PlaneNormal[2];
+  double angle = side < 0 ? this->Angles[0] : this->Angles[1];
+  double t = this->BlendWidth > 0 ? std::min(std::fabs(side) / this->BlendWidth, 1.0) : 1.0;
+  double weight = t * t * (3 - 2 * t);
+  //derivative of the rotation angle along the plane normal
+  double slope = 0;
+  if (t < 1)
+  {
+    slope = angle * 6 * t * (1 - t) / this->BlendWidth * (side < 0 ? -1 : 1);
+  }
+  double theta = angle * weight;
+
+  //Rodrigues rotation of v = x - o about the unit axis k
+  const double* k = this->AxisDirection;
+  double v[3] = { in[0] - this->AxisOrigin[0], in[1] - this->AxisOrigin[1], in[2] - this->AxisOrigin[2] };
+  double c = std::cos(theta);
+  double s = std::sin(theta);
+  double kv = vtkMath::Dot(k, v);
+  double kxv[3];
+  vtkMath::Cross(k, v, kxv);
+  double rotated[3];
+  for (int j = 0; j < 3; j++)
+  {
+    rotated[j] = v[j] * c + kxv[j] * s + k[j] * kv * (1 - c);
+    out[j] = this->AxisOrigin[j] + rotated[j];
+  }
+  if (!derivative)
+  {
+    return;
+  }
+
+  //rotation matrix, plus the change of the rotation with the angle, k x R v, along its gradient
+  double kxr[3];
+  vtkMath::Cross(k, rotated, kxr);
+  for (int j = 0; j < 3; j++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      double cross = 0;
+      if (i != j)
+      {
+        //entry j,i of the cross product matrix of k
+        int m = 3 - i - j;
+        cross = ((j + 1) % 3 == i ? -k[m] : k[m]);
+      }
+      derivative[j][i] = (j == i ? c : 0) + s * cross + (1 - c) * k[j] * k[i] +
+        kxr[j] * slope * this->PlaneNormal[i];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerHingeTransform::ForwardTransformPoint(const double in[3], double out[3])
+{
+  this->ForwardTransformDerivative(in, out, NULL);
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerHingeTransform::ForwardTransformPoint(const float in[3], float out[3])
+{
+  double p[3] = { in[0], in[1], in[2] };
+  double q[3];
+  this->ForwardTransformPoint(p, q);
+  out[0] = static_cast<float>(q[0]);
+  out[1] = static_cast<float>(q[1]);
+  out[2] = static_cast<float>(q[2]);
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerHingeTransform::ForwardTransformDerivative(const float in[3], float out[3], float derivative[3][3])
+{
+  double p[3] = { in[0], in[1], in[2] };
+  double q[3];
+  double d[3][3];
+  this->ForwardTransformDerivative(p, q, d);
+  for (int j = 0; j < 3; j++)
+  {
+    out[j] = static_cast<float>(q[j]);
+    for (int k = 0; k < 3; k++)
+    {
+      derivative[j][k] = static_cast<float>(d[j][k]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//Same as vtkAbstractTransform::TransformPoints, with the points split between threads
+void vtkPlannerHingeTransform::TransformPoints(vtkPoints* inPts, vtkPoints* outPts)
+{
+  vtkPlannerTransformPoints(this, inPts, outPts);
+}
+
+//----------------------------------------------------------------------------
+//Same as vtkAbstractTransform::TransformPointsNormalsVectors without vectors, in parallel
+void vtkPlannerHingeTransform::TransformPointsNormals(vtkPoints* inPts, vtkPoints* outPts, vtkDataArray* inNms, vtkDataArray* outNms)
+{
+  vtkPlannerTransformPoints(this, inPts, outPts, inNms, outNms);
+}
+
+//----------------------------------------------------------------------------
+vtkAbstractTransform* vtkPlannerHingeTransform::MakeTransform()
+{
+  return vtkPlannerHingeTransform::New();
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerHingeTransform::InternalDeepCopy(vtkAbstractTransform* transform)
+{
+  vtkPlannerHingeTransform* hingeTransform = static_cast<vtkPlannerHingeTransform*>(transform);
+  this->Superclass::InternalDeepCopy(transform);
+  for (int k = 0; k < 3; k++)
+  {
+    this->AxisOrigin[k] = hingeTransform->AxisOrigin[k];
+    this->AxisDirection[k] = hingeTransform->AxisDirection[k];
+    this->PlaneOrigin[k] = hingeTransform->PlaneOrigin[k];
+    this->PlaneNormal[k] = hingeTransform->PlaneNormal[k];
+  }
+  this->Angles[0] = hingeTransform->Angles[0];
+  this->Angles[1] = hingeTransform->Angles[1];
+  this->BlendWidth = hingeTransform->BlendWidth;
+}
@@ -0,0 +1,92 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkPlannerHingeTransform - blended rotation of the sides of a bending plane
+// .SECTION Description
+// Rigid hinge bend in closed form.  Each side of the bending plane turns about the hinge
+// axis by its own angle.  The angle is blended in smoothly over a band of the given width
+// next to the plane, so the surface stays continuous across the hinge.  Points are
+// transformed in parallel and no landmarks are involved.
+
+#ifndef __vtkPlannerHingeTransform_h
+#define __vtkPlannerHingeTransform_h
+
+// VTK includes
+#include "vtkWarpTransform.h"
+#include "vtkDataArray.h"
+#include "vtkPoints.h"
+
+//Self includes
+#include "vtkSlicerPlannerModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_PLANNER_MODULE_LOGIC_EXPORT vtkPlannerHingeTransform :
+  public vtkWarpTransform
+{
+public:
+
+  static vtkPlannerHingeTransform* New();
+  vtkTypeMacro(vtkPlannerHingeTransform, vtkWarpTransform);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Point on the hinge axis and its direction, which is normalized
+  void SetAxis(const double origin[3], const double direction[3]);
+
+  // Bending plane, through the hinge axis.  The normal is normalized.
+  void SetPlane(const double origin[3], const double normal[3]);
+
+  // Rotation angles in radians about the axis of the sides behind and in front of the plane
+  vtkSetVector2Macro(Angles, double);
+  vtkGetVector2Macro(Angles, double);
+
+  // Width of the band next to the plane over which the rotation is blended in
+  vtkSetClampMacro(BlendWidth, double, 0, VTK_DOUBLE_MAX);
+  vtkGetMacro(BlendWidth, double);
+
+  // Transform the points in parallel
+  void TransformPoints(vtkPoints* inPts, vtkPoints* outPts);
+
+  // Transform the points and their normals in parallel
+  void TransformPointsNormals(vtkPoints* inPts, vtkPoints* outPts, vtkDataArray* inNms, vtkDataArray* outNms);
+
+  vtkAbstractTransform* MakeTransform();
+
+protected:
+  vtkPlannerHingeTransform();
+  virtual ~vtkPlannerHingeTransform();
+
+  void InternalDeepCopy(vtkAbstractTransform* transform);
+
+  void ForwardTransformPoint(const float in[3], float out[3]);
+  void ForwardTransformPoint(const double in[3], double out[3]);
+  void ForwardTransformDerivative(const float in[3], float out[3], float derivative[3][3]);
+  void ForwardTransformDerivative(const double in[3], double out[3], double derivative[3][3]);
+
+  double AxisOrigin[3];
+  double AxisDirection[3];
+  double PlaneOrigin[3];
+  double PlaneNormal[3];
+  double Angles[2];
+  double BlendWidth;
+
+private:
+  vtkPlannerHingeTransform(const vtkPlannerHingeTransform&); // Not implemented
+  void operator=(const vtkPlannerHingeTransform&); // Not implemented
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Planner Logic includes
+#include "vtkPlannerLevelOfDetail.h"
+
+// VTK includes
+#include <vtkDecimatePro.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPolyDataNormals.h>
+#include <vtkTriangleFilter.h>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkPlannerLevelOfDetail);
+
+//----------------------------------------------------------------------------
+//Constructor
+vtkPlannerLevelOfDetail::vtkPlannerLevelOfDetail()
+{
+  this->MinimumNumberOfTriangles = 2000;
+}
+
+//----------------------------------------------------------------------------
+vtkPlannerLevelOfDetail::~vtkPlannerLevelOfDetail()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerLevelOfDetail::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "MinimumNumberOfTriangles: " << this->MinimumNumberOfTriangles << "\n";
+  os << indent << "NumberOfLevels: " << this->GetNumberOfLevels() << "\n";
+  for (int i = 0; i < this->GetNumberOfLevels(); i++)
+  {
+    os << indent << "Level " << i << ": " << this->GetNumberOfTriangles(i) << " triangles\n";
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerLevelOfDetail::Build(vtkPolyData* input)
+{
+  this->Levels.clear();
+  this->NumberOfTriangles.clear();
+  if (!input)
+  {
+    this->Modified();
+    return;
+  }
+
+  //decimation only takes triangles
+  vtkNew<vtkTriangleFilter> triangulate;
+  triangulate->PassLinesOff();
+  triangulate->PassVertsOff();
+  triangulate->SetInputData(input);
+  triangulate->Update();
+  vtkSmartPointer<vtkPolyData> previous = triangulate->GetOutput();
+  this->Levels.push_back(vtkSmartPointer<vtkPolyData>());
+  this->NumberOfTriangles.push_back(previous->GetNumberOfPolys());
+
+  while (previous->GetNumberOfPolys() / 4 >= this->MinimumNumberOfTriangles)
+  {
+    //the cut borders of the fragments are kept, so the pieces still fit together
+    vtkNew<vtkDecimatePro> decimate;
+    decimate->SetTargetReduction(0.75);
+    decimate->PreserveTopologyOn();
+    decimate->BoundaryVertexDeletionOff();
+    decimate->SetInputData(previous);
+    decimate->Update();
+    vtkPolyData* decimated = decimate->GetOutput();
+    if (decimated->GetNumberOfPolys() == 0 ||
+      decimated->GetNumberOfPolys() > previous->GetNumberOfPolys() * 9 / 10)
+    {
+      //topology stops the decimation, coarser levels would be the same
+      break;
+    }
+
+    vtkNew<vtkPolyDataNormals> normals;
+    normals->SplittingOff();
+    normals->SetInputData(decimated);
+    normals->Update();
+    vtkSmartPointer<vtkPolyData> level = vtkSmartPointer<vtkPolyData>::New();
+    level->ShallowCopy(normals->GetOutput());
+    this->Levels.push_back(level);
+    this->NumberOfTriangles.push_back(level->GetNumberOfPolys());
+    previous = level;
+  }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkPolyData* vtkPlannerLevelOfDetail::GetLevel(int level)
+{
+  if (level < 0 || level >= this->GetNumberOfLevels())
+  {
+    return NULL;
+  }
+  return this->Levels[level];
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkPlannerLevelOfDetail::GetNumberOfTriangles(int level)
+{
+  if (level < 0 || level >= this->GetNumberOfLevels())
+  {
+    return 0;
+  }
+  return this->NumberOfTriangles[level];
+}
+
+//----------------------------------------------------------------------------
+int vtkPlannerLevelOfDetail::SelectLevel(vtkIdType numberOfTriangles)
+{
+  for (int i = 0; i < this->GetNumberOfLevels(); i++)
+  {
+    if (this->GetNumberOfTriangles(i) <= numberOfTriangles)
+    {
+      return i;
+    }
+  }
+  return this->GetNumberOfLevels() - 1;
+}
@@ -0,0 +1,78 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkPlannerLevelOfDetail - decimated copies of a model for interaction
+// .SECTION Description
+// Pyramid of coarser and coarser copies of a surface, each one decimated from the one
+// before it so only the first level pays for the full resolution input.  Level 0 stands
+// for the input, which is not kept: GetLevel(0) is NULL.  Levels keep the topology and
+// the point data of the input, and get their own point normals.  Build only reads its
+// input, so a pyramid may be built off the GUI thread from a copy of the model.
+
+#ifndef __vtkPlannerLevelOfDetail_h
+#define __vtkPlannerLevelOfDetail_h
+
+// VTK includes
+#include "vtkObject.h"
+#include "vtkPolyData.h"
+#include "vtkSmartPointer.h"
+
+// STD includes
+#include <vector>
+
+//Self includes
+#include "vtkSlicerPlannerModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_PLANNER_MODULE_LOGIC_EXPORT vtkPlannerLevelOfDetail :
+  public vtkObject
+{
+public:
+
+  static vtkPlannerLevelOfDetail* New();
+  vtkTypeMacro(vtkPlannerLevelOfDetail, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Build the levels of a surface.  Each level has about a quarter of the triangles of
+  // the level before it, and levels under MinimumNumberOfTriangles are not built.
+  void Build(vtkPolyData* input);
+
+  vtkSetMacro(MinimumNumberOfTriangles, vtkIdType);
+  vtkGetMacro(MinimumNumberOfTriangles, vtkIdType);
+
+  int GetNumberOfLevels() { return static_cast<int>(this->NumberOfTriangles.size()); }
+  vtkPolyData* GetLevel(int level);
+  vtkIdType GetNumberOfTriangles(int level);
+
+  // Finest level with at most numberOfTriangles triangles, or the coarsest level
+  int SelectLevel(vtkIdType numberOfTriangles);
+
+protected:
+  vtkPlannerLevelOfDetail();
+  virtual ~vtkPlannerLevelOfDetail();
+
+  vtkIdType MinimumNumberOfTriangles;
+  std::vector<vtkSmartPointer<vtkPolyData> > Levels;
+  std::vector<vtkIdType> NumberOfTriangles;
+
+private:
+  vtkPlannerLevelOfDetail(const vtkPlannerLevelOfDetail&); // Not implemented
+  void operator=(const vtkPlannerLevelOfDetail&); // Not implemented
+};
+
+#endif
@@ -0,0 +1,173 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Planner Logic includes
+#include "vtkPlannerPlaneSection.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkMath.h>
+#include <vtkObjectFactory.h>
+#include <vtkPoints.h>
+
+// STD includes
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkPlannerPlaneSection);
+
+//----------------------------------------------------------------------------
+//Constructor
+vtkPlannerPlaneSection::vtkPlannerPlaneSection()
+{
+}
+
+//----------------------------------------------------------------------------
+vtkPlannerPlaneSection::~vtkPlannerPlaneSection()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerPlaneSection::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfSegments: " << this->GetNumberOfSegments() << "\n";
+  os << indent << "NumberOfNodes: " << this->Tree.GetNumberOfNodes() << "\n";
+}
+
+//----------------------------------------------------------------------------
+//Cut each polygon where its edges cross the plane.  A convex polygon crosses it twice,
+//the crossings of other polygons are joined in pairs along the boundary.
+void vtkPlannerPlaneSection::Build(vtkPolyData* polyData, vtkPlane* plane)
+{
+  this->Segments.clear();
+  this->Order.clear();
+  this->Tree.Clear();
+  if (!polyData || !plane || !polyData->GetPoints() || !polyData->GetPolys())
+  {
+    return;
+  }
+
+  vtkPoints* points = polyData->GetPoints();
+  std::vector<double> values(points->GetNumberOfPoints());
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    points->GetPoint(i, p);
+    values[i] = plane->EvaluateFunction(p);
+  }
+
+  vtkCellArray* polys = polyData->GetPolys();
+  vtkIdType npts;
+  vtkIdType* pts;
+  std::vector<double> crossings;
+  polys->InitTraversal();
+  while (polys->GetNextCell(npts, pts))
+  {
+    crossings.clear();
+    for (vtkIdType j = 0; j < npts; j++)
+    {
+      vtkIdType a = pts[j];
+      vtkIdType b = pts[(j + 1) % npts];
+      if ((values[a] < 0) == (values[b] < 0))
+      {
+        continue;
+      }
+      double pa[3];
+      double pb[3];
+      points->GetPoint(a, pa);
+      points->GetPoint(b, pb);
+      double t = values[a] / (values[a] - values[b]);
+      for (int k = 0; k < 3; k++)
+      {
+        crossings.push_back(pa[k] + t * (pb[k] - pa[k]));
+      }
+    }
+    for (size_t j = 0; j + 6 <= crossings.size(); j += 6)
+    {
+      this->Segments.insert(this->Segments.end(), crossings.begin() + j, crossings.begin() + j + 6);
+    }
+  }
+
+  vtkIdType numberOfSegments = this->GetNumberOfSegments();
+  if (numberOfSegments == 0)
+  {
+    return;
+  }
+  std::vector<double> bounds(6 * numberOfSegments);
+  for (vtkIdType i = 0; i < numberOfSegments; i++)
+  {
+    const double* segment = &this->Segments[6 * i];
+    for (int k = 0; k < 3; k++)
+    {
+      bounds[6 * i + 2 * k] = std::min(segment[k], segment[3 + k]);
+      bounds[6 * i + 2 * k + 1] = std::max(segment[k], segment[3 + k]);
+    }
+  }
+  this->Tree.Build(numberOfSegments, &bounds[0], this->Order);
+}
+
+//----------------------------------------------------------------------------
+//Closest point of the segments of a leaf, for vtkPlannerBoxTree::FindClosest
+class vtkPlannerClosestSegmentSearch
+{
+public:
+  const double* Segments;
+  const vtkIdType* Order;
+  const double* Point;
+  double* Closest;
+
+  double operator()(vtkIdType begin, vtkIdType end, double best)
+  {
+    const double* x = this->Point;
+    for (vtkIdType i = begin; i < end; i++)
+    {
+      const double* a = this->Segments + 6 * this->Order[i];
+      const double* b = a + 3;
+      double ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+      double ax[3] = { x[0] - a[0], x[1] - a[1], x[2] - a[2] };
+      double length2 = vtkMath::Dot(ab, ab);
+      double t = length2 > 0 ? std::min(std::max(vtkMath::Dot(ax, ab) / length2, 0.0), 1.0) : 0.0;
+      double p[3] = { a[0] + t * ab[0], a[1] + t * ab[1], a[2] + t * ab[2] };
+      double dist2 = vtkMath::Distance2BetweenPoints(p, x);
+      if (dist2 < best)
+      {
+        best = dist2;
+        this->Closest[0] = p[0];
+        this->Closest[1] = p[1];
+        this->Closest[2] = p[2];
+      }
+    }
+    return best;
+  }
+};
+
+//----------------------------------------------------------------------------
+double vtkPlannerPlaneSection::FindClosestPoint(const double x[3], double closest[3])
+{
+  if (this->Tree.IsEmpty())
+  {
+    return VTK_DOUBLE_MAX;
+  }
+  vtkPlannerClosestSegmentSearch search;
+  search.Segments = &this->Segments[0];
+  search.Order = &this->Order[0];
+  search.Point = x;
+  search.Closest = closest;
+  return this->Tree.FindClosest(x, search);
+}
@@ -0,0 +1,75 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkPlannerPlaneSection - section of a surface by a plane, indexed for closest point queries
+// .SECTION Description
+// Cuts the polygons of a surface by a plane into line segments, once, and keeps them in
+// a bounding volume hierarchy.  The closest point of the section to any point is then
+// found by visiting the few boxes that can hold it, instead of running a cutter and
+// building a locator for every query.
+
+#ifndef __vtkPlannerPlaneSection_h
+#define __vtkPlannerPlaneSection_h
+
+// VTK includes
+#include "vtkObject.h"
+#include "vtkPlane.h"
+#include "vtkPolyData.h"
+
+// STD includes
+#include <vector>
+
+//Self includes
+#include "vtkPlannerBoxTree.h"
+#include "vtkSlicerPlannerModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_PLANNER_MODULE_LOGIC_EXPORT vtkPlannerPlaneSection :
+  public vtkObject
+{
+public:
+
+  static vtkPlannerPlaneSection* New();
+  vtkTypeMacro(vtkPlannerPlaneSection, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Cut the polygons of the surface by the plane and index the segments
+  void Build(vtkPolyData* polyData, vtkPlane* plane);
+
+  vtkIdType GetNumberOfSegments() { return static_cast<vtkIdType>(this->Segments.size() / 6); }
+
+  // Closest point of the section to x.  Returns the squared distance to it, or
+  // VTK_DOUBLE_MAX when the plane misses the surface.
+  double FindClosestPoint(const double x[3], double closest[3]);
+
+protected:
+  vtkPlannerPlaneSection();
+  virtual ~vtkPlannerPlaneSection();
+
+  //end points of the segments, one after the other
+  std::vector<double> Segments;
+  //segments in the leaf order of the tree
+  std::vector<vtkIdType> Order;
+  vtkPlannerBoxTree Tree;
+
+private:
+  vtkPlannerPlaneSection(const vtkPlannerPlaneSection&); // Not implemented
+  void operator=(const vtkPlannerPlaneSection&); // Not implemented
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkPlannerTransformPoints - parallel point transform shared by the planner warps
+// .SECTION Description
+// Same as vtkAbstractTransform::TransformPoints and TransformPointsNormalsVectors, with the
+// points split between threads by vtkSMPTools.  The transform is updated first, so its
+// InternalTransformPoint and InternalTransformDerivative can be called from several
+// threads at once.
+
+#ifndef __vtkPlannerTransformPoints_h
+#define __vtkPlannerTransformPoints_h
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkMath.h>
+#include <vtkPoints.h>
+#include <vtkSMPTools.h>
+
+//----------------------------------------------------------------------------
+//Transform a range of points, and of their normals when there are any, for vtkSMPTools.
+//A normal goes through the inverse transpose of the derivative at its point.
+template <class TransformType>
+class vtkPlannerTransformPointsFunctor
+{
+public:
+  TransformType* Transform;
+  vtkPoints* InPoints;
+  vtkPoints* OutPoints;
+  vtkDataArray* InNormals;
+  vtkDataArray* OutNormals;
+  vtkIdType Offset;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    double in[3];
+    double out[3];
+    double normal[3];
+    double derivative[3][3];
+    for (vtkIdType i = begin; i < end; i++)
+    {
+      this->InPoints->GetPoint(i, in);
+      if (!this->InNormals)
+      {
+        this->Transform->InternalTransformPoint(in, out);
+        this->OutPoints->SetPoint(this->Offset + i, out);
+        continue;
+      }
+      this->Transform->InternalTransformDerivative(in, out, derivative);
+      this->OutPoints->SetPoint(this->Offset + i, out);
+      this->InNormals->GetTuple(i, normal);
+      vtkMath::Transpose3x3(derivative, derivative);
+      vtkMath::LinearSolve3x3(derivative, normal, normal);
+      vtkMath::Normalize(normal);
+      this->OutNormals->SetTuple(this->Offset + i, normal);
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+//Append the transformed inPts to outPts, and the transformed inNms to outNms at the same
+//ids when both are given
+template <class TransformType>
+void vtkPlannerTransformPoints(TransformType* transform, vtkPoints* inPts, vtkPoints* outPts,
+  vtkDataArray* inNms = NULL, vtkDataArray* outNms = NULL)
+{
+  transform->Update();
+  vtkIdType numberOfPoints = inPts->GetNumberOfPoints();
+  vtkIdType offset = outPts->GetNumberOfPoints();
+  outPts->SetNumberOfPoints(offset + numberOfPoints);
+  vtkPlannerTransformPointsFunctor<TransformType> functor;
+  functor.Transform = transform;
+  functor.InPoints = inPts;
+  functor.OutPoints = outPts;
+  functor.InNormals = NULL;
+  functor.OutNormals = NULL;
+  functor.Offset = offset;
+  if (inNms && outNms)
+  {
+    functor.InNormals = inNms;
+    functor.OutNormals = outNms;
+    outNms->SetNumberOfComponents(3);
+    outNms->SetNumberOfTuples(offset + numberOfPoints);
+  }
+  vtkSMPTools::For(0, numberOfPoints, functor);
+  outPts->Modified();
+  if (functor.OutNormals)
+  {
+    outNms->Modified();
+  }
+}
+
+#endif
@@ -0,0 +1,591 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Planner Logic includes
+#include "vtkPlannerTriangleIndex.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkCellData.h>
+#include <vtkDataArray.h>
+#include <vtkMath.h>
+#include <vtkObjectFactory.h>
+#include <vtkPoints.h>
+#include <vtkSMPTools.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//Barycentric and segment parameters closer than this to the border of a triangle or to
+//the end of an edge are contacts, not crossings
+static const double CrossingTolerance = 1e-6;
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkPlannerTriangleIndex);
+
+//----------------------------------------------------------------------------
+//Closest points of a range of packed points, for vtkSMPTools
+class vtkPlannerClosestPointsFunctor
+{
+public:
+  const vtkPlannerTriangleIndex* Index;
+  const double* Points;
+  double* ClosestPoints;
+  double* Distances;
+  vtkIdType* CellIds;
+  double* Normals;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    double closest[3];
+    double normal[3];
+    vtkIdType cellId;
+    for (vtkIdType i = begin; i < end; i++)
+    {
+      //an empty index leaves the point where it is
+      std::copy(this->Points + 3 * i, this->Points + 3 * i + 3, closest);
+      std::fill(normal, normal + 3, 0.0);
+      double dist2 = this->Index->FindClosestPoint(this->Points + 3 * i, closest, cellId, normal);
+      if (this->ClosestPoints)
+      {
+        std::copy(closest, closest + 3, this->ClosestPoints + 3 * i);
+      }
+      if (this->Distances)
+      {
+        this->Distances[i] = std::sqrt(dist2);
+      }
+      if (this->CellIds)
+      {
+        this->CellIds[i] = cellId;
+      }
+      if (this->Normals)
+      {
+        std::copy(normal, normal + 3, this->Normals + 3 * i);
+      }
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+//Constructor
+vtkPlannerTriangleIndex::vtkPlannerTriangleIndex()
+{
+}
+
+//----------------------------------------------------------------------------
+vtkPlannerTriangleIndex::~vtkPlannerTriangleIndex()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerTriangleIndex::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfTriangles: " << this->GetNumberOfTriangles() << "\n";
+  os << indent << "NumberOfNodes: " << this->Tree.GetNumberOfNodes() << "\n";
+}
+
+//----------------------------------------------------------------------------
+//Split the polygons in fans of triangles, then sort them into the hierarchy
+void vtkPlannerTriangleIndex::Build(vtkPolyData* polyData)
+{
+  this->Corners.clear();
+  this->CellIds.clear();
+  this->Normals.clear();
+  this->Tree.Clear();
+  if (!polyData || !polyData->GetPoints() || !polyData->GetPolys())
+  {
+    return;
+  }
+
+  vtkPoints* points = polyData->GetPoints();
+  vtkDataArray* cellNormals = polyData->GetCellData()->GetNormals();
+  vtkCellArray* polys = polyData->GetPolys();
+  //polygons come after the vertices and lines in the cell ids
+  vtkIdType cellId = polyData->GetNumberOfVerts() + polyData->GetNumberOfLines();
+  std::vector<double> corners;
+  std::vector<vtkIdType> cellIds;
+  std::vector<double> normals;
+  vtkIdType npts;
+  vtkIdType* pts;
+  polys->InitTraversal();
+  for (; polys->GetNextCell(npts, pts); cellId++)
+  {
+    for (vtkIdType j = 1; j + 1 < npts; j++)
+    {
+      double p[3][3];
+      points->GetPoint(pts[0], p[0]);
+      points->GetPoint(pts[j], p[1]);
+      points->GetPoint(pts[j + 1], p[2]);
+      double normal[3];
+      if (cellNormals)
+      {
+        cellNormals->GetTuple(cellId, normal);
+      }
+      else
+      {
+        double u[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+        double v[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+        vtkMath::Cross(u, v, normal);
+        vtkMath::Normalize(normal);
+      }
+      corners.insert(corners.end(), &p[0][0], &p[0][0] + 9);
+      normals.insert(normals.end(), normal, normal + 3);
+      cellIds.push_back(cellId);
+    }
+  }
+
+  vtkIdType numberOfTriangles = static_cast<vtkIdType>(cellIds.size());
+  if (numberOfTriangles == 0)
+  {
+    return;
+  }
+  std::vector<double> bounds(6 * numberOfTriangles);
+  for (vtkIdType i = 0; i < numberOfTriangles; i++)
+  {
+    const double* triangle = &corners[9 * i];
+    for (int k = 0; k < 3; k++)
+    {
+      bounds[6 * i + 2 * k] = std::min(std::min(triangle[k], triangle[3 + k]), triangle[6 + k]);
+      bounds[6 * i + 2 * k + 1] = std::max(std::max(triangle[k], triangle[3 + k]), triangle[6 + k]);
+    }
+  }
+  std::vector<vtkIdType> order;
+  this->Tree.Build(numberOfTriangles, &bounds[0], order);
+
+  //pack the triangles in leaf order
+  this->Corners.resize(corners.size());
+  this->Normals.resize(normals.size());
+  this->CellIds.resize(numberOfTriangles);
+  for (vtkIdType i = 0; i < numberOfTriangles; i++)
+  {
+    std::copy(corners.begin() + 9 * order[i], corners.begin() + 9 * order[i] + 9, this->Corners.begin() + 9 * i);
+    std::copy(normals.begin() + 3 * order[i], normals.begin() + 3 * order[i] + 3, this->Normals.begin() + 3 * i);
+    this->CellIds[i] = cellIds[order[i]];
+  }
+}
+
+//----------------------------------------------------------------------------
+//Closest point of a triangle to a point, by the region of the triangle it projects to
+static void closestPointOnTriangle(const double x[3], const double* t, double closest[3])
+{
+  const double* a = t;
+  const double* b = t + 3;
+  const double* c = t + 6;
+  double ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+  double ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+  double ax[3] = { x[0] - a[0], x[1] - a[1], x[2] - a[2] };
+  double d1 = vtkMath::Dot(ab, ax);
+  double d2 = vtkMath::Dot(ac, ax);
+  if (d1 <= 0 && d2 <= 0)
+  {
+    std::copy(a, a + 3, closest);
+    return;
+  }
+  double bx[3] = { x[0] - b[0], x[1] - b[1], x[2] - b[2] };
+  double d3 = vtkMath::Dot(ab, bx);
+  double d4 = vtkMath::Dot(ac, bx);
+  if (d3 >= 0 && d4 <= d3)
+  {
+    std::copy(b, b + 3, closest);
+    return;
+  }
+  double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+  {
+    double v = d1 / (d1 - d3);
+    for (int k = 0; k < 3; k++)
+    {
+      closest[k] = a[k] + v * ab[k];
+    }
+    return;
+  }
+  double cx[3] = { x[0] - c[0], x[1] - c[1], x[2] - c[2] };
+  double d5 = vtkMath::Dot(ab, cx);
+  double d6 = vtkMath::Dot(ac, cx);
+  if (d6 >= 0 && d5 <= d6)
+  {
+    std::copy(c, c + 3, closest);
+    return;
+  }
+  double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+  {
+    double w = d2 / (d2 - d6);
+    for (int k = 0; k < 3; k++)
+    {
+      closest[k] = a[k] + w * ac[k];
+    }
+    return;
+  }
+  double va = d3 * d6 - d5 * d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+  {
+    double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    for (int k = 0; k < 3; k++)
+    {
+      closest[k] = b[k] + w * (c[k] - b[k]);
+    }
+    return;
+  }
+  double denominator = 1.0 / (va + vb + vc);
+  double v = vb * denominator;
+  double w = vc * denominator;
+  for (int k = 0; k < 3; k++)
+  {
+    closest[k] = a[k] + v * ab[k] + w * ac[k];
+  }
+}
+
+//----------------------------------------------------------------------------
+//Closest point of the triangles of a leaf, for vtkPlannerBoxTree::FindClosest
+class vtkPlannerClosestTriangleSearch
+{
+public:
+  const double* Corners;
+  const double* Point;
+  double Closest[3];
+  vtkIdType Triangle;
+
+  double operator()(vtkIdType begin, vtkIdType end, double best)
+  {
+    const double* corners = this->Corners + 9 * begin;
+    for (vtkIdType i = begin; i < end; i++, corners += 9)
+    {
+      double p[3];
+      closestPointOnTriangle(this->Point, corners, p);
+      double dist2 = vtkMath::Distance2BetweenPoints(p, this->Point);
+      if (dist2 < best)
+      {
+        best = dist2;
+        this->Triangle = i;
+        std::copy(p, p + 3, this->Closest);
+      }
+    }
+    return best;
+  }
+};
+
+//----------------------------------------------------------------------------
+double vtkPlannerTriangleIndex::FindClosestPoint(const double x[3], double closest[3], vtkIdType& cellId, double normal[3]) const
+{
+  cellId = -1;
+  if (this->Tree.IsEmpty())
+  {
+    return VTK_DOUBLE_MAX;
+  }
+  vtkPlannerClosestTriangleSearch search;
+  search.Corners = &this->Corners[0];
+  search.Point = x;
+  search.Triangle = -1;
+  double best = this->Tree.FindClosest(x, search);
+
+  //nothing is closer than VTK_DOUBLE_MAX when x is not a number
+  if (search.Triangle < 0)
+  {
+    return VTK_DOUBLE_MAX;
+  }
+  std::copy(search.Closest, search.Closest + 3, closest);
+  cellId = this->CellIds[search.Triangle];
+  if (normal)
+  {
+    std::copy(&this->Normals[3 * search.Triangle], &this->Normals[3 * search.Triangle] + 3, normal);
+  }
+  return best;
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerTriangleIndex::FindClosestPoints(vtkIdType numberOfPoints, const double* points, double* closestPoints,
+  double* distances, vtkIdType* cellIds, double* normals) const
+{
+  vtkPlannerClosestPointsFunctor functor;
+  functor.Index = this;
+  functor.Points = points;
+  functor.ClosestPoints = closestPoints;
+  functor.Distances = distances;
+  functor.CellIds = cellIds;
+  functor.Normals = normals;
+  vtkSMPTools::For(0, numberOfPoints, functor);
+}
+
+//----------------------------------------------------------------------------
+void vtkPlannerTriangleIndex::GetBounds(double bounds[6]) const
+{
+  if (this->Tree.IsEmpty())
+  {
+    vtkMath::UninitializeBounds(bounds);
+    return;
+  }
+  std::copy(this->Tree.GetBounds(), this->Tree.GetBounds() + 6, bounds);
+}
+
+//----------------------------------------------------------------------------
+//First three rows of a matrix, the identity when there is none
+static void getAffineRows(vtkMatrix4x4* matrix, double m[12])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 4; j++)
+    {
+      m[4 * i + j] = matrix ? matrix->GetElement(i, j) : (i == j ? 1 : 0);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//Corners of a triangle moved by an affine matrix, given by its first three rows
+static void transformTriangle(const double* source, const double m[12], double triangle[9])
+{
+  for (int c = 0; c < 3; c++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      triangle[3 * c + k] = m[4 * k] * source[3 * c] + m[4 * k + 1] * source[3 * c + 1] +
+        m[4 * k + 2] * source[3 * c + 2] + m[4 * k + 3];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//True if the segment pq goes through the inside of the triangle, Moller-Trumbore.  A
+//segment in the plane of the triangle does not cross it.
+static bool segmentCrossesTriangle(const double p[3], const double q[3], const double* t)
+{
+  double e1[3] = { t[3] - t[0], t[4] - t[1], t[5] - t[2] };
+  double e2[3] = { t[6] - t[0], t[7] - t[1], t[8] - t[2] };
+  double d[3] = { q[0] - p[0], q[1] - p[1], q[2] - p[2] };
+  double h[3];
+  vtkMath::Cross(d, e2, h);
+  double det = vtkMath::Dot(e1, h);
+  double scale = std::sqrt(vtkMath::Dot(d, d) * vtkMath::Dot(e1, e1) * vtkMath::Dot(e2, e2));
+  if (std::fabs(det) <= CrossingTolerance * scale)
+  {
+    return false;
+  }
+  double f = 1.0 / det;
+  double s[3] = { p[0] - t[0], p[1] - t[1], p[2] - t[2] };
+  double u = f * vtkMath::Dot(s, h);
+  if (u <= CrossingTolerance || u >= 1 - CrossingTolerance)
+  {
+    return false;
+  }
+  double r[3];
+  vtkMath::Cross(s, e1, r);
+  double v = f * vtkMath::Dot(d, r);
+  if (v <= CrossingTolerance || u + v >= 1 - CrossingTolerance)
+  {
+    return false;
+  }
+  double w = f * vtkMath::Dot(e2, r);
+  return w > CrossingTolerance && w < 1 - CrossingTolerance;
+}
+
+//----------------------------------------------------------------------------
+//Two triangles cross when an edge of one of them goes through the other
+static bool trianglesCross(const double* a, const double* b)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    int j = (i + 1) % 3;
+    if (segmentCrossesTriangle(a + 3 * i, a + 3 * j, b) || segmentCrossesTriangle(b + 3 * i, b + 3 * j, a))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+//Crossing triangles of two leaves, for vtkPlannerBoxTree::VisitOverlappingLeaves.  The
+//triangles of the other leaf are moved by the matrix rows.
+class vtkPlannerCrossingTrianglesVisit
+{
+public:
+  const double* Corners;
+  const double* OtherCorners;
+  const double* Matrix;
+  std::vector<vtkIdType>* Triangles;
+  std::vector<vtkIdType>* OtherTriangles;
+  vtkIdType NumberOfPairs;
+
+  bool operator()(const vtkPlannerBoxTree::Node& node, const vtkPlannerBoxTree::Node& otherNode)
+  {
+    for (vtkIdType j = otherNode.Begin; j < otherNode.End; j++)
+    {
+      double otherTriangle[9];
+      transformTriangle(this->OtherCorners + 9 * j, this->Matrix, otherTriangle);
+      for (vtkIdType i = node.Begin; i < node.End; i++)
+      {
+        if (trianglesCross(this->Corners + 9 * i, otherTriangle))
+        {
+          this->Triangles->push_back(i);
+          this->OtherTriangles->push_back(j);
+          this->NumberOfPairs++;
+        }
+      }
+    }
+    return false;
+  }
+};
+
+//----------------------------------------------------------------------------
+//The boxes of the other index are moved into this index as they are visited, so only
+//the part of the other surface near this one is transformed
+vtkIdType vtkPlannerTriangleIndex::FindIntersectingTriangles(const vtkPlannerTriangleIndex* other,
+  vtkMatrix4x4* otherToThis, std::vector<vtkIdType>& triangles, std::vector<vtkIdType>& otherTriangles) const
+{
+  if (this->Tree.IsEmpty() || !other || other->Tree.IsEmpty())
+  {
+    return 0;
+  }
+  double m[12];
+  getAffineRows(otherToThis, m);
+  vtkPlannerCrossingTrianglesVisit visit;
+  visit.Corners = &this->Corners[0];
+  visit.OtherCorners = &other->Corners[0];
+  visit.Matrix = m;
+  visit.Triangles = &triangles;
+  visit.OtherTriangles = &otherTriangles;
+  visit.NumberOfPairs = 0;
+  this->Tree.VisitOverlappingLeaves(other->Tree, m, 0, visit);
+  return visit.NumberOfPairs;
+}
+
+//----------------------------------------------------------------------------
+//Squared distance between the segments p1q1 and p2q2, from the parameters of their
+//closest points clamped to the segments
+static double segmentsDistance2(const double* p1, const double* q1, const double* p2, const double* q2)
+{
+  double d1[3] = { q1[0] - p1[0], q1[1] - p1[1], q1[2] - p1[2] };
+  double d2[3] = { q2[0] - p2[0], q2[1] - p2[1], q2[2] - p2[2] };
+  double r[3] = { p1[0] - p2[0], p1[1] - p2[1], p1[2] - p2[2] };
+  double a = vtkMath::Dot(d1, d1);
+  double e = vtkMath::Dot(d2, d2);
+  double f = vtkMath::Dot(d2, r);
+  double s = 0;
+  double t = 0;
+  if (a > 0 && e > 0)
+  {
+    double b = vtkMath::Dot(d1, d2);
+    double c = vtkMath::Dot(d1, r);
+    double denominator = a * e - b * b;
+    //parallel segments take any pair of closest points, from the start of the first one
+    s = denominator > 0 ? std::min(std::max((b * f - c * e) / denominator, 0.0), 1.0) : 0.0;
+    t = (b * s + f) / e;
+    if (t < 0)
+    {
+      t = 0;
+      s = std::min(std::max(-c / a, 0.0), 1.0);
+    }
+    else if (t > 1)
+    {
+      t = 1;
+      s = std::min(std::max((b - c) / a, 0.0), 1.0);
+    }
+  }
+  else if (a > 0)
+  {
+    s = std::min(std::max(-vtkMath::Dot(d1, r) / a, 0.0), 1.0);
+  }
+  else if (e > 0)
+  {
+    t = std::min(std::max(f / e, 0.0), 1.0);
+  }
+  double dist2 = 0;
+  for (int k = 0; k < 3; k++)
+  {
+    double d = r[k] + d1[k] * s - d2[k] * t;
+    dist2 += d * d;
+  }
+  return dist2;
+}
+
+//----------------------------------------------------------------------------
+//Squared distance between two triangles.  Triangles that do not cross are closest at a
+//corner of one of them or between two of their edges.
+static double trianglesDistance2(const double* a, const double* b)
+{
+  if (trianglesCross(a, b))
+  {
+    return 0;
+  }
+  double best = VTK_DOUBLE_MAX;
+  double closest[3];
+  for (int i = 0; i < 3; i++)
+  {
+    closestPointOnTriangle(a + 3 * i, b, closest);
+    best = std::min(best, vtkMath::Distance2BetweenPoints(a + 3 * i, closest));
+    closestPointOnTriangle(b + 3 * i, a, closest);
+    best = std::min(best, vtkMath::Distance2BetweenPoints(b + 3 * i, closest));
+    for (int j = 0; j < 3; j++)
+    {
+      best = std::min(best, segmentsDistance2(a + 3 * i, a + 3 * ((i + 1) % 3), b + 3 * j, b + 3 * ((j + 1) % 3)));
+    }
+  }
+  return best;
+}
+
+//----------------------------------------------------------------------------
+//Stop at the first pair of triangles of two leaves close enough, for
+//vtkPlannerBoxTree::VisitOverlappingLeaves
+class vtkPlannerNearTrianglesVisit
+{
+public:
+  const double* Corners;
+  const double* OtherCorners;
+  const double* Matrix;
+  double Distance2;
+
+  bool operator()(const vtkPlannerBoxTree::Node& node, const vtkPlannerBoxTree::Node& otherNode)
+  {
+    for (vtkIdType j = otherNode.Begin; j < otherNode.End; j++)
+    {
+      double otherTriangle[9];
+      transformTriangle(this->OtherCorners + 9 * j, this->Matrix, otherTriangle);
+      for (vtkIdType i = node.Begin; i < node.End; i++)
+      {
+        if (trianglesDistance2(this->Corners + 9 * i, otherTriangle) <= this->Distance2)
+        {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+};
+
+//----------------------------------------------------------------------------
+//Walk both hierarchies together as FindIntersectingTriangles does, with the boxes grown
+//by the distance
+bool vtkPlannerTriangleIndex::IsWithinDistance(const vtkPlannerTriangleIndex* other, vtkMatrix4x4* otherToThis,
+  double distance) const
+{
+  if (this->Tree.IsEmpty() || !other || other->Tree.IsEmpty())
+  {
+    return false;
+  }
+  double m[12];
+  getAffineRows(otherToThis, m);
+  vtkPlannerNearTrianglesVisit visit;
+  visit.Corners = &this->Corners[0];
+  visit.OtherCorners = &other->Corners[0];
+  visit.Matrix = m;
+  visit.Distance2 = distance * distance;
+  return this->Tree.VisitOverlappingLeaves(other->Tree, m, distance, visit);
+}
@@ -0,0 +1,110 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkPlannerTriangleIndex - closest point queries on a triangulated surface, in batches
+// .SECTION Description
+// Keeps the polygons of a surface, split into triangles, in a bounding volume hierarchy.
+// The corners of the triangles of each leaf are packed one after the other, so a leaf is
+// tested in a single pass over contiguous memory.  Queries do not modify the index, which
+// makes them safe to run from several threads: FindClosestPoints splits a batch of points
+// over the threads with vtkSMPTools.  FindIntersectingTriangles walks the hierarchies of
+// two indices together to find the triangles of two surfaces that cross each other, and
+// IsWithinDistance the same way to tell if two surfaces come close to each other.
+
+#ifndef __vtkPlannerTriangleIndex_h
+#define __vtkPlannerTriangleIndex_h
+
+// VTK includes
+#include "vtkObject.h"
+#include "vtkMatrix4x4.h"
+#include "vtkPolyData.h"
+
+// STD includes
+#include <vector>
+
+//Self includes
+#include "vtkPlannerBoxTree.h"
+#include "vtkSlicerPlannerModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_PLANNER_MODULE_LOGIC_EXPORT vtkPlannerTriangleIndex :
+  public vtkObject
+{
+public:
+
+  static vtkPlannerTriangleIndex* New();
+  vtkTypeMacro(vtkPlannerTriangleIndex, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Index the polygons of the surface.  The normals of the triangles are taken from the
+  // cell normals of the surface if it has them, and computed from the corners otherwise.
+  void Build(vtkPolyData* polyData);
+
+  vtkIdType GetNumberOfTriangles() { return static_cast<vtkIdType>(this->CellIds.size()); }
+
+  // Triangles are numbered in leaf order: the nine corner coordinates of a triangle and
+  // the cell of the surface it comes from
+  const double* GetTriangle(vtkIdType triangle) const { return &this->Corners[9 * triangle]; }
+  vtkIdType GetTriangleCellId(vtkIdType triangle) const { return this->CellIds[triangle]; }
+
+  // Bounds of the surface, uninitialized bounds when it has no polygons
+  void GetBounds(double bounds[6]) const;
+
+  // Closest point of the surface to x, the id of the cell it is on and optionally the
+  // normal of that cell.  Returns the squared distance, or VTK_DOUBLE_MAX and a cell id
+  // of -1 when the surface has no polygons or no distance to x can be computed.
+  double FindClosestPoint(const double x[3], double closest[3], vtkIdType& cellId, double normal[3] = NULL) const;
+
+  // Closest points of the surface to numberOfPoints packed points, in parallel.  Any of
+  // the outputs may be NULL: packed closest points, distances, cell ids and packed
+  // normals of the closest cells.
+  void FindClosestPoints(vtkIdType numberOfPoints, const double* points, double* closestPoints,
+    double* distances, vtkIdType* cellIds, double* normals) const;
+
+  // Pairs of crossing triangles of this surface and of another one, placed by the matrix
+  // from the coordinates of the other surface to the ones of this surface.  Triangles
+  // that only touch, as the faces of two fragments along their cut, do not cross.  The
+  // triangles of each pair are appended to triangles and otherTriangles, and the number
+  // of pairs is returned.
+  vtkIdType FindIntersectingTriangles(const vtkPlannerTriangleIndex* other, vtkMatrix4x4* otherToThis,
+    std::vector<vtkIdType>& triangles, std::vector<vtkIdType>& otherTriangles) const;
+
+  // True if a triangle of this surface and one of another surface, placed by the matrix
+  // from the coordinates of the other surface to the ones of this surface, are at most
+  // distance apart.  Surfaces that touch or cross are at distance 0.
+  bool IsWithinDistance(const vtkPlannerTriangleIndex* other, vtkMatrix4x4* otherToThis, double distance) const;
+
+protected:
+  vtkPlannerTriangleIndex();
+  virtual ~vtkPlannerTriangleIndex();
+
+  //corners of the triangles in leaf order, nine values each
+  std::vector<double> Corners;
+  //cell of the surface each triangle comes from, in leaf order
+  std::vector<vtkIdType> CellIds;
+  //unit normal of each triangle, in leaf order
+  std::vector<double> Normals;
+  //boxes of the triangles, in the order of the triangles
+  vtkPlannerBoxTree Tree;
+
+private:
+  vtkPlannerTriangleIndex(const vtkPlannerTriangleIndex&); // Not implemented
+  void operator=(const vtkPlannerTriangleIndex&); // Not implemented
+};
+
+#endif
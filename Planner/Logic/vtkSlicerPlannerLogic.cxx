@@ -33,27 +33,41 @@
 #include <vtkMRMLModelDisplayNode.h>
 
 // VTK includes
+#include <vtkAppendPolyData.h>
 #include <vtkNew.h>
-#include <vtkMassProperties.h>
 #include <vtkTriangleFilter.h>
-#include <vtkAppendPolyData.h>
+#include <vtkCellArray.h>
+#include <vtkIdTypeArray.h>
 #include "vtkVector.h"
 #include "vtkVectorOperators.h"
 #include "vtkMath.h"
-#include "vtkCutter.h"
 #include "vtkPointData.h"
 #include "vtkCellData.h"
 #include "vtkPolyDataNormals.h"
 #include "vtkCleanPolyData.h"
 #include "vtkPolyDataPointSampler.h"
-#include "vtkDecimatePro.h"
 #include "vtkMatrix4x4.h"
-#include "vtkVertexGlyphFilter.h"
+#include "vtkGeneralTransform.h"
+#include <vtkMRMLTransformNode.h>
+#include <vtkSMPTools.h>
+#include <vtkSMPThreadLocal.h>
 
 // STD includes
 #include <cassert>
 #include <sstream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+
+//Distance the collision highlight is drawn off the surfaces, in mm
+static const double CollisionHighlightOffset = 0.05;
 
+//Models whose surfaces come this close are neighbors in the adjacency graph, in mm
+static const double AdjacencyTolerance = 0.5;
+
+//Support radius of a local bend, relative to the diagonal of the bounds of the model
+static const double LocalBendSupport = 0.25;
 
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkSlicerPlannerLogic);
@@ -73,18 +87,27 @@ vtkSlicerPlannerLogic::vtkSlicerPlannerLogic()
   this->templateICV = 0;
   this->TempMerged = NULL;
   this->TempWrapped = NULL;
+  this->CollisionHighlight = NULL;
   this->CurrentModel = NULL;
   this->SourcePoints = NULL;
   this->SourcePointsDense = NULL;
   this->TargetPoints = NULL;
   this->Fiducials = NULL;
-  this->cellLocator = NULL;
+  this->BendingIndex = NULL;
   this->bendMode = Double;
   this->bendSide = A;
+  this->BendLandmarkBudget = 300;
+  this->BendLocal = false;
+  this->BendSupportRadius = 0;
   this->BendingPlane = NULL;
-  this->BendingPlaneLocator = NULL;
+  this->BendingPlaneSection = NULL;
   this->bendInitialized = false;
   this->BendingPolyData = NULL;
+  this->PreviewDistance = NULL;
+  this->PreviewReferenceMTime = 0;
+  this->PreviewExactDistance = NULL;
+  this->PreviewPoints = NULL;
+  this->PreviewSigned = false;
 }
 
 //----------------------------------------------------------------------------
@@ -175,8 +198,7 @@ vtkSmartPointer<vtkMRMLCommandLineModuleNode> vtkSlicerPlannerLogic::createPreOP
   std::string name;
   name = HierarchyNode->GetName();
   name += " - Merged";
-  this->TempMerged = this->mergeModel(HierarchyNode, name);
-  this->TempMerged->GetDisplayNode()->SetVisibility(0);
+  this->mergeModel(HierarchyNode, name);
   name = HierarchyNode->GetName();
   name += " - Wrapped";
   return this->wrapModel(this->TempMerged, name, vtkSlicerPlannerLogic::PreOP);
@@ -206,8 +228,7 @@ vtkSmartPointer<vtkMRMLCommandLineModuleNode>  vtkSlicerPlannerLogic::createCurr
   std::string name;
   name = HierarchyNode->GetName();
   name += " - Temp Merge";
-  this->TempMerged = this->mergeModel(HierarchyNode, name);
-  this->TempMerged->GetDisplayNode()->SetVisibility(0);
+  this->mergeModel(HierarchyNode, name);
   name = HierarchyNode->GetName();
   name += " - Current Wrapped";
   return this->wrapModel(this->TempMerged, name, vtkSlicerPlannerLogic::Current);
@@ -279,56 +300,181 @@ double vtkSlicerPlannerLogic::getTemplateICV()
 }
 
 //----------------------------------------------------------------------------
-//Merge hierarchy into a single model
+//Merge hierarchy into a single model.  The wrapper reads its input from the scene, so a
+//single hidden model holds the merge and is reused by every wrap.
 vtkMRMLModelNode* vtkSlicerPlannerLogic::mergeModel(vtkMRMLModelHierarchyNode* HierarchyNode, std::string name)
 {
-
-  vtkNew<vtkMRMLModelNode> mergedModel;
-  vtkNew<vtkAppendPolyData> filter;
   vtkMRMLScene* scene = this->GetMRMLScene();
-  mergedModel->SetScene(scene);
-  mergedModel->SetName(name.c_str());
-  vtkNew<vtkMRMLModelDisplayNode> dnode;
-  vtkNew<vtkMRMLModelStorageNode> snode;
-  mergedModel->SetAndObserveDisplayNodeID(dnode->GetID());
-  mergedModel->SetAndObserveStorageNodeID(snode->GetID());
-  scene->AddNode(dnode.GetPointer());
-  scene->AddNode(snode.GetPointer());
-  scene->AddNode(mergedModel.GetPointer());
+  if (!this->TempMerged || this->TempMerged->GetScene() != scene || !scene->IsNodePresent(this->TempMerged))
+  {
+    vtkNew<vtkMRMLModelNode> mergedModel;
+    mergedModel->SetScene(scene);
+    mergedModel->HideFromEditorsOn();
+    vtkNew<vtkMRMLModelDisplayNode> dnode;
+    vtkNew<vtkMRMLModelStorageNode> snode;
+    dnode->SetVisibility(0);
+    //the merge is only an input of the wrapper, it is not part of the plan
+    mergedModel->SetSaveWithScene(false);
+    dnode->SetSaveWithScene(false);
+    snode->SetSaveWithScene(false);
+    scene->AddNode(dnode.GetPointer());
+    scene->AddNode(snode.GetPointer());
+    scene->AddNode(mergedModel.GetPointer());
+    mergedModel->SetAndObserveDisplayNodeID(dnode->GetID());
+    mergedModel->SetAndObserveStorageNodeID(snode->GetID());
+    this->TempMerged = mergedModel.GetPointer();
+    this->MergeSegments.clear();
+  }
+  this->TempMerged->SetName(name.c_str());
 
   std::vector<vtkMRMLHierarchyNode*> children;
   std::vector<vtkMRMLHierarchyNode*>::const_iterator it;
+  std::vector<vtkPolyData*> childPolyData;
   HierarchyNode->GetAllChildrenNodes(children);
   for(it = children.begin(); it != children.end(); ++it)
   {
     vtkMRMLModelNode* childModel =
       vtkMRMLModelNode::SafeDownCast((*it)->GetAssociatedNode());
 
-    if(childModel)
+    if(childModel && childModel->GetPolyData())
+    {
+      childPolyData.push_back(childModel->GetPolyData());
+    }
+  }
+
+  if (this->updateMergedPolyData(childPolyData) || this->TempMerged->GetPolyData() != this->MergedPolyData)
+  {
+    this->TempMerged->SetAndObservePolyData(this->MergedPolyData);
+  }
+  return this->TempMerged;
+}
+
+//----------------------------------------------------------------------------
+//Bring the merged points and polygons up to date with the children.  When the children
+//kept their number of points and polygons, only the segments of the modified children
+//are copied.  Children with vertices, lines or strips are appended whole instead, as
+//the segments only hold polygons.  Returns true when the merge was built again from scratch.
+bool vtkSlicerPlannerLogic::updateMergedPolyData(const std::vector<vtkPolyData*>& children)
+{
+  bool polygonsOnly = true;
+  for (size_t i = 0; polygonsOnly && i < children.size(); i++)
+  {
+    polygonsOnly = children[i]->GetNumberOfVerts() == 0 && children[i]->GetNumberOfLines() == 0 &&
+      children[i]->GetNumberOfStrips() == 0;
+  }
+  if (!polygonsOnly)
+  {
+    vtkNew<vtkAppendPolyData> append;
+    for (size_t i = 0; i < children.size(); i++)
     {
-      filter->AddInputData(childModel->GetPolyData());
+      append->AddInputData(children[i]);
+    }
+    append->Update();
+    this->MergedPolyData = vtkSmartPointer<vtkPolyData>::New();
+    this->MergedPolyData->ShallowCopy(append->GetOutput());
+    //segments of no child, so the next merge is laid out again
+    this->MergeSegments.assign(children.size(), MergeSegment());
+    return true;
+  }
+
+  bool sameLayout = this->MergedPolyData && this->MergeSegments.size() == children.size();
+  for (size_t i = 0; sameLayout && i < children.size(); i++)
+  {
+    const MergeSegment& segment = this->MergeSegments[i];
+    sameLayout = segment.PolyData == children[i] &&
+      segment.NumberOfPoints == children[i]->GetNumberOfPoints() &&
+      segment.NumberOfCells == children[i]->GetNumberOfPolys() &&
+      segment.ConnectivitySize == children[i]->GetPolys()->GetData()->GetNumberOfValues();
+  }
 
+  if (!sameLayout)
+  {
+    this->MergeSegments.resize(children.size());
+    vtkIdType numberOfPoints = 0;
+    vtkIdType connectivitySize = 0;
+    vtkIdType numberOfCells = 0;
+    for (size_t i = 0; i < children.size(); i++)
+    {
+      MergeSegment& segment = this->MergeSegments[i];
+      segment.PolyData = children[i];
+      segment.MTime = 0;
+      segment.NumberOfPoints = children[i]->GetNumberOfPoints();
+      segment.PointOffset = numberOfPoints;
+      segment.NumberOfCells = children[i]->GetNumberOfPolys();
+      segment.ConnectivitySize = children[i]->GetPolys()->GetData()->GetNumberOfValues();
+      segment.ConnectivityOffset = connectivitySize;
+      numberOfPoints += segment.NumberOfPoints;
+      connectivitySize += segment.ConnectivitySize;
+      numberOfCells += segment.NumberOfCells;
     }
+    vtkNew<vtkPoints> points;
+    points->SetNumberOfPoints(numberOfPoints);
+    vtkNew<vtkIdTypeArray> connectivity;
+    connectivity->SetNumberOfValues(connectivitySize);
+    vtkNew<vtkCellArray> polys;
+    polys->SetCells(numberOfCells, connectivity.GetPointer());
+    this->MergedPolyData = vtkSmartPointer<vtkPolyData>::New();
+    this->MergedPolyData->SetPoints(points.GetPointer());
+    this->MergedPolyData->SetPolys(polys.GetPointer());
   }
 
-  filter->Update();
-  mergedModel->SetAndObservePolyData(filter->GetOutput());
-  mergedModel->SetAndObserveDisplayNodeID(dnode->GetID());
+  vtkPoints* points = this->MergedPolyData->GetPoints();
+  vtkIdTypeArray* connectivity = this->MergedPolyData->GetPolys()->GetData();
+  bool modified = false;
+  for (size_t i = 0; i < children.size(); i++)
+  {
+    MergeSegment& segment = this->MergeSegments[i];
+    if (segment.MTime == children[i]->GetMTime())
+    {
+      continue;
+    }
+    double p[3];
+    for (vtkIdType j = 0; j < segment.NumberOfPoints; j++)
+    {
+      children[i]->GetPoint(j, p);
+      points->SetPoint(segment.PointOffset + j, p);
+    }
+
+    //cells are stored as their number of points followed by the point ids
+    vtkIdType* source = children[i]->GetPolys()->GetData()->GetPointer(0);
+    vtkIdType* target = connectivity->GetPointer(segment.ConnectivityOffset);
+    for (vtkIdType j = 0; j < segment.ConnectivitySize;)
+    {
+      vtkIdType npts = source[j];
+      target[j++] = npts;
+      for (vtkIdType k = 0; k < npts; k++, j++)
+      {
+        target[j] = source[j] + segment.PointOffset;
+      }
+    }
+    segment.MTime = children[i]->GetMTime();
+    modified = true;
+  }
 
-  return mergedModel.GetPointer();
+  if (modified)
+  {
+    points->Modified();
+    connectivity->Modified();
+    this->MergedPolyData->GetPolys()->Modified();
+    this->MergedPolyData->Modified();
+  }
+  return !sameLayout;
 }
 
 //----------------------------------------------------------------------------
 //Compute the ICV of a model
 double vtkSlicerPlannerLogic::computeICV(vtkMRMLModelNode* model)
 {
-  vtkNew<vtkMassProperties> areaFilter;
-  vtkNew<vtkTriangleFilter> triFilter;
-  triFilter->SetInputData(model->GetPolyData());
-  triFilter->Update();
-  areaFilter->SetInputData(triFilter->GetOutput());
-  areaFilter->Update();
-  return (areaFilter->GetVolume() / 1000);   //convert to cm^3
+  //the preprocessed copy is triangulated, with its triangles oriented consistently as
+  //the volume needs
+  vtkPolyData* polyData = this->getPreprocessedPolyData(model);
+  if (!polyData || !polyData->GetPoints())
+  {
+    return 0;
+  }
+  std::vector<vtkIdType> triangles;
+  getTriangles(polyData, triangles);
+  return (computeVolume(polyData->GetPoints(), triangles) / 1000);   //convert to cm^3
 }
 
 //----------------------------------------------------------------------------
@@ -385,12 +531,7 @@ void vtkSlicerPlannerLogic::finishWrap(vtkMRMLCommandLineModuleNode* cmdNode)
   this->GetMRMLScene()->RemoveNode(cmdNode);
   node->SetAttribute("PlannerRole", "WrappedModel");
 
-
-  if(this->TempMerged)
-  {
-    this->GetMRMLScene()->RemoveNode(this->TempMerged);
-    this->TempMerged = NULL;
-  }
+  //the merged model is kept for the next wrap
 
   if(this->TempWrapped)
   {
@@ -458,73 +599,259 @@ void vtkSlicerPlannerLogic::initializeBend(vtkPoints* inputFiducials, vtkMRMLMod
   this->Fiducials = inputFiducials;
   this->ModelToBend = model;
 
-  vtkNew<vtkTriangleFilter> triangulate;
-  vtkNew<vtkCleanPolyData> clean;
-  vtkNew<vtkPolyDataNormals> normals;
-  normals->SetComputePointNormals(1);
-  normals->SetComputeCellNormals(1);
-  normals->SetAutoOrientNormals(1);
-  normals->SetInputData(this->ModelToBend->GetPolyData());
-  normals->Update();
-  clean->SetInputData(normals->GetOutput());
-  clean->Update();
-  this->BendingPolyData = clean->GetOutput();
+  this->BendingPolyData = this->getPreprocessedPolyData(model);
+  //a local bend only moves the surface within the support radius of the displaced landmarks
+  this->BendSupportRadius = this->BendLocal ? LocalBendSupport * this->BendingPolyData->GetLength() : 0;
 
-  this->cellLocator = vtkSmartPointer<vtkCellLocator>::New();
-  this->cellLocator->SetDataSet(this->BendingPolyData);
-  this->cellLocator->BuildLocator();
+  this->BendingIndex = vtkSmartPointer<vtkPlannerTriangleIndex>::New();
+  this->BendingIndex->Build(this->BendingPolyData);
 
   this->generateSourcePoints();
+  this->updateBendLandmarks();
+
+  this->HingeTransform = vtkSmartPointer<vtkPlannerHingeTransform>::New();
   this->bendInitialized =  true;
 }
 
+//----------------------------------------------------------------------------
+//Select the landmarks and compute their bend geometry.  The landmarks change, so the
+//spline system has to be decomposed again.
+void vtkSlicerPlannerLogic::updateBendLandmarks()
+{
+  //Downsample to a fixed number of source points, so the cost of the bend does not depend on the mesh resolution
+  this->SourcePointsDense = this->selectLandmarks(this->BendingPolyData->GetPoints(), this->BendLandmarkBudget);
+  this->computeBendGeometry();
+
+  this->BendTransform = vtkSmartPointer<vtkPlannerBendTransform>::New();
+  this->BendTransform->SetSupportRadius(this->BendSupportRadius);
+}
+
 //----------------------------------------------------------------------------
 //CReate bend transform based on points and bend magnitude
-vtkSmartPointer<vtkThinPlateSplineTransform> vtkSlicerPlannerLogic::getBendTransform(double magnitude)
+vtkSmartPointer<vtkWarpTransform> vtkSlicerPlannerLogic::getBendTransform(double magnitude)
 {
-  vtkSmartPointer<vtkThinPlateSplineTransform> transform = vtkSmartPointer<vtkThinPlateSplineTransform>::New();
-  if(this->bendInitialized)
+  if(!this->bendInitialized)
   {
+    return vtkSmartPointer<vtkPlannerBendTransform>::New();
+  }
+
+  if(this->bendMode == Hinge)
+  {
+    this->configureHingeTransform(this->HingeTransform, magnitude);
+    return this->HingeTransform;
+  }
+
+  //the source landmarks are fixed for the whole bend, so the spline system is decomposed
+  //once, the first time it is needed, and each magnitude only needs new coefficients
+  if(this->BendTransform->GetNumberOfLandmarks() != this->SourcePointsDense->GetNumberOfPoints())
+  {
+    this->BendTransform->SetSourceLandmarks(this->SourcePointsDense);
+  }
+  this->TargetPoints = vtkSmartPointer<vtkPoints>::New();
+  this->computeTargetPoints(magnitude, this->TargetPoints);
+  this->BendTransform->SetTargetLandmarks(this->TargetPoints);
+  return this->BendTransform;
+}
+
+//----------------------------------------------------------------------------
+//Create bend transform as getBendTransform, but as a new transform that shares no data
+//with the bend state, so it can be used on another thread once it is created.  The
+//decomposition of the spline is not copied, only what evaluating it needs.
+vtkSmartPointer<vtkWarpTransform> vtkSlicerPlannerLogic::createBendTransform(double magnitude)
+{
+  if(!this->bendInitialized)
+  {
+    return vtkSmartPointer<vtkPlannerBendTransform>::New();
+  }
+
+  if(this->bendMode == Hinge)
+  {
+    vtkSmartPointer<vtkPlannerHingeTransform> hinge = vtkSmartPointer<vtkPlannerHingeTransform>::New();
+    this->configureHingeTransform(hinge, magnitude);
+    return hinge;
+  }
+
+  if(this->BendTransform->GetNumberOfLandmarks() != this->SourcePointsDense->GetNumberOfPoints())
+  {
+    this->BendTransform->SetSourceLandmarks(this->SourcePointsDense);
+  }
+  vtkNew<vtkPoints> target;
+  this->computeTargetPoints(magnitude, target.GetPointer());
+  vtkSmartPointer<vtkPlannerBendTransform> tps = vtkSmartPointer<vtkPlannerBendTransform>::New();
+  this->BendTransform->ComputeSpline(target.GetPointer(), tps);
+  return tps;
+}
+
+//----------------------------------------------------------------------------
+//Set up a sweep of the current bend over a range of magnitudes, with as many samples as
+//the memory budget allows for the points, at most 21.  NULL if fewer than
+//MinimumBendSweepSamples fit: over the slider range the bend turns by up to 90 degrees,
+//and fewer samples would interpolate the rotation far from the bend.  The sample
+//transforms are created here, so computing the sweep does not touch the bend state.
+vtkSmartPointer<vtkPlannerBendSweep> vtkSlicerPlannerLogic::createBendSweep(vtkPoints* points, double minimumMagnitude, double maximumMagnitude)
+{
+  vtkIdType numberOfPoints = std::max(points->GetNumberOfPoints(), static_cast<vtkIdType>(1));
+  vtkIdType fitting = BendSweepBudget / (3 * numberOfPoints);
+  if (fitting < MinimumBendSweepSamples)
+  {
+    return NULL;
+  }
+  int numberOfSamples = static_cast<int>(std::min(fitting, static_cast<vtkIdType>(21)));
+  vtkSmartPointer<vtkPlannerBendSweep> sweep = vtkSmartPointer<vtkPlannerBendSweep>::New();
+  sweep->SetPoints(points);
+  sweep->SetSampling(minimumMagnitude, maximumMagnitude, numberOfSamples);
+  for(int i = 0; i < numberOfSamples; i++)
+  {
+    sweep->SetSampleTransform(i, this->createBendTransform(sweep->GetSampleMagnitude(i)));
+  }
+  return sweep;
+}
+
+//----------------------------------------------------------------------------
+//Find the magnitude in the range that brings the model being bent closest to the
+//reference, on average over a subset of its points.  The range is scanned coarsely first,
+//then a golden section search refines the best bracket.  Each evaluation only updates the
+//spline targets of the decomposed system and queries the cached reference distance.
+double vtkSlicerPlannerLogic::optimizeBendMagnitude(vtkMRMLModelNode* reference, double minimumMagnitude, double maximumMagnitude)
+{
+  if (!this->bendInitialized || !reference || !reference->GetPolyData() ||
+    reference->GetPolyData()->GetNumberOfPoints() == 0 || maximumMagnitude <= minimumMagnitude)
+  {
+    vtkErrorMacro("optimizeBendMagnitude: no bend or reference to optimize against");
+    return 0;
+  }
+  this->updateReferenceDistance(reference->GetPolyData());
 
-    this->TargetPoints = vtkSmartPointer<vtkPoints>::New();
-    for(int i = 0; i < this->SourcePointsDense->GetNumberOfPoints(); i++)
+  vtkPoints* points = this->BendingPolyData->GetPoints();
+  vtkIdType stride = std::max(points->GetNumberOfPoints() / BendOptimizeSampleBudget, static_cast<vtkIdType>(1));
+  vtkNew<vtkPoints> samples;
+  samples->SetDataTypeToDouble();
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i += stride)
+  {
+    double p[3];
+    points->GetPoint(i, p);
+    samples->InsertNextPoint(p);
+  }
+  vtkNew<vtkPoints> bent;
+
+  //coarse scan, the distance may have more than one local minimum over the whole range
+  const int scanIntervals = 8;
+  double step = (maximumMagnitude - minimumMagnitude) / scanIntervals;
+  int best = 0;
+  double bestDistance = std::numeric_limits<double>::max();
+  for (int i = 0; i <= scanIntervals; i++)
+  {
+    double distance = this->meanBendDistance(samples.GetPointer(), minimumMagnitude + i * step, bent.GetPointer());
+    if (distance < bestDistance)
     {
-      double p[3];
-      this->SourcePointsDense->GetPoint(i, p);
-      vtkVector3d point = (vtkVector3d)p;
-      vtkVector3d bent = point;
-      if(this->bendMode == Double)
-      {
-        bent = this->bendPoint(point, magnitude);
-      }
-      if(this->bendMode == Single)
-      {
-        if(this->bendSide == A)
-        {
-          if(this->BendingPlane->EvaluateFunction(point.GetData())*this->BendingPlane->EvaluateFunction(this->SourcePoints->GetPoint(0)) > 0)
-          {
-            bent = this->bendPoint(point, magnitude);
-          }
-        }
-        if(this->bendSide == B)
-        {
-          if(this->BendingPlane->EvaluateFunction(point.GetData())*this->BendingPlane->EvaluateFunction(this->SourcePoints->GetPoint(1)) > 0)
-          {
-            bent = this->bendPoint(point, magnitude);
-          }
-        }
+      bestDistance = distance;
+      best = i;
+    }
+  }
 
-      }
-      this->TargetPoints->InsertPoint(i, bent.GetData());
+  //golden section search in the intervals around the best sample
+  const double ratio = 0.5 * (std::sqrt(5.0) - 1);
+  double a = minimumMagnitude + std::max(best - 1, 0) * step;
+  double b = minimumMagnitude + std::min(best + 1, scanIntervals) * step;
+  double x1 = b - ratio * (b - a);
+  double x2 = a + ratio * (b - a);
+  double f1 = this->meanBendDistance(samples.GetPointer(), x1, bent.GetPointer());
+  double f2 = this->meanBendDistance(samples.GetPointer(), x2, bent.GetPointer());
+  double tolerance = 1e-3 * (maximumMagnitude - minimumMagnitude);
+  while (b - a > tolerance)
+  {
+    if (f1 < f2)
+    {
+      b = x2;
+      x2 = x1;
+      f2 = f1;
+      x1 = b - ratio * (b - a);
+      f1 = this->meanBendDistance(samples.GetPointer(), x1, bent.GetPointer());
     }
+    else
+    {
+      a = x1;
+      x1 = x2;
+      f1 = f2;
+      x2 = a + ratio * (b - a);
+      f2 = this->meanBendDistance(samples.GetPointer(), x2, bent.GetPointer());
+    }
+  }
+
+  double magnitude = 0.5 * (a + b);
+  if (std::min(f1, f2) > bestDistance)
+  {
+    magnitude = minimumMagnitude + best * step;
+  }
+  return magnitude;
+}
+
+//----------------------------------------------------------------------------
+//Mean unsigned distance from the bent samples to the reference
+double vtkSlicerPlannerLogic::meanBendDistance(vtkPoints* samples, double magnitude, vtkPoints* bent)
+{
+  vtkSmartPointer<vtkWarpTransform> transform = this->createBendTransform(magnitude);
+  bent->Reset();
+  transform->TransformPoints(samples, bent);
+  double sum = 0;
+  for (vtkIdType i = 0; i < bent->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    bent->GetPoint(i, p);
+    sum += std::fabs(this->PreviewDistance->EvaluateFunction(p));
+  }
+  return sum / std::max(bent->GetNumberOfPoints(), static_cast<vtkIdType>(1));
+}
+
+//----------------------------------------------------------------------------
+//Bend the dense source points by the magnitude
+void vtkSlicerPlannerLogic::computeTargetPoints(double magnitude, vtkPoints* target)
+{
+  //in single sided and hinge mode only the landmarks on the side of the chosen fiducial move
+  double movingSide = 0;
+  if(this->bendMode != Double)
+  {
+    double fiducial[3];
+    this->SourcePoints->GetPoint(this->bendSide == A ? 0 : 1, fiducial);
+    movingSide = this->BendingPlane->EvaluateFunction(fiducial);
+  }
 
-    transform->SetSigma(.0001);
-    transform->SetBasisToR();
-    transform->SetSourceLandmarks(this->SourcePointsDense);
-    transform->SetTargetLandmarks(this->TargetPoints);
-    transform->Update();
+  vtkIdType numberOfLandmarks = this->SourcePointsDense->GetNumberOfPoints();
+  target->SetDataTypeToDouble();
+  target->SetNumberOfPoints(numberOfLandmarks);
+  double* sourcePoints = static_cast<double*>(this->SourcePointsDense->GetVoidPointer(0));
+  double* targetPoints = static_cast<double*>(target->GetVoidPointer(0));
+  for(vtkIdType i = 0; i < numberOfLandmarks; i++)
+  {
+    vtkVector3d point = (vtkVector3d)(sourcePoints + 3 * i);
+    vtkVector3d bent = point;
+    if(movingSide == 0 || this->LandmarkSides[i] * movingSide > 0)
+    {
+      bent = this->bendPoint(point, this->LandmarkLevers[i], this->LandmarkDirections[i], magnitude);
+    }
+    targetPoints[3 * i] = bent[0];
+    targetPoints[3 * i + 1] = bent[1];
+    targetPoints[3 * i + 2] = bent[2];
   }
-  return transform;
+}
+
+//----------------------------------------------------------------------------
+//Rotate the chosen side about the axis through the pivot, by the same angle the
+//spline bend gives its landmarks: bendPoint turns them by atan(magnitude)
+void vtkSlicerPlannerLogic::configureHingeTransform(vtkPlannerHingeTransform* transform, double magnitude)
+{
+  double fiducial[3];
+  double pivot[3];
+  double axis[3];
+  this->SourcePoints->GetPoint(this->bendSide == A ? 0 : 1, fiducial);
+  this->SourcePoints->GetPoint(5, pivot);
+  this->SourcePoints->GetPoint(4, axis);
+  double side = this->BendingPlane->EvaluateFunction(fiducial);
+  double angle = std::atan(magnitude);
+  transform->SetAxis(pivot, axis);
+  transform->SetPlane(this->BendingPlane->GetOrigin(), this->BendingPlane->GetNormal());
+  transform->SetAngles(side < 0 ? angle : 0, side < 0 ? 0 : -angle);
+  transform->SetBlendWidth(0.05 * this->BendingPolyData->GetLength());
 }
 
 //----------------------------------------------------------------------------
@@ -534,11 +861,16 @@ void vtkSlicerPlannerLogic::clearBendingData()
   this->SourcePoints = NULL;
   this->SourcePointsDense = NULL;
   this->TargetPoints = NULL;
+  this->BendTransform = NULL;
+  this->HingeTransform = NULL;
+  this->LandmarkLevers.clear();
+  this->LandmarkDirections.clear();
+  this->LandmarkSides.clear();
   this->Fiducials = NULL;
   this->ModelToBend = NULL;
-  this->cellLocator = NULL;
+  this->BendingIndex = NULL;
   this->BendingPlane = NULL;
-  this->BendingPlaneLocator = NULL;
+  this->BendingPlaneSection = NULL;
   this->bendInitialized = false;
 }
 
@@ -571,7 +903,7 @@ void vtkSlicerPlannerLogic::generateSourcePoints()
       D = (vtkVector3d)secondPoint;
       CD = D - C;
       vtkVector3d CDMid = C + 0.5*CD;
-      vtkVector3d normal = this->getNormalAtPoint(CDMid, this->cellLocator, this->BendingPolyData);
+      vtkVector3d normal = this->getNormalAtPoint(CDMid, this->BendingIndex);
       vtkVector3d bendLine = normal.Cross(CD);
       A = CDMid + bendLine;
       B = CDMid - bendLine;
@@ -583,7 +915,7 @@ void vtkSlicerPlannerLogic::generateSourcePoints()
       B = (vtkVector3d)secondPoint;
       AB = B - A;
       vtkVector3d ABMid = A + 0.5*AB;
-      vtkVector3d normal = this->getNormalAtPoint(ABMid, this->cellLocator, this->BendingPolyData);
+      vtkVector3d normal = this->getNormalAtPoint(ABMid, this->BendingIndex);
       vtkVector3d bendAxis = normal.Cross(AB);
       C = ABMid + bendAxis;
       D = ABMid - bendAxis;
@@ -622,65 +954,151 @@ void vtkSlicerPlannerLogic::generateSourcePoints()
 
   //Store beding axis in source points
   this->SourcePoints->InsertPoint(4, axis.GetData());
-
-  //Agressively downsample to create source points
-  vtkNew<vtkCleanPolyData> clean;
-  vtkNew<vtkVertexGlyphFilter> verts;
-  verts->SetInputData(this->BendingPolyData);
-  verts->Update();
-  clean->SetInputData(verts->GetOutput());
-  clean->SetTolerance(0.07);
-  clean->Update();
-  this->SourcePointsDense = clean->GetOutput()->GetPoints();
+  //and the pivot the axis goes through
+  this->SourcePoints->InsertPoint(5, F.GetData());
 }
 
 //----------------------------------------------------------------------------
-//Project a 3D point onto the closest point on the bending model
-vtkVector3d vtkSlicerPlannerLogic::projectToModel(vtkVector3d point)
+//Farthest point sampling: add count candidates, each one the allowed candidate farthest
+//from the ones already selected.  Stops early if all the candidates are selected.
+static void farthestPointSampling(const std::vector<vtkVector3d>& candidates, const std::vector<bool>& allowed,
+  int count, std::vector<double>& minDist2, std::vector<vtkIdType>& selected)
 {
-  //build locator when model is loaded
-
-  return this->projectToModel(point, this->cellLocator);
+  for (int n = 0; n < count; n++)
+  {
+    vtkIdType farthest = -1;
+    for (vtkIdType i = 0; i < static_cast<vtkIdType>(candidates.size()); i++)
+    {
+      if (allowed[i] && minDist2[i] > 0 && (farthest < 0 || minDist2[i] > minDist2[farthest]))
+      {
+        farthest = i;
+      }
+    }
+    if (farthest < 0)
+    {
+      return;
+    }
+    selected.push_back(farthest);
+    for (vtkIdType i = 0; i < static_cast<vtkIdType>(candidates.size()); i++)
+    {
+      vtkVector3d d = candidates[i] - candidates[farthest];
+      minDist2[i] = std::min(minDist2[i], d.Dot(d));
+    }
+  }
 }
 
 //----------------------------------------------------------------------------
-//Project a 3D point onto the closest point on the bending model, constrained by a plane
-vtkVector3d vtkSlicerPlannerLogic::projectToModel(vtkVector3d point, vtkPlane* plane)
+//Select at most budget landmarks spread evenly over the points.  A fifth of the budget is
+//first spread along the bending plane, where the model folds, and the rest fills the model
+vtkSmartPointer<vtkPoints> vtkSlicerPlannerLogic::selectLandmarks(vtkPoints* points, int budget)
 {
-  vtkNew<vtkCutter> cutter;
-  cutter->SetCutFunction(plane);
-  cutter->SetInputData(this->BendingPolyData);
-  vtkSmartPointer<vtkPolyData> cut;
-  cutter->Update();
-  cut = cutter->GetOutput();
-  return this->projectToModel(point, cut);
+  vtkSmartPointer<vtkPoints> landmarks = vtkSmartPointer<vtkPoints>::New();
+  landmarks->SetDataTypeToDouble();
+  if (!points || points->GetNumberOfPoints() == 0 || budget <= 0)
+  {
+    return landmarks;
+  }
+
+  //candidates are reduced to one point per grid cell, much smaller than the landmark spacing
+  double bounds[6];
+  points->GetBounds(bounds);
+  double diagonal = std::sqrt((bounds[1] - bounds[0]) * (bounds[1] - bounds[0]) +
+    (bounds[3] - bounds[2]) * (bounds[3] - bounds[2]) +
+    (bounds[5] - bounds[4]) * (bounds[5] - bounds[4]));
+  double spacing = std::max(diagonal / std::sqrt(static_cast<double>(budget)), 1e-6);
+  double cellSize = 0.25 * spacing;
+  std::map<long long, vtkIdType> cells;
+  std::vector<vtkVector3d> candidates;
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+  {
+    vtkVector3d p = (vtkVector3d)points->GetPoint(i);
+    long long key = 0;
+    for (int j = 0; j < 3; j++)
+    {
+      key = (key << 21) | static_cast<long long>((p[j] - bounds[2 * j]) / cellSize);
+    }
+    if (cells.insert(std::make_pair(key, static_cast<vtkIdType>(candidates.size()))).second)
+    {
+      candidates.push_back(p);
+    }
+  }
+
+  std::vector<double> minDist2(candidates.size(), std::numeric_limits<double>::max());
+  std::vector<vtkIdType> selected;
+
+  //mandatory landmarks close to the bending plane, starting from the middle of the axis
+  if (this->BendingPlane)
+  {
+    vtkVector3d origin = (vtkVector3d)this->BendingPlane->GetOrigin();
+    vtkVector3d normal = ((vtkVector3d)this->BendingPlane->GetNormal()).Normalized();
+    std::vector<bool> nearPlane(candidates.size(), false);
+    vtkIdType first = -1;
+    double firstDist2 = std::numeric_limits<double>::max();
+    for (vtkIdType i = 0; i < static_cast<vtkIdType>(candidates.size()); i++)
+    {
+      nearPlane[i] = std::fabs(normal.Dot(candidates[i] - origin)) < cellSize;
+      vtkVector3d d = candidates[i] - origin;
+      if (nearPlane[i] && d.Dot(d) < firstDist2)
+      {
+        first = i;
+        firstDist2 = d.Dot(d);
+      }
+    }
+    if (first >= 0)
+    {
+      selected.push_back(first);
+      for (vtkIdType i = 0; i < static_cast<vtkIdType>(candidates.size()); i++)
+      {
+        vtkVector3d d = candidates[i] - candidates[first];
+        minDist2[i] = d.Dot(d);
+      }
+      farthestPointSampling(candidates, nearPlane, std::max(budget / 5, 1) - 1, minDist2, selected);
+    }
+  }
+
+  std::vector<bool> all(candidates.size(), true);
+  farthestPointSampling(candidates, all, budget - static_cast<int>(selected.size()), minDist2, selected);
+  for (size_t i = 0; i < selected.size(); i++)
+  {
+    landmarks->InsertNextPoint(candidates[selected[i]].GetData());
+  }
+  return landmarks;
 }
 
 //----------------------------------------------------------------------------
-//Project a 3D point onto the closest point on the specified model
-vtkVector3d vtkSlicerPlannerLogic::projectToModel(vtkVector3d point, vtkPolyData* model)
+//Project a 3D point onto the closest point on the bending model
+vtkVector3d vtkSlicerPlannerLogic::projectToModel(vtkVector3d point)
 {
-  vtkNew<vtkCellLocator> locator;
-  vtkNew<vtkTriangleFilter> triangulate;
-  triangulate->SetInputData(model);
-  triangulate->Update();
-  locator->SetDataSet(triangulate->GetOutput());
-  locator->BuildLocator();
-  return this->projectToModel(point, locator.GetPointer());
+  //the index is built when the model is loaded
+  return this->projectToModel(point, this->BendingIndex);
 }
 
 //----------------------------------------------------------------------------
-//Project a 3D point onto the closest point on the model as defined by the provided cell locator
-vtkVector3d vtkSlicerPlannerLogic::projectToModel(vtkVector3d point, vtkCellLocator* locator)
+//Project a 3D point onto the closest point on the model as defined by the provided index.
+//The point is kept when the model is empty.
+vtkVector3d vtkSlicerPlannerLogic::projectToModel(vtkVector3d point, vtkPlannerTriangleIndex* index)
 {
+  vtkVector3d projection = point;
   double closestPoint[3];//the coordinates of the closest point will be returned here
-  double closestPointDist2; //the squared distance to the closest point will be returned here
   vtkIdType cellId; //the cell id of the cell containing the closest point will be returned here
-  int subId; //this is rarely used (in triangle strips only, I believe)
-  locator->FindClosestPoint(point.GetData(), closestPoint, cellId, subId, closestPointDist2);
+  if (index->FindClosestPoint(point.GetData(), closestPoint, cellId) < VTK_DOUBLE_MAX)
+  {
+    projection.Set(closestPoint[0], closestPoint[1], closestPoint[2]);
+  }
+  return projection;
+}
 
-  vtkVector3d projection;
-  projection.Set(closestPoint[0], closestPoint[1], closestPoint[2]);
+//----------------------------------------------------------------------------
+//Project a 3D point onto the closest point on a section of the model.  The point is
+//kept when the section is empty.
+vtkVector3d vtkSlicerPlannerLogic::projectToModel(vtkVector3d point, vtkPlannerPlaneSection* section)
+{
+  vtkVector3d projection = point;
+  double closestPoint[3];
+  if (section->FindClosestPoint(point.GetData(), closestPoint) < VTK_DOUBLE_MAX)
+  {
+    projection.Set(closestPoint[0], closestPoint[1], closestPoint[2]);
+  }
   return projection;
 }
 
@@ -701,49 +1119,185 @@ vtkSmartPointer<vtkPlane> vtkSlicerPlannerLogic::createPlane(vtkVector3d A, vtkV
 }
 
 //----------------------------------------------------------------------------
-//bend point using vector computed from axis
-vtkVector3d vtkSlicerPlannerLogic::bendPoint(vtkVector3d point, double magnitude)
+//Compute the parts of the bend of each landmark that do not depend on the magnitude:
+//the lever from the landmark to its foot point on the bending axis, the direction it
+//moves in and the side of the bending plane it is on
+void vtkSlicerPlannerLogic::computeBendGeometry()
 {
   double ax[3];
   this->SourcePoints->GetPoint(4, ax);
   vtkVector3d axis = (vtkVector3d)ax;
-  vtkVector3d F = projectToModel(point, this->BendingPlaneLocator);
-  vtkVector3d AF = F - point;
-  vtkVector3d BendingVector;
-  if(this->BendingPlane->EvaluateFunction(point.GetData()) < 0)
+
+  vtkIdType numberOfLandmarks = this->SourcePointsDense->GetNumberOfPoints();
+  this->LandmarkLevers.resize(numberOfLandmarks);
+  this->LandmarkDirections.resize(numberOfLandmarks);
+  this->LandmarkSides.resize(numberOfLandmarks);
+  for(vtkIdType i = 0; i < numberOfLandmarks; i++)
   {
-    BendingVector = AF.Cross(axis);
+    vtkVector3d point = (vtkVector3d)this->SourcePointsDense->GetPoint(i);
+    vtkVector3d F = projectToModel(point, this->BendingPlaneSection);
+    vtkVector3d AF = F - point;
+    double side = this->BendingPlane->EvaluateFunction(point.GetData());
+    vtkVector3d BendingVector;
+    if(side < 0)
+    {
+      BendingVector = AF.Cross(axis);
+    }
+    else
+    {
+      BendingVector = axis.Cross(AF);
+    }
+    this->LandmarkLevers[i] = AF;
+    this->LandmarkDirections[i] = BendingVector.Normalized();
+    this->LandmarkSides[i] = side;
   }
-  else
+}
+
+//----------------------------------------------------------------------------
+//bend point along its precomputed direction, keeping its distance to the foot point:
+//a turn of atan(magnitude) about the foot point
+vtkVector3d vtkSlicerPlannerLogic::bendPoint(vtkVector3d point, vtkVector3d lever, vtkVector3d direction, double magnitude)
+{
+  double length = lever.Norm();
+  if(length == 0)
+  {
+    return point;
+  }
+  vtkVector3d F = point + lever;
+  vtkVector3d rotationAxis = ((-1.0 / length) * lever).Cross(direction);
+  double angle = std::atan(magnitude);
+  double c = std::cos(angle);
+  double s = std::sin(angle);
+
+  //Rodrigues rotation about the foot point
+  vtkVector3d v = point - F;
+  vtkVector3d rotated = c * v + s * rotationAxis.Cross(v) + ((1 - c) * rotationAxis.Dot(v)) * rotationAxis;
+  return F + rotated;
+}
+
+//----------------------------------------------------------------------------
+//Sum of the areas of a range of triangles, or of the signed volumes of the tetrahedra
+//from the origin to them, for vtkSMPTools
+template <class T>
+class vtkPlannerTriangleSumFunctor
+{
+public:
+  vtkPlannerTriangleSumFunctor(const T* points, const vtkIdType* triangles, bool volume)
+    : Points(points), Triangles(triangles), Volume(volume), Sum(0)
+  {
+  }
+
+  const T* Points;
+  const vtkIdType* Triangles;
+  bool Volume;
+  vtkSMPThreadLocal<double> Sum;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    double& sum = this->Sum.Local();
+    for (vtkIdType i = begin; i < end; i++)
+    {
+      const T* a = this->Points + 3 * this->Triangles[3 * i];
+      const T* b = this->Points + 3 * this->Triangles[3 * i + 1];
+      const T* c = this->Points + 3 * this->Triangles[3 * i + 2];
+      double ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+      double ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+      double cross[3];
+      vtkMath::Cross(ab, ac, cross);
+      if (this->Volume)
+      {
+        sum += (a[0] * cross[0] + a[1] * cross[1] + a[2] * cross[2]) / 6;
+      }
+      else
+      {
+        sum += 0.5 * vtkMath::Norm(cross);
+      }
+    }
+  }
+
+  double GetSum()
+  {
+    double sum = 0;
+    for (typename vtkSMPThreadLocal<double>::iterator it = this->Sum.begin(); it != this->Sum.end(); ++it)
+    {
+      sum += *it;
+    }
+    return sum;
+  }
+};
+
+//----------------------------------------------------------------------------
+//Sum the areas or signed volumes of the triangles in parallel, straight from the point
+//buffer when it holds floats or doubles
+static double sumOverTriangles(vtkPoints* points, const std::vector<vtkIdType>& triangles, bool volume)
+{
+  vtkIdType numberOfTriangles = static_cast<vtkIdType>(triangles.size() / 3);
+  if (numberOfTriangles == 0)
+  {
+    return 0;
+  }
+  if (points->GetDataType() == VTK_FLOAT)
+  {
+    vtkPlannerTriangleSumFunctor<float> functor(static_cast<float*>(points->GetVoidPointer(0)), &triangles[0], volume);
+    vtkSMPTools::For(0, numberOfTriangles, functor);
+    return functor.GetSum();
+  }
+  vtkSmartPointer<vtkPoints> doublePoints = points;
+  if (points->GetDataType() != VTK_DOUBLE)
+  {
+    doublePoints = vtkSmartPointer<vtkPoints>::New();
+    doublePoints->SetDataTypeToDouble();
+    doublePoints->SetNumberOfPoints(points->GetNumberOfPoints());
+    for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+    {
+      doublePoints->SetPoint(i, points->GetPoint(i));
+    }
+  }
+  vtkPlannerTriangleSumFunctor<double> functor(static_cast<double*>(doublePoints->GetVoidPointer(0)), &triangles[0], volume);
+  vtkSMPTools::For(0, numberOfTriangles, functor);
+  return functor.GetSum();
+}
+
+//----------------------------------------------------------------------------
+//Pack the triangles of a triangulated model, three point ids each
+void vtkSlicerPlannerLogic::getTriangles(vtkPolyData* polyData, std::vector<vtkIdType>& triangles)
+{
+  triangles.clear();
+  vtkCellArray* polys = polyData->GetPolys();
+  triangles.reserve(3 * polys->GetNumberOfCells());
+  vtkIdType npts;
+  vtkIdType* pts;
+  for (polys->InitTraversal(); polys->GetNextCell(npts, pts);)
   {
-    BendingVector = axis.Cross(AF);
+    if (npts == 3)
+    {
+      triangles.insert(triangles.end(), pts, pts + 3);
+    }
   }
-  vtkVector3d point2 = point + ((magnitude * AF.Norm()) * BendingVector.Normalized());
-  vtkVector3d A2F = F - point2;
+}
 
-  //correction factor
-  point2 = point2 + (A2F.Norm() - AF.Norm()) * A2F.Normalized();
+//----------------------------------------------------------------------------
+//Same area as vtkMassProperties
+double vtkSlicerPlannerLogic::computeSurfaceArea(vtkPoints* points, const std::vector<vtkIdType>& triangles)
+{
+  return sumOverTriangles(points, triangles, false);
+}
 
-  return point2;
+//----------------------------------------------------------------------------
+//Divergence theorem: the signed volumes of the tetrahedra from the origin to each
+//triangle add up to the enclosed volume.  The triangles must all face out or all face
+//in, which only flips the sign; mixed orientations make the sum meaningless.
+double vtkSlicerPlannerLogic::computeVolume(vtkPoints* points, const std::vector<vtkIdType>& triangles)
+{
+  return std::fabs(sumOverTriangles(points, triangles, true));
 }
+
 //----------------------------------------------------------------------------
 //Create a point locator constrained to the bending axis
 void vtkSlicerPlannerLogic::createBendingLocator()
 {
-  this->BendingPlaneLocator = vtkSmartPointer<vtkCellLocator>::New();
-
-  vtkNew<vtkCutter> cutter;
-  cutter->SetCutFunction(this->BendingPlane);
-  cutter->SetInputData(this->BendingPolyData);
-  vtkSmartPointer<vtkPolyData> cut;
-  cutter->Update();
-  cut = cutter->GetOutput();
-
-  vtkNew<vtkTriangleFilter> triangulate;
-  triangulate->SetInputData(cut);
-  triangulate->Update();
-  this->BendingPlaneLocator->SetDataSet(triangulate->GetOutput());
-  this->BendingPlaneLocator->BuildLocator();
+  this->BendingPlaneSection = vtkSmartPointer<vtkPlannerPlaneSection>::New();
+  this->BendingPlaneSection->Build(this->BendingPolyData, this->BendingPlane);
 }
 
 //----------------------------------------------------------------------------
@@ -751,6 +1305,16 @@ void vtkSlicerPlannerLogic::createBendingLocator()
 void vtkSlicerPlannerLogic::clearModelsAndData()
 {
   this->clearBendingData();
+  this->clearDistancePreview();
+  this->clearModelLocators();
+  this->clearPreprocessedModels();
+  this->clearLevelsOfDetail();
+  this->clearCollisions();
+  this->clearAdjacency();
+  this->CollisionIndices.clear();
+  this->PreviewDistance = NULL;
+  this->PreviewExactDistance = NULL;
+  this->PreviewReferencePolyData = NULL;
   if (this->SkullWrappedPreOP)
   {
     this->GetMRMLScene()->RemoveNode(this->SkullWrappedPreOP);
@@ -776,6 +1340,8 @@ void vtkSlicerPlannerLogic::clearModelsAndData()
     this->GetMRMLScene()->RemoveNode(this->TempMerged);
     this->TempMerged = NULL;
   }
+  this->MergeSegments.clear();
+  this->MergedPolyData = NULL;
 
   if (this->TempWrapped)
   {
@@ -790,37 +1356,1136 @@ void vtkSlicerPlannerLogic::clearModelsAndData()
 
 }
 
-vtkVector3d vtkSlicerPlannerLogic::getNormalAtPoint(vtkVector3d point, vtkCellLocator* locator, vtkPolyData* model)
+vtkVector3d vtkSlicerPlannerLogic::getNormalAtPoint(vtkVector3d point, vtkPlannerTriangleIndex* index)
 {
     double closestPoint[3];//the coordinates of the closest point will be returned here
-    double closestPointDist2; //the squared distance to the closest point will be returned here
     vtkIdType cellId; //the cell id of the cell containing the closest point will be returned here
-    int subId; //this is rarely used (in triangle strips only, I believe)
-    locator->FindClosestPoint(point.GetData(), closestPoint, cellId, subId, closestPointDist2);
-
-    vtkVector3d normal;
-    double n[3];
-    model->GetCellData()->GetNormals()->GetTuple(cellId, n);
-    normal.SetX(n[0]);
-    normal.SetY(n[1]);
-    normal.SetZ(n[2]);
-
+    vtkVector3d normal(0, 0, 0);
+    index->FindClosestPoint(point.GetData(), closestPoint, cellId, normal.GetData());
     return normal;
 }
 
-double vtkSlicerPlannerLogic::getDistanceToModel(vtkVector3d point, vtkPolyData* model)
+//----------------------------------------------------------------------------
+//Distance from a point to a model
+double vtkSlicerPlannerLogic::getDistanceToModel(vtkVector3d point, vtkMRMLModelNode* model)
 {
-    vtkNew<vtkCellLocator> locator;
-    vtkNew<vtkTriangleFilter> triangulate;
-    triangulate->SetInputData(model);
-    triangulate->Update();
-    locator->SetDataSet(triangulate->GetOutput());
-    locator->BuildLocator();
+  double distance = std::numeric_limits<double>::max();
+  this->projectPointsToModel(model, 1, point.GetData(), NULL, &distance, NULL, NULL);
+  return distance;
+}
 
-    double closestPoint[3];//the coordinates of the closest point will be returned here
-    double closestPointDist2; //the squared distance to the closest point will be returned here
-    vtkIdType cellId; //the cell id of the cell containing the closest point will be returned here
-    int subId; //this is rarely used (in triangle strips only, I believe)
-    locator->FindClosestPoint(point.GetData(), closestPoint, cellId, subId, closestPointDist2);   
-    return std::sqrt(closestPointDist2);
-}
\ No newline at end of file
+//----------------------------------------------------------------------------
+//Closest points of a model to packed points, in parallel when there are many.  The
+//outputs are left as they are when the model is empty.
+void vtkSlicerPlannerLogic::projectPointsToModel(vtkMRMLModelNode* model, vtkIdType numberOfPoints, const double* points,
+  double* closestPoints, double* distances, vtkIdType* cellIds, double* normals)
+{
+  vtkPlannerTriangleIndex* index = this->getModelLocator(model);
+  if (!index || index->GetNumberOfTriangles() == 0)
+  {
+    return;
+  }
+  index->FindClosestPoints(numberOfPoints, points, closestPoints, distances, cellIds, normals);
+}
+
+//----------------------------------------------------------------------------
+//Cleaned and triangulated copy of the polydata of a model, with auto oriented point and
+//cell normals.  The copy is shared by the operations on the model until its polydata is
+//replaced or its geometry modified, arrays added to the polydata do not matter.
+vtkPolyData* vtkSlicerPlannerLogic::getPreprocessedPolyData(vtkMRMLModelNode* model)
+{
+  if (!model || !model->GetPolyData())
+  {
+    return NULL;
+  }
+
+  //forget the models removed since
+  std::map<std::string, PreprocessedModel>::iterator it = this->PreprocessedModels.begin();
+  while (it != this->PreprocessedModels.end())
+  {
+    if (!it->second.Model)
+    {
+      this->PreprocessedModels.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  vtkPolyData* polyData = model->GetPolyData();
+  PreprocessedModel uncached;
+  PreprocessedModel& entry = model->GetID() ? this->PreprocessedModels[model->GetID()] : uncached;
+  if (entry.Output && entry.Model == model && entry.PolyData == polyData && entry.MTime == getGeometryMTime(polyData))
+  {
+    return entry.Output;
+  }
+
+  vtkNew<vtkPolyDataNormals> normals;
+  vtkNew<vtkCleanPolyData> clean;
+  vtkNew<vtkTriangleFilter> triangulate;
+  normals->SetComputePointNormals(1);
+  normals->SetComputeCellNormals(1);
+  normals->SetAutoOrientNormals(1);
+  normals->SetInputData(polyData);
+  clean->SetInputConnection(normals->GetOutputPort());
+  triangulate->SetInputConnection(clean->GetOutputPort());
+  triangulate->PassLinesOff();
+  triangulate->PassVertsOff();
+  triangulate->Update();
+
+  entry.Model = model;
+  entry.PolyData = polyData;
+  entry.MTime = getGeometryMTime(polyData);
+  entry.Output = triangulate->GetOutput();
+  if (!model->GetID())
+  {
+    //the caller holds no reference, keep the last one alive
+    this->UncachedPreprocessed = entry.Output;
+  }
+  return entry.Output;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerPlannerLogic::clearPreprocessedModels()
+{
+  this->PreprocessedModels.clear();
+  this->UncachedPreprocessed = NULL;
+}
+
+//----------------------------------------------------------------------------
+//Latest modification of the points, polygons and strips of a polydata, unlike its MTime
+//it does not change when arrays are added to the polydata
+vtkMTimeType vtkSlicerPlannerLogic::getGeometryMTime(vtkPolyData* polyData)
+{
+  vtkMTimeType mtime = std::max(polyData->GetPolys()->GetMTime(), polyData->GetStrips()->GetMTime());
+  if (polyData->GetPoints())
+  {
+    mtime = std::max(mtime, polyData->GetPoints()->GetMTime());
+  }
+  return mtime;
+}
+
+//----------------------------------------------------------------------------
+//True if the levels of detail of a model were built from its current geometry
+bool vtkSlicerPlannerLogic::hasLevelsOfDetail(vtkMRMLModelNode* model)
+{
+  if (!model || !model->GetID() || !model->GetPolyData())
+  {
+    return false;
+  }
+  std::map<std::string, ModelLevelsOfDetail>::iterator it = this->LevelsOfDetail.find(model->GetID());
+  return it != this->LevelsOfDetail.end() && it->second.Levels && it->second.Model == model &&
+    it->second.PolyData == model->GetPolyData() &&
+    it->second.MTime == getGeometryMTime(model->GetPolyData());
+}
+
+//----------------------------------------------------------------------------
+//Keep levels of detail built from the geometry of a model at geometryMTime, they are
+//dropped if the model was modified since
+void vtkSlicerPlannerLogic::setLevelsOfDetail(vtkMRMLModelNode* model, vtkMTimeType geometryMTime,
+  vtkPlannerLevelOfDetail* levels)
+{
+  if (!model || !model->GetID() || !model->GetPolyData() ||
+    getGeometryMTime(model->GetPolyData()) != geometryMTime)
+  {
+    return;
+  }
+  this->showFullResolution(model);
+  ModelLevelsOfDetail& entry = this->LevelsOfDetail[model->GetID()];
+  entry.Model = model;
+  entry.PolyData = model->GetPolyData();
+  entry.MTime = geometryMTime;
+  entry.Levels = levels;
+}
+
+//----------------------------------------------------------------------------
+//Display the level of a model within the interactive triangle budget instead of the
+//model.  False if the model has no up to date level coarser than itself.
+bool vtkSlicerPlannerLogic::showLevelOfDetail(vtkMRMLModelNode* model)
+{
+  if (!this->hasLevelsOfDetail(model))
+  {
+    return false;
+  }
+  ModelLevelsOfDetail& entry = this->LevelsOfDetail[model->GetID()];
+  int level = entry.Levels->SelectLevel(InteractiveTriangleBudget);
+  if (level <= 0 || model->GetNumberOfDisplayNodes() == 0)
+  {
+    return false;
+  }
+  entry.Producer = vtkSmartPointer<vtkTrivialProducer>::New();
+  entry.Producer->SetOutput(entry.Levels->GetLevel(level));
+  for (int i = 0; i < model->GetNumberOfDisplayNodes(); i++)
+  {
+    vtkMRMLModelDisplayNode* display = vtkMRMLModelDisplayNode::SafeDownCast(model->GetNthDisplayNode(i));
+    if (display)
+    {
+      display->SetInputPolyDataConnection(entry.Producer->GetOutputPort());
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Display the model itself again
+void vtkSlicerPlannerLogic::showFullResolution(vtkMRMLModelNode* model)
+{
+  if (!model || !model->GetID())
+  {
+    return;
+  }
+  std::map<std::string, ModelLevelsOfDetail>::iterator it = this->LevelsOfDetail.find(model->GetID());
+  if (it == this->LevelsOfDetail.end() || !it->second.Producer)
+  {
+    return;
+  }
+  it->second.Producer = NULL;
+  for (int i = 0; i < model->GetNumberOfDisplayNodes(); i++)
+  {
+    vtkMRMLModelDisplayNode* display = vtkMRMLModelDisplayNode::SafeDownCast(model->GetNthDisplayNode(i));
+    if (display)
+    {
+      display->SetInputPolyDataConnection(model->GetPolyDataConnection());
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//Polydata a model is displayed with, its level of detail while one is shown
+vtkPolyData* vtkSlicerPlannerLogic::getDisplayedPolyData(vtkMRMLModelNode* model)
+{
+  if (model && model->GetID())
+  {
+    std::map<std::string, ModelLevelsOfDetail>::iterator it = this->LevelsOfDetail.find(model->GetID());
+    if (it != this->LevelsOfDetail.end() && it->second.Producer && it->second.Model == model)
+    {
+      return vtkPolyData::SafeDownCast(it->second.Producer->GetOutputDataObject(0));
+    }
+  }
+  return model ? model->GetPolyData() : NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerPlannerLogic::clearLevelsOfDetail()
+{
+  std::map<std::string, ModelLevelsOfDetail>::iterator it;
+  for (it = this->LevelsOfDetail.begin(); it != this->LevelsOfDetail.end(); ++it)
+  {
+    if (it->second.Model)
+    {
+      this->showFullResolution(it->second.Model);
+    }
+  }
+  this->LevelsOfDetail.clear();
+}
+
+//----------------------------------------------------------------------------
+//Matrix from the coordinates of a model to world, false if a transform of the model is
+//not linear
+static bool getMatrixToWorld(vtkMRMLModelNode* model, vtkMatrix4x4* matrix)
+{
+  matrix->Identity();
+  vtkMRMLTransformNode* transformNode = model->GetParentTransformNode();
+  if (!transformNode)
+  {
+    return true;
+  }
+  if (!transformNode->IsTransformToWorldLinear())
+  {
+    return false;
+  }
+  transformNode->GetMatrixTransformToWorld(matrix);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Bounds of the corners of a box moved by a matrix
+static void transformBounds(const double bounds[6], vtkMatrix4x4* matrix, double transformed[6])
+{
+  vtkMath::UninitializeBounds(transformed);
+  for (int i = 0; i < 8; i++)
+  {
+    double corner[4] = { bounds[i & 1], bounds[2 + ((i >> 1) & 1)], bounds[4 + ((i >> 2) & 1)], 1 };
+    matrix->MultiplyPoint(corner, corner);
+    for (int k = 0; k < 3; k++)
+    {
+      transformed[2 * k] = i == 0 ? corner[k] : std::min(transformed[2 * k], corner[k]);
+      transformed[2 * k + 1] = i == 0 ? corner[k] : std::max(transformed[2 * k + 1], corner[k]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//Add the triangles of an index to the collision highlight, in world coordinates.  Each
+//triangle is added twice, pushed off the surface on either side, so that it shows above
+//the surface whichever way it is oriented.
+static void appendCollisionTriangles(vtkPlannerTriangleIndex* index, std::vector<vtkIdType>& triangles,
+  vtkMatrix4x4* toWorld, vtkPoints* points, vtkCellArray* polys)
+{
+  std::sort(triangles.begin(), triangles.end());
+  triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+  for (size_t i = 0; i < triangles.size(); i++)
+  {
+    const double* corners = index->GetTriangle(triangles[i]);
+    double world[3][4];
+    for (int c = 0; c < 3; c++)
+    {
+      double corner[4] = { corners[3 * c], corners[3 * c + 1], corners[3 * c + 2], 1 };
+      toWorld->MultiplyPoint(corner, world[c]);
+    }
+    double u[3] = { world[1][0] - world[0][0], world[1][1] - world[0][1], world[1][2] - world[0][2] };
+    double v[3] = { world[2][0] - world[0][0], world[2][1] - world[0][1], world[2][2] - world[0][2] };
+    double normal[3];
+    vtkMath::Cross(u, v, normal);
+    vtkMath::Normalize(normal);
+    for (int side = -1; side <= 1; side += 2)
+    {
+      vtkIdType ids[3];
+      for (int c = 0; c < 3; c++)
+      {
+        ids[c] = points->InsertNextPoint(world[c][0] + side * CollisionHighlightOffset * normal[0],
+          world[c][1] + side * CollisionHighlightOffset * normal[1],
+          world[c][2] + side * CollisionHighlightOffset * normal[2]);
+      }
+      polys->InsertNextCell(3, ids);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//True if the collision index of a model was built from its current geometry
+bool vtkSlicerPlannerLogic::hasCollisionIndex(vtkMRMLModelNode* model)
+{
+  if (!model || !model->GetID() || !model->GetPolyData())
+  {
+    return false;
+  }
+  std::map<std::string, CollisionIndex>::iterator it = this->CollisionIndices.find(model->GetID());
+  return it != this->CollisionIndices.end() && it->second.Index &&
+    it->second.PolyData == model->GetPolyData() &&
+    it->second.MTime == getGeometryMTime(model->GetPolyData());
+}
+
+//----------------------------------------------------------------------------
+//Keep a collision index built from the geometry of a model at geometryMTime, it is
+//dropped if the model was modified since
+void vtkSlicerPlannerLogic::setCollisionIndex(vtkMRMLModelNode* model, vtkMTimeType geometryMTime,
+  vtkPlannerTriangleIndex* index)
+{
+  if (!model || !model->GetID() || !model->GetPolyData() ||
+    getGeometryMTime(model->GetPolyData()) != geometryMTime)
+  {
+    return;
+  }
+
+  //forget the polydata deleted since
+  std::map<std::string, CollisionIndex>::iterator it = this->CollisionIndices.begin();
+  while (it != this->CollisionIndices.end())
+  {
+    if (!it->second.PolyData)
+    {
+      this->CollisionIndices.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  CollisionIndex& entry = this->CollisionIndices[model->GetID()];
+  entry.PolyData = model->GetPolyData();
+  entry.MTime = geometryMTime;
+  entry.Index = index;
+}
+
+//----------------------------------------------------------------------------
+//Triangles of a model in its own coordinates, at full resolution, for collision and gap
+//queries, or NULL until an index built from its current geometry is set.  The index does
+//not depend on the transform of the model, so the one of a model being moved serves the
+//whole move.
+vtkPlannerTriangleIndex* vtkSlicerPlannerLogic::getCollisionIndex(vtkMRMLModelNode* model)
+{
+  if (!this->hasCollisionIndex(model))
+  {
+    return NULL;
+  }
+  return this->CollisionIndices[model->GetID()].Index;
+}
+
+//----------------------------------------------------------------------------
+//Models among others that a model crosses, in their current positions, on their full
+//resolution triangles: a decimated level would report fragments that touch along their
+//cut as crossing.  The world boxes of the models are compared first, then the hierarchies of the triangles of the models
+//whose boxes overlap are walked together.  The crossing triangles of all the models are
+//shown in the collision highlight.
+std::vector<vtkMRMLModelNode*> vtkSlicerPlannerLogic::computeCollisions(vtkMRMLModelNode* model,
+  const std::vector<vtkMRMLModelNode*>& others)
+{
+  std::vector<vtkMRMLModelNode*> hits;
+  vtkNew<vtkPoints> points;
+  vtkNew<vtkCellArray> polys;
+  vtkNew<vtkMatrix4x4> toWorld;
+  vtkPlannerTriangleIndex* index = model ? this->getCollisionIndex(model) : NULL;
+  if (index && index->GetNumberOfTriangles() > 0 && getMatrixToWorld(model, toWorld.GetPointer()))
+  {
+    double bounds[6];
+    double worldBounds[6];
+    index->GetBounds(bounds);
+    transformBounds(bounds, toWorld.GetPointer(), worldBounds);
+    vtkNew<vtkMatrix4x4> toModel;
+    vtkMatrix4x4::Invert(toWorld.GetPointer(), toModel.GetPointer());
+    std::vector<vtkIdType> triangles;
+    for (size_t i = 0; i < others.size(); i++)
+    {
+      vtkMRMLModelNode* other = others[i];
+      vtkPlannerTriangleIndex* otherIndex = other && other != model ? this->getCollisionIndex(other) : NULL;
+      vtkNew<vtkMatrix4x4> otherToWorld;
+      if (!otherIndex || otherIndex->GetNumberOfTriangles() == 0 ||
+        !getMatrixToWorld(other, otherToWorld.GetPointer()))
+      {
+        continue;
+      }
+      double otherWorldBounds[6];
+      otherIndex->GetBounds(bounds);
+      transformBounds(bounds, otherToWorld.GetPointer(), otherWorldBounds);
+      if (worldBounds[0] > otherWorldBounds[1] || otherWorldBounds[0] > worldBounds[1] ||
+        worldBounds[2] > otherWorldBounds[3] || otherWorldBounds[2] > worldBounds[3] ||
+        worldBounds[4] > otherWorldBounds[5] || otherWorldBounds[4] > worldBounds[5])
+      {
+        continue;
+      }
+
+      //the other model is brought into the coordinates of the model
+      vtkNew<vtkMatrix4x4> otherToModel;
+      vtkMatrix4x4::Multiply4x4(toModel.GetPointer(), otherToWorld.GetPointer(), otherToModel.GetPointer());
+      std::vector<vtkIdType> otherTriangles;
+      if (index->FindIntersectingTriangles(otherIndex, otherToModel.GetPointer(), triangles, otherTriangles) > 0)
+      {
+        hits.push_back(other);
+        appendCollisionTriangles(otherIndex, otherTriangles, otherToWorld.GetPointer(),
+          points.GetPointer(), polys.GetPointer());
+      }
+    }
+    appendCollisionTriangles(index, triangles, toWorld.GetPointer(), points.GetPointer(), polys.GetPointer());
+  }
+
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene || (polys->GetNumberOfCells() == 0 && !this->CollisionHighlight))
+  {
+    return hits;
+  }
+  if (!this->CollisionHighlight || !scene->IsNodePresent(this->CollisionHighlight))
+  {
+    vtkNew<vtkMRMLModelNode> highlight;
+    highlight->SetScene(scene);
+    highlight->SetName("Collisions");
+    highlight->HideFromEditorsOn();
+    highlight->SetSaveWithScene(false);
+    vtkNew<vtkMRMLModelDisplayNode> dnode;
+    dnode->SetColor(1, 0, 0);
+    dnode->SetBackfaceCulling(0);
+    dnode->SetSaveWithScene(false);
+    scene->AddNode(dnode.GetPointer());
+    scene->AddNode(highlight.GetPointer());
+    highlight->SetAndObserveDisplayNodeID(dnode->GetID());
+    this->CollisionHighlight = highlight.GetPointer();
+  }
+  vtkNew<vtkPolyData> highlightPolyData;
+  highlightPolyData->SetPoints(points.GetPointer());
+  highlightPolyData->SetPolys(polys.GetPointer());
+  this->CollisionHighlight->SetAndObservePolyData(highlightPolyData.GetPointer());
+  return hits;
+}
+
+//----------------------------------------------------------------------------
+//Distance from each point of a model, as it is displayed, to the closest of other models
+//at full resolution, in their current positions.  The points are brought into the coordinates of each other model, where its
+//index is, and their closest points are found in parallel.  Models whose world box is
+//farther than maximumGap from the one of the model are skipped.  Returns the minimum
+//gap, or maximumGap when no other model is closer, and sets closest to the model at the
+//minimum gap.
+double vtkSlicerPlannerLogic::computeGaps(vtkMRMLModelNode* model, const std::vector<vtkMRMLModelNode*>& others,
+  double maximumGap, vtkMRMLModelNode*& closest)
+{
+  closest = NULL;
+  vtkPolyData* polyData = model ? this->getDisplayedPolyData(model) : NULL;
+  vtkNew<vtkMatrix4x4> toWorld;
+  if (!polyData || polyData->GetNumberOfPoints() == 0 || !getMatrixToWorld(model, toWorld.GetPointer()))
+  {
+    return maximumGap;
+  }
+
+  //points of the model in world coordinates, and their box
+  vtkIdType numberOfPoints = polyData->GetNumberOfPoints();
+  std::vector<double> worldPoints(3 * numberOfPoints);
+  double worldBounds[6];
+  for (vtkIdType i = 0; i < numberOfPoints; i++)
+  {
+    double p[4] = { 0, 0, 0, 1 };
+    polyData->GetPoint(i, p);
+    toWorld->MultiplyPoint(p, p);
+    std::copy(p, p + 3, &worldPoints[3 * i]);
+    for (int k = 0; k < 3; k++)
+    {
+      worldBounds[2 * k] = i == 0 ? p[k] : std::min(worldBounds[2 * k], p[k]);
+      worldBounds[2 * k + 1] = i == 0 ? p[k] : std::max(worldBounds[2 * k + 1], p[k]);
+    }
+  }
+
+  vtkFloatArray* gaps = vtkFloatArray::SafeDownCast(polyData->GetPointData()->GetArray("Gap"));
+  if (!gaps || gaps->GetNumberOfTuples() != numberOfPoints)
+  {
+    vtkNew<vtkFloatArray> newGaps;
+    newGaps->SetName("Gap");
+    newGaps->SetNumberOfValues(numberOfPoints);
+    polyData->GetPointData()->AddArray(newGaps.GetPointer());
+    gaps = newGaps.GetPointer();
+  }
+  gaps->FillComponent(0, maximumGap);
+
+  double minimumGap = maximumGap;
+  std::vector<double> localPoints(3 * numberOfPoints);
+  std::vector<double> distances(numberOfPoints);
+  for (size_t i = 0; i < others.size(); i++)
+  {
+    vtkMRMLModelNode* other = others[i];
+    vtkPlannerTriangleIndex* otherIndex = other && other != model ? this->getCollisionIndex(other) : NULL;
+    vtkNew<vtkMatrix4x4> otherToWorld;
+    if (!otherIndex || otherIndex->GetNumberOfTriangles() == 0 ||
+      !getMatrixToWorld(other, otherToWorld.GetPointer()))
+    {
+      continue;
+    }
+    double bounds[6];
+    double otherWorldBounds[6];
+    otherIndex->GetBounds(bounds);
+    transformBounds(bounds, otherToWorld.GetPointer(), otherWorldBounds);
+    bool inRange = true;
+    for (int k = 0; k < 3; k++)
+    {
+      inRange = inRange && otherWorldBounds[2 * k] - worldBounds[2 * k + 1] < maximumGap &&
+        worldBounds[2 * k] - otherWorldBounds[2 * k + 1] < maximumGap;
+    }
+    if (!inRange)
+    {
+      continue;
+    }
+
+    vtkNew<vtkMatrix4x4> worldToOther;
+    vtkMatrix4x4::Invert(otherToWorld.GetPointer(), worldToOther.GetPointer());
+    for (vtkIdType j = 0; j < numberOfPoints; j++)
+    {
+      double p[4] = { worldPoints[3 * j], worldPoints[3 * j + 1], worldPoints[3 * j + 2], 1 };
+      worldToOther->MultiplyPoint(p, p);
+      std::copy(p, p + 3, &localPoints[3 * j]);
+    }
+    otherIndex->FindClosestPoints(numberOfPoints, &localPoints[0], NULL, &distances[0], NULL, NULL);
+    for (vtkIdType j = 0; j < numberOfPoints; j++)
+    {
+      if (distances[j] < gaps->GetValue(j))
+      {
+        gaps->SetValue(j, distances[j]);
+      }
+      if (distances[j] < minimumGap)
+      {
+        minimumGap = distances[j];
+        closest = other;
+      }
+    }
+  }
+  gaps->Modified();
+  polyData->Modified();
+  return minimumGap;
+}
+
+//----------------------------------------------------------------------------
+//Remove the gaps of a model from the polydata it is displayed with, and from its own
+void vtkSlicerPlannerLogic::clearGaps(vtkMRMLModelNode* model)
+{
+  if (!model)
+  {
+    return;
+  }
+  vtkPolyData* polyData = this->getDisplayedPolyData(model);
+  if (polyData && polyData->GetPointData()->GetArray("Gap"))
+  {
+    polyData->GetPointData()->RemoveArray("Gap");
+    polyData->Modified();
+  }
+  polyData = model->GetPolyData();
+  if (polyData && polyData->GetPointData()->GetArray("Gap"))
+  {
+    polyData->GetPointData()->RemoveArray("Gap");
+    polyData->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+//Remove the collision highlight
+void vtkSlicerPlannerLogic::clearCollisions()
+{
+  if (this->CollisionHighlight && this->GetMRMLScene())
+  {
+    vtkMRMLDisplayNode* display = this->CollisionHighlight->GetDisplayNode();
+    if (display)
+    {
+      this->GetMRMLScene()->RemoveNode(display);
+    }
+    this->GetMRMLScene()->RemoveNode(this->CollisionHighlight);
+  }
+  this->CollisionHighlight = NULL;
+}
+
+//----------------------------------------------------------------------------
+//Latest modification of the transforms from a model to world
+static vtkMTimeType getTransformToWorldMTime(vtkMRMLTransformableNode* node)
+{
+  vtkMTimeType mtime = 0;
+  for (vtkMRMLTransformNode* transformNode = node->GetParentTransformNode(); transformNode;
+    transformNode = transformNode->GetParentTransformNode())
+  {
+    mtime = std::max(mtime, transformNode->GetMTime());
+    vtkAbstractTransform* transform = transformNode->GetTransformToParent();
+    if (transform)
+    {
+      mtime = std::max(mtime, transform->GetMTime());
+    }
+  }
+  return mtime;
+}
+
+//----------------------------------------------------------------------------
+//Box of a model in world coordinates, false if the model has no points or a transform of
+//the model is not linear
+static bool getWorldBounds(vtkMRMLModelNode* model, double worldBounds[6])
+{
+  vtkNew<vtkMatrix4x4> toWorld;
+  vtkPolyData* polyData = model ? model->GetPolyData() : NULL;
+  if (!polyData || polyData->GetNumberOfPoints() == 0 || !getMatrixToWorld(model, toWorld.GetPointer()))
+  {
+    return false;
+  }
+  double bounds[6];
+  polyData->GetBounds(bounds);
+  transformBounds(bounds, toWorld.GetPointer(), worldBounds);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//True if two boxes come within distance of each other along every axis
+static bool areBoundsWithin(const double bounds[6], const double otherBounds[6], double distance)
+{
+  for (int k = 0; k < 3; k++)
+  {
+    if (otherBounds[2 * k] - bounds[2 * k + 1] > distance || bounds[2 * k] - otherBounds[2 * k + 1] > distance)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//True if the triangles of two indices, the other brought into the coordinates of the
+//first by otherToModel, come within the adjacency tolerance of each other.  The
+//hierarchies of the triangles are walked together, the indices are only read.
+bool vtkSlicerPlannerLogic::areAdjacent(vtkPlannerTriangleIndex* index, vtkPlannerTriangleIndex* otherIndex,
+  vtkMatrix4x4* otherToModel)
+{
+  if (!index || !otherIndex || index->GetNumberOfTriangles() == 0 || otherIndex->GetNumberOfTriangles() == 0)
+  {
+    return false;
+  }
+  return index->IsWithinDistance(otherIndex, otherToModel, AdjacencyTolerance);
+}
+
+//----------------------------------------------------------------------------
+//Bring the adjacency graph up to date with models.  Models that are not given anymore
+//are dropped.  Models added, or whose polydata or transforms were modified since the
+//last update, lose their edges and are returned paired with all the models whose world
+//boxes come within the adjacency tolerance of theirs; the edges between the other models
+//are kept.
+std::vector<vtkSlicerPlannerLogic::AdjacencyCandidate> vtkSlicerPlannerLogic::updateAdjacency(
+  const std::vector<vtkMRMLModelNode*>& models)
+{
+  std::set<std::string> ids;
+  for (size_t i = 0; i < models.size(); i++)
+  {
+    if (models[i] && models[i]->GetID())
+    {
+      ids.insert(models[i]->GetID());
+    }
+  }
+  std::map<std::string, AdjacencyNode>::iterator it = this->Adjacency.begin();
+  while (it != this->Adjacency.end())
+  {
+    if (!it->second.Model || !ids.count(it->first))
+    {
+      this->removeAdjacencyEdges(it->first);
+      this->Adjacency.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  std::vector<vtkMRMLModelNode*> changed;
+  std::vector<vtkMRMLModelNode*> unchanged;
+  for (size_t i = 0; i < models.size(); i++)
+  {
+    vtkMRMLModelNode* model = models[i];
+    if (!model || !model->GetID())
+    {
+      continue;
+    }
+    if (this->isAdjacencyCurrent(model))
+    {
+      unchanged.push_back(model);
+      continue;
+    }
+    this->removeAdjacencyEdges(model->GetID());
+    AdjacencyNode& node = this->Adjacency[model->GetID()];
+    node.Model = model;
+    node.GeometryMTime = model->GetPolyData() ? getGeometryMTime(model->GetPolyData()) : 0;
+    node.TransformMTime = getTransformToWorldMTime(model);
+    node.Neighbors.clear();
+    changed.push_back(model);
+  }
+
+  //each pair with a changed model is a candidate once, if the world boxes are close
+  std::vector<AdjacencyCandidate> candidates;
+  for (size_t i = 0; i < changed.size(); i++)
+  {
+    double worldBounds[6];
+    vtkNew<vtkMatrix4x4> toModel;
+    if (!getWorldBounds(changed[i], worldBounds) || !getMatrixToWorld(changed[i], toModel.GetPointer()))
+    {
+      continue;
+    }
+    toModel->Invert();
+    std::vector<vtkMRMLModelNode*> others(changed.begin() + i + 1, changed.end());
+    others.insert(others.end(), unchanged.begin(), unchanged.end());
+    for (size_t j = 0; j < others.size(); j++)
+    {
+      double otherWorldBounds[6];
+      vtkNew<vtkMatrix4x4> otherToWorld;
+      if (!getWorldBounds(others[j], otherWorldBounds) ||
+        !areBoundsWithin(worldBounds, otherWorldBounds, AdjacencyTolerance) ||
+        !getMatrixToWorld(others[j], otherToWorld.GetPointer()))
+      {
+        continue;
+      }
+      AdjacencyCandidate candidate;
+      candidate.Model = changed[i];
+      candidate.Other = others[j];
+      candidate.OtherToModel = vtkSmartPointer<vtkMatrix4x4>::New();
+      vtkMatrix4x4::Multiply4x4(toModel.GetPointer(), otherToWorld.GetPointer(), candidate.OtherToModel);
+      candidates.push_back(candidate);
+    }
+  }
+  return candidates;
+}
+
+//----------------------------------------------------------------------------
+//Record that two models are neighbors, unless one was modified since the update that
+//returned them, the next update tests it again
+void vtkSlicerPlannerLogic::setAdjacent(vtkMRMLModelNode* model, vtkMRMLModelNode* other)
+{
+  if (!this->isAdjacencyCurrent(model) || !this->isAdjacencyCurrent(other) || model == other)
+  {
+    return;
+  }
+  this->Adjacency[model->GetID()].Neighbors.insert(other->GetID());
+  this->Adjacency[other->GetID()].Neighbors.insert(model->GetID());
+}
+
+//----------------------------------------------------------------------------
+//True if a model is in the adjacency graph with its current geometry and transforms
+bool vtkSlicerPlannerLogic::isAdjacencyCurrent(vtkMRMLModelNode* model)
+{
+  if (!this->hasAdjacency(model))
+  {
+    return false;
+  }
+  const AdjacencyNode& node = this->Adjacency[model->GetID()];
+  return node.GeometryMTime == (model->GetPolyData() ? getGeometryMTime(model->GetPolyData()) : 0) &&
+    node.TransformMTime == getTransformToWorldMTime(model);
+}
+
+//----------------------------------------------------------------------------
+//Remove a model from the neighbors of its neighbors
+void vtkSlicerPlannerLogic::removeAdjacencyEdges(const std::string& id)
+{
+  std::map<std::string, AdjacencyNode>::iterator it = this->Adjacency.find(id);
+  if (it == this->Adjacency.end())
+  {
+    return;
+  }
+  std::set<std::string>::const_iterator neighbor;
+  for (neighbor = it->second.Neighbors.begin(); neighbor != it->second.Neighbors.end(); ++neighbor)
+  {
+    std::map<std::string, AdjacencyNode>::iterator neighborNode = this->Adjacency.find(*neighbor);
+    if (neighborNode != this->Adjacency.end())
+    {
+      neighborNode->second.Neighbors.erase(id);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerPlannerLogic::hasAdjacency(vtkMRMLModelNode* model)
+{
+  if (!model || !model->GetID())
+  {
+    return false;
+  }
+  std::map<std::string, AdjacencyNode>::iterator it = this->Adjacency.find(model->GetID());
+  return it != this->Adjacency.end() && it->second.Model == model;
+}
+
+//----------------------------------------------------------------------------
+//Models next to a model in the adjacency graph, as of the last update
+std::vector<vtkMRMLModelNode*> vtkSlicerPlannerLogic::getNeighbors(vtkMRMLModelNode* model)
+{
+  std::vector<vtkMRMLModelNode*> neighbors;
+  if (!this->hasAdjacency(model))
+  {
+    return neighbors;
+  }
+  const std::set<std::string>& ids = this->Adjacency[model->GetID()].Neighbors;
+  std::set<std::string>::const_iterator id;
+  for (id = ids.begin(); id != ids.end(); ++id)
+  {
+    std::map<std::string, AdjacencyNode>::iterator it = this->Adjacency.find(*id);
+    if (it != this->Adjacency.end() && it->second.Model)
+    {
+      neighbors.push_back(it->second.Model);
+    }
+  }
+  return neighbors;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerPlannerLogic::clearAdjacency()
+{
+  this->Adjacency.clear();
+}
+
+//----------------------------------------------------------------------------
+//Models among others, other than the model, whose world box comes within distance of the
+//one of the model
+std::vector<vtkMRMLModelNode*> vtkSlicerPlannerLogic::getModelsNear(vtkMRMLModelNode* model,
+  const std::vector<vtkMRMLModelNode*>& others, double distance)
+{
+  std::vector<vtkMRMLModelNode*> near;
+  double worldBounds[6];
+  if (!getWorldBounds(model, worldBounds))
+  {
+    return near;
+  }
+  for (size_t i = 0; i < others.size(); i++)
+  {
+    double otherWorldBounds[6];
+    if (others[i] && others[i] != model && getWorldBounds(others[i], otherWorldBounds) &&
+      areBoundsWithin(worldBounds, otherWorldBounds, distance))
+    {
+      near.push_back(others[i]);
+    }
+  }
+  return near;
+}
+
+//----------------------------------------------------------------------------
+//Locator of the triangles of a model in world coordinates, built again only when the
+//model polydata or its transforms were modified since the last query
+vtkPlannerTriangleIndex* vtkSlicerPlannerLogic::getModelLocator(vtkMRMLModelNode* model)
+{
+  if (!model || !model->GetID() || !model->GetPolyData() || model->GetPolyData()->GetNumberOfCells() == 0)
+  {
+    return NULL;
+  }
+
+  //forget the models removed since
+  std::map<std::string, ModelLocator>::iterator it = this->ModelLocators.begin();
+  while (it != this->ModelLocators.end())
+  {
+    if (!it->second.Model)
+    {
+      this->ModelLocators.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  vtkPolyData* polyData = model->GetPolyData();
+  vtkMRMLTransformNode* transformNode = model->GetParentTransformNode();
+  vtkMTimeType transformMTime = getTransformToWorldMTime(model);
+  ModelLocator& entry = this->ModelLocators[model->GetID()];
+  if (entry.Locator && entry.Model == model && entry.PolyData == polyData &&
+    entry.PolyDataMTime == getGeometryMTime(polyData) && entry.TransformNode == transformNode &&
+    entry.TransformMTime == transformMTime)
+  {
+    return entry.Locator;
+  }
+
+  entry.Triangles = vtkSmartPointer<vtkPolyData>::New();
+  entry.Triangles->ShallowCopy(this->getPreprocessedPolyData(model));
+  if (transformNode)
+  {
+    vtkNew<vtkGeneralTransform> toWorld;
+    transformNode->GetTransformToWorld(toWorld.GetPointer());
+    vtkNew<vtkPoints> worldPoints;
+    toWorld->TransformPoints(entry.Triangles->GetPoints(), worldPoints.GetPointer());
+    entry.Triangles->SetPoints(worldPoints.GetPointer());
+    //normals of the model are not transformed, the index computes them from the corners
+    entry.Triangles->GetCellData()->SetNormals(NULL);
+  }
+  entry.Locator = vtkSmartPointer<vtkPlannerTriangleIndex>::New();
+  entry.Locator->Build(entry.Triangles);
+
+  entry.Model = model;
+  entry.PolyData = polyData;
+  entry.PolyDataMTime = getGeometryMTime(polyData);
+  entry.TransformNode = transformNode;
+  entry.TransformMTime = transformMTime;
+  return entry.Locator;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerPlannerLogic::clearModelLocators()
+{
+  this->ModelLocators.clear();
+}
+
+//----------------------------------------------------------------------------
+//The reference does not move, its distance field is kept until it is modified
+void vtkSlicerPlannerLogic::updateReferenceDistance(vtkPolyData* referencePolyData)
+{
+  if (!this->PreviewDistance || this->PreviewReferencePolyData != referencePolyData ||
+    this->PreviewReferenceMTime != getGeometryMTime(referencePolyData))
+  {
+    this->PreviewDistance = vtkSmartPointer<vtkImplicitPolyDataDistance>::New();
+    this->PreviewDistance->SetInput(referencePolyData);
+    this->PreviewExactDistance = NULL;
+    this->PreviewReferencePolyData = referencePolyData;
+    this->PreviewReferenceMTime = getGeometryMTime(referencePolyData);
+  }
+}
+
+//----------------------------------------------------------------------------
+//Approximate distance from a model, in its current position, to a reference.  The exact
+//distance is only computed for the point closest to the center of each cell of a grid
+//over the model, and interpolated to the other points from the samples of the neighboring
+//cells.  The distance to a surface is 1-Lipschitz, so an interpolated value is off by at
+//most the weighted distance to its samples: the largest of these is returned.
+double vtkSlicerPlannerLogic::computeDistancePreview(vtkMRMLModelNode* model, vtkMRMLModelNode* reference, bool signedDistance)
+{
+  this->clearDistancePreview();
+  vtkPolyData* polyData = model ? this->getDisplayedPolyData(model) : NULL;
+  if (!polyData || polyData->GetNumberOfPoints() == 0 || !reference || !reference->GetPolyData())
+  {
+    return 0;
+  }
+
+  this->updateReferenceDistance(reference->GetPolyData());
+
+  //points of the model as they are displayed, from the level of detail shown if any
+  vtkIdType numberOfPoints = polyData->GetNumberOfPoints();
+  this->PreviewPoints = vtkSmartPointer<vtkPoints>::New();
+  vtkMRMLTransformNode* transformNode = model->GetParentTransformNode();
+  if (transformNode)
+  {
+    vtkNew<vtkGeneralTransform> toWorld;
+    transformNode->GetTransformToWorld(toWorld.GetPointer());
+    toWorld->TransformPoints(polyData->GetPoints(), this->PreviewPoints);
+  }
+  else
+  {
+    this->PreviewPoints->DeepCopy(polyData->GetPoints());
+  }
+
+  //a surface crosses about sqrt(N) cells along each axis of a grid of N cells
+  double bounds[6];
+  this->PreviewPoints->GetBounds(bounds);
+  double diagonal = std::sqrt((bounds[1] - bounds[0]) * (bounds[1] - bounds[0]) +
+    (bounds[3] - bounds[2]) * (bounds[3] - bounds[2]) +
+    (bounds[5] - bounds[4]) * (bounds[5] - bounds[4]));
+  double spacing = std::max(diagonal / std::sqrt(static_cast<double>(PreviewSampleBudget)), 1e-6);
+  int dims[3];
+  for (int i = 0; i < 3; i++)
+  {
+    dims[i] = static_cast<int>((bounds[2 * i + 1] - bounds[2 * i]) / spacing) + 1;
+  }
+  std::vector<vtkIdType> pointCells(numberOfPoints);
+  std::vector<vtkIdType> cellSamples(dims[0] * dims[1] * dims[2], -1);
+  std::vector<double> cellSampleDist2(cellSamples.size(), std::numeric_limits<double>::max());
+  for (vtkIdType i = 0; i < numberOfPoints; i++)
+  {
+    double p[3];
+    this->PreviewPoints->GetPoint(i, p);
+    int index[3];
+    double center[3];
+    for (int j = 0; j < 3; j++)
+    {
+      index[j] = std::min(static_cast<int>((p[j] - bounds[2 * j]) / spacing), dims[j] - 1);
+      center[j] = bounds[2 * j] + (index[j] + 0.5) * spacing;
+    }
+    vtkIdType cell = index[0] + dims[0] * (index[1] + dims[1] * index[2]);
+    pointCells[i] = cell;
+    double dist2 = vtkMath::Distance2BetweenPoints(p, center);
+    if (dist2 < cellSampleDist2[cell])
+    {
+      cellSampleDist2[cell] = dist2;
+      cellSamples[cell] = i;
+    }
+  }
+
+  //exact distance at the samples
+  std::vector<double> cellDistances(cellSamples.size(), 0);
+  for (size_t cell = 0; cell < cellSamples.size(); cell++)
+  {
+    if (cellSamples[cell] >= 0)
+    {
+      double distance = this->PreviewDistance->EvaluateFunction(this->PreviewPoints->GetPoint(cellSamples[cell]));
+      cellDistances[cell] = signedDistance ? distance : std::fabs(distance);
+    }
+  }
+
+  //inverse distance weighting of the samples of the 27 neighboring cells
+  vtkFloatArray* distances = this->getDistancePreviewArray(polyData);
+  double errorBound = 0;
+  for (vtkIdType i = 0; i < numberOfPoints; i++)
+  {
+    vtkIdType cell = pointCells[i];
+    if (cellSamples[cell] == i)
+    {
+      distances->SetValue(i, cellDistances[cell]);
+      continue;
+    }
+    double p[3];
+    this->PreviewPoints->GetPoint(i, p);
+    int index[3] = { static_cast<int>(cell % dims[0]),
+                     static_cast<int>((cell / dims[0]) % dims[1]),
+                     static_cast<int>(cell / (dims[0] * dims[1])) };
+    double weightSum = 0;
+    double valueSum = 0;
+    double errorSum = 0;
+    for (int z = std::max(index[2] - 1, 0); z <= std::min(index[2] + 1, dims[2] - 1); z++)
+    {
+      for (int y = std::max(index[1] - 1, 0); y <= std::min(index[1] + 1, dims[1] - 1); y++)
+      {
+        for (int x = std::max(index[0] - 1, 0); x <= std::min(index[0] + 1, dims[0] - 1); x++)
+        {
+          vtkIdType neighbor = x + dims[0] * (y + dims[1] * z);
+          if (cellSamples[neighbor] < 0)
+          {
+            continue;
+          }
+          double s[3];
+          this->PreviewPoints->GetPoint(cellSamples[neighbor], s);
+          double dist2 = std::max(vtkMath::Distance2BetweenPoints(p, s), 1e-12);
+          double weight = 1.0 / dist2;
+          weightSum += weight;
+          valueSum += weight * cellDistances[neighbor];
+          errorSum += weight * std::sqrt(dist2);
+        }
+      }
+    }
+    distances->SetValue(i, valueSum / weightSum);
+    errorBound = std::max(errorBound, errorSum / weightSum);
+  }
+  distances->Modified();
+  polyData->Modified();
+
+  //exact values are computed from getDistancePreviewInputs
+  this->PreviewPolyData = polyData;
+  this->PreviewSigned = signedDistance;
+  return errorBound;
+}
+
+//----------------------------------------------------------------------------
+//The points of the preview and the distance given are not modified by the logic after
+//this: the points are replaced by the next preview, not updated.
+bool vtkSlicerPlannerLogic::getDistancePreviewInputs(vtkSmartPointer<vtkPoints>& points,
+  vtkSmartPointer<vtkImplicitPolyDataDistance>& distance, bool& signedDistance)
+{
+  if (!this->PreviewPolyData || !this->PreviewPoints || !this->PreviewReferencePolyData)
+  {
+    return false;
+  }
+  if (!this->PreviewExactDistance)
+  {
+    this->PreviewExactDistance = vtkSmartPointer<vtkImplicitPolyDataDistance>::New();
+    this->PreviewExactDistance->SetInput(this->PreviewReferencePolyData);
+  }
+  points = this->PreviewPoints;
+  distance = this->PreviewExactDistance;
+  signedDistance = this->PreviewSigned;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Exact distances replace the preview they were computed for, and only that one
+bool vtkSlicerPlannerLogic::setExactDistancePreview(vtkPoints* points, vtkFloatArray* distances)
+{
+  vtkPolyData* polyData = this->PreviewPolyData;
+  if (!polyData || !points || points != this->PreviewPoints || !distances ||
+    polyData->GetNumberOfPoints() != distances->GetNumberOfTuples())
+  {
+    return false;
+  }
+  distances->SetName(getDistancePreviewArrayName());
+  polyData->GetPointData()->AddArray(distances);
+  polyData->Modified();
+  this->clearDistancePreview();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Forget the distance preview in progress, exact distances computed for it are dropped
+void vtkSlicerPlannerLogic::clearDistancePreview()
+{
+  this->PreviewPolyData = NULL;
+  this->PreviewPoints = NULL;
+}
+
+//----------------------------------------------------------------------------
+//Remove the distance preview array of a model from the polydata it is displayed with,
+//and from its own.  Returns true if there was one.
+bool vtkSlicerPlannerLogic::removeDistancePreview(vtkMRMLModelNode* model)
+{
+  bool removed = false;
+  vtkPolyData* polyDatas[2] = { this->getDisplayedPolyData(model), model->GetPolyData() };
+  for (int i = 0; i < 2; i++)
+  {
+    if (polyDatas[i] && polyDatas[i]->GetPointData()->GetArray(getDistancePreviewArrayName()))
+    {
+      polyDatas[i]->GetPointData()->RemoveArray(getDistancePreviewArrayName());
+      polyDatas[i]->Modified();
+      removed = true;
+    }
+  }
+  return removed;
+}
+
+//----------------------------------------------------------------------------
+//Get the distance preview array of a model
+vtkFloatArray* vtkSlicerPlannerLogic::getDistancePreviewArray(vtkPolyData* polyData)
+{
+  const char* name = getDistancePreviewArrayName();
+  vtkIdType numberOfPoints = polyData->GetNumberOfPoints();
+  vtkFloatArray* distances = vtkFloatArray::SafeDownCast(polyData->GetPointData()->GetArray(name));
+  if (!distances || distances->GetNumberOfTuples() != numberOfPoints)
+  {
+    vtkNew<vtkFloatArray> newDistances;
+    newDistances->SetName(name);
+    newDistances->SetNumberOfValues(numberOfPoints);
+    polyData->GetPointData()->AddArray(newDistances.GetPointer());
+    distances = newDistances.GetPointer();
+  }
+  return distances;
+}
@@ -33,14 +33,23 @@
 #include "vtkMRMLTableNode.h"
 #include "vtkPoints.h"
 #include "vtkThinPlateSplineTransform.h"
-#include "vtkCellLocator.h"
 #include "vtkPlane.h"
 #include "vtkMatrix4x4.h"
+#include "vtkFloatArray.h"
+#include "vtkImplicitPolyDataDistance.h"
+#include "vtkTrivialProducer.h"
+#include "vtkPlannerBendTransform.h"
+#include "vtkPlannerHingeTransform.h"
+#include "vtkPlannerBendSweep.h"
+#include "vtkPlannerPlaneSection.h"
+#include "vtkPlannerTriangleIndex.h"
+#include "vtkPlannerLevelOfDetail.h"
 
 // STD includes
 #include <cstdlib>
 #include <vector>
 #include <map>
+#include <set>
 
 //Self includes
 #include "vtkSlicerPlannerModuleLogicExport.h"
@@ -86,6 +95,7 @@ public:
   {
     Single,
     Double,
+    Hinge,
   };
 
   enum BendSide
@@ -95,13 +105,110 @@ public:
   };
   //Bending functions
   void initializeBend(vtkPoints* inputFiducials, vtkMRMLModelNode* model);
-  vtkSmartPointer<vtkThinPlateSplineTransform> getBendTransform(double bendMagnitude);
+  vtkSmartPointer<vtkWarpTransform> getBendTransform(double bendMagnitude);
+  vtkSmartPointer<vtkWarpTransform> createBendTransform(double bendMagnitude);
+  vtkSmartPointer<vtkPlannerBendSweep> createBendSweep(vtkPoints* points, double minimumMagnitude, double maximumMagnitude);
+  double optimizeBendMagnitude(vtkMRMLModelNode* reference, double minimumMagnitude, double maximumMagnitude);
+
   void clearBendingData();
   vtkSmartPointer<vtkPoints> getSourcePoints() {return this->SourcePoints;}
   vtkSmartPointer<vtkPoints> getTargetPoints() { return this->TargetPoints; }
   void setBendType(BendModeType type) {this->bendMode = type;}
   void setBendSide(BendSide side) { this->bendSide = side; }
-  double getDistanceToModel(vtkVector3d point, vtkPolyData* model);
+  void setBendLandmarkBudget(int budget) { this->BendLandmarkBudget = budget; }
+  //Bend with a compactly supported spline, sized from the model in initializeBend
+  void setBendLocal(bool local) { this->BendLocal = local; }
+
+  //Queries on a model in world coordinates.  The locator of each model is kept until
+  //its polydata or its transforms are modified.
+  double getDistanceToModel(vtkVector3d point, vtkMRMLModelNode* model);
+  //Closest points of a model to numberOfPoints packed points, computed in parallel.  Any
+  //of the outputs may be NULL: packed closest points, distances, cell ids and packed normals.
+  void projectPointsToModel(vtkMRMLModelNode* model, vtkIdType numberOfPoints, const double* points,
+    double* closestPoints, double* distances, vtkIdType* cellIds, double* normals);
+  void clearModelLocators();
+
+  //Cleaned, triangulated copy of a model with point and cell normals, shared by the
+  //operations on the model until its geometry is modified
+  vtkPolyData* getPreprocessedPolyData(vtkMRMLModelNode* model);
+  void clearPreprocessedModels();
+
+  //Decimated levels of the models, displayed instead of the models while they are moved.
+  //The levels are built by the caller, possibly off the GUI thread, from the geometry of
+  //the model at geometryMTime.  The models keep their full resolution polydata, which
+  //hardening, metrics and export use.
+  static vtkMTimeType getGeometryMTime(vtkPolyData* polyData);
+  bool hasLevelsOfDetail(vtkMRMLModelNode* model);
+  void setLevelsOfDetail(vtkMRMLModelNode* model, vtkMTimeType geometryMTime, vtkPlannerLevelOfDetail* levels);
+  bool showLevelOfDetail(vtkMRMLModelNode* model);
+  void showFullResolution(vtkMRMLModelNode* model);
+  vtkPolyData* getDisplayedPolyData(vtkMRMLModelNode* model);
+  void clearLevelsOfDetail();
+
+  //Triangles of the models at full resolution for collision and gap queries, whatever
+  //level the models are displayed with.  The indices are built by the caller, possibly
+  //off the GUI thread, from the geometry of the model at geometryMTime.
+  bool hasCollisionIndex(vtkMRMLModelNode* model);
+  void setCollisionIndex(vtkMRMLModelNode* model, vtkMTimeType geometryMTime, vtkPlannerTriangleIndex* index);
+  vtkPlannerTriangleIndex* getCollisionIndex(vtkMRMLModelNode* model);
+
+  //Models among others that a model crosses, on their collision indices.  The crossing
+  //triangles are highlighted in red until clearCollisions.  Models that only touch, as
+  //fragments along their cut, do not collide.  Models without an up to date collision
+  //index are skipped.
+  std::vector<vtkMRMLModelNode*> computeCollisions(vtkMRMLModelNode* model, const std::vector<vtkMRMLModelNode*>& others);
+  void clearCollisions();
+
+  //Gap between a model and others.  The distance of each point of the polydata the model
+  //is displayed with to the closest of the collision indices of the others, up to
+  //maximumGap, is stored in the "Gap" array of that polydata.  Others without an up to
+  //date collision index are skipped.  Returns the minimum gap and the model it is to, or
+  //maximumGap and NULL.
+  double computeGaps(vtkMRMLModelNode* model, const std::vector<vtkMRMLModelNode*>& others,
+    double maximumGap, vtkMRMLModelNode*& closest);
+  void clearGaps(vtkMRMLModelNode* model);
+
+  //Graph of the models that touch each other, as the fragments on either side of a cut.
+  //Two models are neighbors when their collision indices come within a tolerance of each
+  //other.  updateAdjacency drops the models that are not given anymore and returns the
+  //pairs with a model added or modified since the last update whose world boxes come
+  //within the tolerance.  The caller tests the pairs with areAdjacent, possibly off the
+  //GUI thread, and records the edges found with setAdjacent.
+  struct AdjacencyCandidate
+  {
+    vtkMRMLModelNode* Model;
+    vtkMRMLModelNode* Other;
+    vtkSmartPointer<vtkMatrix4x4> OtherToModel;
+  };
+  std::vector<AdjacencyCandidate> updateAdjacency(const std::vector<vtkMRMLModelNode*>& models);
+  static bool areAdjacent(vtkPlannerTriangleIndex* index, vtkPlannerTriangleIndex* otherIndex,
+    vtkMatrix4x4* otherToModel);
+  void setAdjacent(vtkMRMLModelNode* model, vtkMRMLModelNode* other);
+  bool hasAdjacency(vtkMRMLModelNode* model);
+  std::vector<vtkMRMLModelNode*> getNeighbors(vtkMRMLModelNode* model);
+  void clearAdjacency();
+
+  //Models among others whose world box comes within distance of the one of a model
+  std::vector<vtkMRMLModelNode*> getModelsNear(vtkMRMLModelNode* model,
+    const std::vector<vtkMRMLModelNode*>& others, double distance);
+
+  //Surface area and enclosed volume from packed triangle connectivity, summed in parallel
+  //over the triangles
+  static void getTriangles(vtkPolyData* polyData, std::vector<vtkIdType>& triangles);
+  static double computeSurfaceArea(vtkPoints* points, const std::vector<vtkIdType>& triangles);
+  static double computeVolume(vtkPoints* points, const std::vector<vtkIdType>& triangles);
+
+  //Distance preview functions.  The preview is the distance from the model itself to the
+  //reference, kept apart from the distances of the metrics in its own point data array.
+  //The exact distances are computed from getDistancePreviewInputs, off the GUI thread,
+  //then passed to setExactDistancePreview.
+  static const char* getDistancePreviewArrayName() { return "DistancePreview"; }
+  double computeDistancePreview(vtkMRMLModelNode* model, vtkMRMLModelNode* reference, bool signedDistance);
+  bool getDistancePreviewInputs(vtkSmartPointer<vtkPoints>& points,
+    vtkSmartPointer<vtkImplicitPolyDataDistance>& distance, bool& signedDistance);
+  bool setExactDistancePreview(vtkPoints* points, vtkFloatArray* distances);
+  void clearDistancePreview();
+  bool removeDistancePreview(vtkMRMLModelNode* model);
   
 
 protected:
@@ -118,16 +225,24 @@ private:
   void operator=(const vtkSlicerPlannerLogic&); // Not implemented
   vtkSmartPointer<vtkMRMLCommandLineModuleNode> wrapModel(vtkMRMLModelNode* model, std::string Name, int dest);
   vtkMRMLModelNode* mergeModel(vtkMRMLModelHierarchyNode* HierarchyNode, std::string name);
+  bool updateMergedPolyData(const std::vector<vtkPolyData*>& children);
   void generateSourcePoints();
   vtkVector3d projectToModel(vtkVector3d point);
-  vtkVector3d projectToModel(vtkVector3d point, vtkPlane* plane);  
-  vtkVector3d projectToModel(vtkVector3d point, vtkCellLocator* locator);
-  vtkVector3d projectToModel(vtkVector3d point, vtkPolyData* model);
-  vtkVector3d getNormalAtPoint(vtkVector3d point, vtkCellLocator* locator, vtkPolyData* model);
+  vtkVector3d projectToModel(vtkVector3d point, vtkPlannerTriangleIndex* index);
+  vtkVector3d projectToModel(vtkVector3d point, vtkPlannerPlaneSection* section);
+  vtkVector3d getNormalAtPoint(vtkVector3d point, vtkPlannerTriangleIndex* index);
+  vtkPlannerTriangleIndex* getModelLocator(vtkMRMLModelNode* model);
   vtkSmartPointer<vtkPlane> createPlane(vtkVector3d A, vtkVector3d B, vtkVector3d C, vtkVector3d D);
   void createBendingLocator();
-  vtkVector3d bendPoint(vtkVector3d point, double magnitude);
+  vtkSmartPointer<vtkPoints> selectLandmarks(vtkPoints* points, int budget);
+  void updateBendLandmarks();
+  void computeBendGeometry();
+  void computeTargetPoints(double magnitude, vtkPoints* target);
+  void configureHingeTransform(vtkPlannerHingeTransform* transform, double magnitude);
+  double meanBendDistance(vtkPoints* samples, double magnitude, vtkPoints* bent);
+  vtkVector3d bendPoint(vtkVector3d point, vtkVector3d lever, vtkVector3d direction, double magnitude);
   double computeICV(vtkMRMLModelNode* model);
+  vtkFloatArray* getDistancePreviewArray(vtkPolyData* polyData);
   vtkSmartPointer<vtkMRMLModelNode> SkullWrappedPreOP;
   vtkSmartPointer<vtkMRMLModelNode> HealthyBrain;
   vtkSmartPointer<vtkMRMLModelNode> CurrentModel;
@@ -141,13 +256,121 @@ private:
   vtkSmartPointer<vtkPoints> SourcePoints;
   vtkSmartPointer<vtkPoints> SourcePointsDense;
   vtkSmartPointer<vtkPoints> TargetPoints;
-  vtkSmartPointer<vtkCellLocator> cellLocator;
-  vtkSmartPointer<vtkCellLocator> BendingPlaneLocator;
+  vtkSmartPointer<vtkPlannerBendTransform> BendTransform;
+  vtkSmartPointer<vtkPlannerHingeTransform> HingeTransform;
+  vtkSmartPointer<vtkPlannerTriangleIndex> BendingIndex;
+  vtkSmartPointer<vtkPlannerPlaneSection> BendingPlaneSection;
   vtkSmartPointer<vtkPlane> BendingPlane;
   vtkSmartPointer<vtkPolyData> BendingPolyData;
   bool bendInitialized;
   BendModeType bendMode;
   BendSide bendSide;
+  int BendLandmarkBudget;
+  bool BendLocal;
+  double BendSupportRadius;
+  //Per landmark geometry that does not depend on the bend magnitude
+  std::vector<vtkVector3d> LandmarkLevers;
+  std::vector<vtkVector3d> LandmarkDirections;
+  std::vector<double> LandmarkSides;
+
+  //Triangles of a queried model in world coordinates and their locator, with the state
+  //they were built from
+  struct ModelLocator
+  {
+    vtkWeakPointer<vtkMRMLModelNode> Model;
+    vtkWeakPointer<vtkPolyData> PolyData;
+    vtkMTimeType PolyDataMTime;
+    vtkWeakPointer<vtkMRMLTransformNode> TransformNode;
+    vtkMTimeType TransformMTime;
+    vtkSmartPointer<vtkPolyData> Triangles;
+    vtkSmartPointer<vtkPlannerTriangleIndex> Locator;
+  };
+  std::map<std::string, ModelLocator> ModelLocators;
+
+  //Preprocessed copies of the models, with the polydata they were made from
+  struct PreprocessedModel
+  {
+    vtkWeakPointer<vtkMRMLModelNode> Model;
+    vtkWeakPointer<vtkPolyData> PolyData;
+    vtkMTimeType MTime;
+    vtkSmartPointer<vtkPolyData> Output;
+  };
+  std::map<std::string, PreprocessedModel> PreprocessedModels;
+  vtkSmartPointer<vtkPolyData> UncachedPreprocessed;
+
+  //Levels of detail of the models, with the producer of the level displayed if any
+  struct ModelLevelsOfDetail
+  {
+    vtkWeakPointer<vtkMRMLModelNode> Model;
+    vtkWeakPointer<vtkPolyData> PolyData;
+    vtkMTimeType MTime;
+    vtkSmartPointer<vtkPlannerLevelOfDetail> Levels;
+    vtkSmartPointer<vtkTrivialProducer> Producer;
+  };
+  std::map<std::string, ModelLevelsOfDetail> LevelsOfDetail;
+
+  //Number of triangles a model is displayed with while it is moved
+  static const vtkIdType InteractiveTriangleBudget = 50000;
+
+  //Triangles of the models in their own coordinates for collision and gap queries, with
+  //the full resolution polydata they were built from, and the highlight of the last
+  //collisions found
+  struct CollisionIndex
+  {
+    vtkWeakPointer<vtkPolyData> PolyData;
+    vtkMTimeType MTime;
+    vtkSmartPointer<vtkPlannerTriangleIndex> Index;
+  };
+  std::map<std::string, CollisionIndex> CollisionIndices;
+  vtkSmartPointer<vtkMRMLModelNode> CollisionHighlight;
+
+  //Neighbors of each model in the adjacency graph, with the geometry and transforms of
+  //the model they were found for
+  struct AdjacencyNode
+  {
+    vtkWeakPointer<vtkMRMLModelNode> Model;
+    vtkMTimeType GeometryMTime;
+    vtkMTimeType TransformMTime;
+    std::set<std::string> Neighbors;
+  };
+  std::map<std::string, AdjacencyNode> Adjacency;
+  bool isAdjacencyCurrent(vtkMRMLModelNode* model);
+  void removeAdjacencyEdges(const std::string& id);
+
+  //Merge of the models of a hierarchy, kept between wraps.  Each child owns a segment of
+  //the merged points and polygons, copied again only when the child is modified.
+  struct MergeSegment
+  {
+    vtkWeakPointer<vtkPolyData> PolyData;
+    vtkMTimeType MTime;
+    vtkIdType NumberOfPoints;
+    vtkIdType PointOffset;
+    vtkIdType NumberOfCells;
+    vtkIdType ConnectivitySize;
+    vtkIdType ConnectivityOffset;
+  };
+  std::vector<MergeSegment> MergeSegments;
+  vtkSmartPointer<vtkPolyData> MergedPolyData;
+
+  //Distance preview member variables.  PreviewExactDistance is a second distance to the
+  //same reference, only evaluated by the thread computing the exact distances: a new one
+  //is made when the reference changes, the thread keeps the one it was given.
+  vtkSmartPointer<vtkImplicitPolyDataDistance> PreviewDistance;
+  vtkSmartPointer<vtkImplicitPolyDataDistance> PreviewExactDistance;
+  vtkWeakPointer<vtkPolyData> PreviewReferencePolyData;
+  vtkMTimeType PreviewReferenceMTime;
+  vtkWeakPointer<vtkPolyData> PreviewPolyData;
+  vtkSmartPointer<vtkPoints> PreviewPoints;
+  bool PreviewSigned;
+  static const int PreviewSampleBudget = 2000;
+  void updateReferenceDistance(vtkPolyData* referencePolyData);
+
+  //Number of model points the bend optimization measures
+  static const int BendOptimizeSampleBudget = 2000;
+
+  //Number of floats a bend sweep may store, and the fewest samples worth sweeping
+  static const vtkIdType BendSweepBudget = 32 * 1024 * 1024;
+  static const int MinimumBendSweepSamples = 5;
 
 
   double preOPICV;
@@ -0,0 +1,122 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Planner Logic includes
+#include "vtkPlannerBendSweep.h"
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkPoints.h>
+#include <vtkTransform.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+//Rotation about the z axis by the angle a bend gives its landmarks, atan(magnitude)
+void bendPoint(const double in[3], double magnitude, double out[3])
+{
+  double angle = std::atan(magnitude);
+  out[0] = std::cos(angle) * in[0] - std::sin(angle) * in[1];
+  out[1] = std::sin(angle) * in[0] + std::cos(angle) * in[1];
+  out[2] = in[2];
+}
+
+//----------------------------------------------------------------------------
+//Largest distance between the interpolated points at a magnitude and the bent points
+double interpolationError(vtkPlannerBendSweep* sweep, vtkPoints* points, double magnitude)
+{
+  vtkNew<vtkPoints> interpolated;
+  sweep->InterpolatePoints(magnitude, interpolated.GetPointer());
+  double error = 0;
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    double expected[3];
+    double q[3];
+    points->GetPoint(i, p);
+    bendPoint(p, magnitude, expected);
+    interpolated->GetPoint(i, q);
+    error = std::max(error, std::sqrt(vtkMath::Distance2BetweenPoints(q, expected)));
+  }
+  return error;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+//Sweep a rotation over the range of the bend slider with the fewest samples the logic
+//builds a sweep with, and check the interpolation between the samples
+int vtkPlannerBendSweepTest(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  const int numberOfSamples = 5;
+  const double lever = 100;
+
+  //points along a lever from the axis, as the side of a bone turning about the bend
+  vtkNew<vtkPoints> points;
+  for (int i = 0; i <= 10; i++)
+  {
+    points->InsertNextPoint(lever * i / 10, 0, i % 3);
+  }
+
+  vtkNew<vtkPlannerBendSweep> sweep;
+  sweep->SetPoints(points.GetPointer());
+  sweep->SetSampling(-1, 1, numberOfSamples);
+  for (int i = 0; i < numberOfSamples; i++)
+  {
+    vtkNew<vtkTransform> rotation;
+    rotation->RotateZ(vtkMath::DegreesFromRadians(std::atan(sweep->GetSampleMagnitude(i))));
+    sweep->SetSampleTransform(i, rotation.GetPointer());
+  }
+  if (!sweep->Compute() || !sweep->GetComplete())
+  {
+    std::cerr << "The sweep was not computed" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //the samples are reproduced, up to the float precision they are stored with
+  for (int i = 0; i < numberOfSamples; i++)
+  {
+    double error = interpolationError(sweep.GetPointer(), points.GetPointer(), sweep->GetSampleMagnitude(i));
+    if (error > 1e-4)
+    {
+      std::cerr << "Sample " << i << " is off by " << error << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  //between the samples, where the interpolation is the farthest from the rotation, the
+  //points stay within a hundredth of the lever
+  for (int i = 0; i + 1 < numberOfSamples; i++)
+  {
+    double magnitude = (sweep->GetSampleMagnitude(i) + sweep->GetSampleMagnitude(i + 1)) / 2;
+    double error = interpolationError(sweep.GetPointer(), points.GetPointer(), magnitude);
+    if (error > 0.01 * lever)
+    {
+      std::cerr << "Interpolation at " << magnitude << " is off by " << error << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,396 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Planner Logic includes
+#include "vtkPlannerBendTransform.h"
+
+// VTK includes
+#include <vtkDoubleArray.h>
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkPoints.h>
+#include <vtkThinPlateSplineTransform.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+bool checkPoint(const char* what, const double actual[3], const double expected[3], double tolerance)
+{
+  if (vtkMath::Distance2BetweenPoints(actual, expected) > tolerance * tolerance)
+  {
+    std::cerr << what << ": got (" << actual[0] << ", " << actual[1] << ", " << actual[2]
+      << "), expected (" << expected[0] << ", " << expected[1] << ", " << expected[2] << ")" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Landmarks on a 4x4x3 grid of spacing 10, so no point is within the support radius of all of them
+void makeLandmarks(vtkPoints* landmarks)
+{
+  for (int z = 0; z < 3; z++)
+  {
+    for (int y = 0; y < 4; y++)
+    {
+      for (int x = 0; x < 4; x++)
+      {
+        landmarks->InsertNextPoint(10 * x, 10 * y, 10 * z);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+//Landmarks spread over a sphere of radius 60 away from the origin, in millimeters as
+//the landmarks of a bend
+void makeSphereLandmarks(vtkPoints* landmarks)
+{
+  const int count = 60;
+  const double center[3] = { 100, -50, 30 };
+  const double radius = 60;
+  for (int i = 0; i < count; i++)
+  {
+    double z = 1 - (2 * i + 1.0) / count;
+    double r = std::sqrt(1 - z * z);
+    double angle = 2.39996323 * i;
+    landmarks->InsertNextPoint(center[0] + radius * r * std::cos(angle),
+      center[1] + radius * r * std::sin(angle), center[2] + radius * z);
+  }
+}
+
+//----------------------------------------------------------------------------
+//The R basis spline with the Sigma of the bends, on landmarks in millimeters, against
+//vtkThinPlateSplineTransform at points between the landmarks.  A rigid motion of the
+//landmarks must move all the points rigidly.
+bool checkThinPlateSpline()
+{
+  const double tolerance = 1e-6;
+  vtkNew<vtkPoints> sources;
+  makeSphereLandmarks(sources.GetPointer());
+  vtkNew<vtkPoints> rigid;
+  vtkNew<vtkPoints> bent;
+  const double c = std::cos(0.3);
+  const double s = std::sin(0.3);
+  for (vtkIdType i = 0; i < sources->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    sources->GetPoint(i, p);
+    rigid->InsertNextPoint(c * p[0] - s * p[1] + 5, s * p[0] + c * p[1] - 3, p[2] + 2);
+    bent->InsertNextPoint(p[0], p[1], p[2] + (i % 7 == 0 ? 4 : 0));
+  }
+
+  vtkNew<vtkPlannerBendTransform> transform;
+  transform->SetSigma(.0001);
+  transform->SetSourceLandmarks(sources.GetPointer());
+  transform->SetTargetLandmarks(rigid.GetPointer());
+  const double inside[3][3] = { { 100, -50, 30 }, { 130, -40, 10 }, { 80, -70, 60 } };
+  for (int i = 0; i < 3; i++)
+  {
+    const double* p = inside[i];
+    double expected[3] = { c * p[0] - s * p[1] + 5, s * p[0] + c * p[1] - 3, p[2] + 2 };
+    double out[3];
+    transform->TransformPoint(p, out);
+    if (!checkPoint("Rigid motion", out, expected, tolerance))
+    {
+      return false;
+    }
+  }
+
+  vtkNew<vtkThinPlateSplineTransform> reference;
+  reference->SetBasisToR();
+  reference->SetSigma(.0001);
+  reference->SetSourceLandmarks(sources.GetPointer());
+  reference->SetTargetLandmarks(bent.GetPointer());
+  transform->SetTargetLandmarks(bent.GetPointer());
+  for (int i = 0; i < 3; i++)
+  {
+    double out[3];
+    double expected[3];
+    transform->TransformPoint(inside[i], out);
+    reference->TransformPoint(inside[i], expected);
+    if (!checkPoint("Thin plate spline", out, expected, 1e-4))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//The R basis of the bends, with its default Sigma: landmarks are interpolated, the
+//derivative matches central differences, and the parallel transform of points and normals
+//agrees with the transform of single points.  A transformed normal stays orthogonal to
+//the transformed tangents of its point.
+bool checkRadialBasis()
+{
+  const double tolerance = 1e-6;
+  vtkNew<vtkPoints> sources;
+  makeSphereLandmarks(sources.GetPointer());
+  vtkNew<vtkPoints> targets;
+  for (vtkIdType i = 0; i < sources->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    sources->GetPoint(i, p);
+    targets->InsertNextPoint(p[0] + 1, p[1] - 2 + (i % 5 == 0 ? 3 : 0), p[2] + (i % 3 == 0 ? -2 : 0));
+  }
+  vtkNew<vtkPlannerBendTransform> transform;
+  transform->SetSourceLandmarks(sources.GetPointer());
+  transform->SetTargetLandmarks(targets.GetPointer());
+  double out[3];
+  for (vtkIdType i = 0; i < sources->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    double q[3];
+    sources->GetPoint(i, p);
+    targets->GetPoint(i, q);
+    transform->TransformPoint(p, out);
+    if (!checkPoint("R basis landmark", out, q, tolerance))
+    {
+      return false;
+    }
+  }
+
+  const double step = 1e-4;
+  const double probes[3][3] = { { 100, -50, 30 }, { 130, -40, 10 }, { 80, -70, 60 } };
+  const double probeNormals[3][3] = { { 0, 0, 1 }, { 0.6, 0, 0.8 }, { 1 / 3.0, 2 / 3.0, -2 / 3.0 } };
+  vtkNew<vtkPoints> points;
+  vtkNew<vtkDoubleArray> normals;
+  normals->SetNumberOfComponents(3);
+  transform->Update();
+  for (int i = 0; i < 3; i++)
+  {
+    points->InsertNextPoint(probes[i][0], probes[i][1], probes[i][2]);
+    normals->InsertNextTuple(probeNormals[i]);
+    double derivative[3][3];
+    transform->InternalTransformDerivative(probes[i], out, derivative);
+    for (int k = 0; k < 3; k++)
+    {
+      double forward[3] = { probes[i][0], probes[i][1], probes[i][2] };
+      double backward[3] = { probes[i][0], probes[i][1], probes[i][2] };
+      forward[k] += step;
+      backward[k] -= step;
+      double outForward[3];
+      double outBackward[3];
+      transform->TransformPoint(forward, outForward);
+      transform->TransformPoint(backward, outBackward);
+      double column[3];
+      double expected[3];
+      for (int j = 0; j < 3; j++)
+      {
+        column[j] = derivative[j][k];
+        expected[j] = (outForward[j] - outBackward[j]) / (2 * step);
+      }
+      if (!checkPoint("R basis derivative", column, expected, 1e-6))
+      {
+        return false;
+      }
+    }
+  }
+
+  vtkNew<vtkPoints> transformed;
+  vtkNew<vtkDoubleArray> transformedNormals;
+  transform->TransformPointsNormals(points.GetPointer(), transformed.GetPointer(),
+    normals.GetPointer(), transformedNormals.GetPointer());
+  if (transformedNormals->GetNumberOfTuples() != points->GetNumberOfPoints())
+  {
+    std::cerr << "Wrong number of transformed normals: " << transformedNormals->GetNumberOfTuples() << std::endl;
+    return false;
+  }
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    double q[3];
+    points->GetPoint(i, p);
+    transformed->GetPoint(i, q);
+    transform->TransformPoint(p, out);
+    if (!checkPoint("R basis parallel transform", q, out, tolerance))
+    {
+      return false;
+    }
+
+    //two tangents orthogonal to the normal, through central differences
+    double normal[3];
+    double transformedNormal[3];
+    normals->GetTuple(i, normal);
+    transformedNormals->GetTuple(i, transformedNormal);
+    if (std::fabs(vtkMath::Norm(transformedNormal) - 1) > tolerance)
+    {
+      std::cerr << "Transformed normal " << i << " is not a unit vector" << std::endl;
+      return false;
+    }
+    double tangents[2][3];
+    vtkMath::Perpendiculars(normal, tangents[0], tangents[1], 0);
+    for (int t = 0; t < 2; t++)
+    {
+      double forward[3];
+      double backward[3];
+      for (int k = 0; k < 3; k++)
+      {
+        forward[k] = p[k] + step * tangents[t][k];
+        backward[k] = p[k] - step * tangents[t][k];
+      }
+      double outForward[3];
+      double outBackward[3];
+      transform->TransformPoint(forward, outForward);
+      transform->TransformPoint(backward, outBackward);
+      double tangent[3];
+      for (int k = 0; k < 3; k++)
+      {
+        tangent[k] = (outForward[k] - outBackward[k]) / (2 * step);
+      }
+      if (std::fabs(vtkMath::Dot(tangent, transformedNormal)) > 1e-6)
+      {
+        std::cerr << "Transformed normal " << i << " is not orthogonal to the surface" << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+//Exercise the compactly supported basis of vtkPlannerBendTransform
+int vtkPlannerBendTransformTest(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  const double radius = 15;
+  const double tolerance = 1e-6;
+  const double translation[3] = { 1, 2, 3 };
+
+  vtkNew<vtkPoints> sources;
+  makeLandmarks(sources.GetPointer());
+
+  vtkNew<vtkPlannerBendTransform> transform;
+  transform->SetSupportRadius(radius);
+  transform->SetSourceLandmarks(sources.GetPointer());
+  if (transform->GetNumberOfLandmarks() != sources->GetNumberOfPoints())
+  {
+    std::cerr << "Wrong number of landmarks: " << transform->GetNumberOfLandmarks() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //A translation of all the landmarks is reproduced everywhere, by the affine part alone
+  vtkNew<vtkPoints> targets;
+  for (vtkIdType i = 0; i < sources->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    sources->GetPoint(i, p);
+    targets->InsertNextPoint(p[0] + translation[0], p[1] + translation[1], p[2] + translation[2]);
+  }
+  transform->SetTargetLandmarks(targets.GetPointer());
+  const double inside[3] = { 15, 12, 7 };
+  const double translated[3] = { inside[0] + translation[0], inside[1] + translation[1], inside[2] + translation[2] };
+  double out[3];
+  transform->TransformPoint(inside, out);
+  if (!checkPoint("Translated point", out, translated, tolerance))
+  {
+    return EXIT_FAILURE;
+  }
+
+  //Displace one corner landmark: the landmarks are still interpolated
+  double corner[3];
+  targets->GetPoint(0, corner);
+  targets->SetPoint(0, corner[0], corner[1], corner[2] + 5);
+  transform->SetTargetLandmarks(targets.GetPointer());
+  for (vtkIdType i = 0; i < sources->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    double q[3];
+    sources->GetPoint(i, p);
+    targets->GetPoint(i, q);
+    transform->TransformPoint(p, out);
+    if (!checkPoint("Landmark", out, q, tolerance))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  //Beyond the support radius of every landmark only the affine part is left, so the
+  //transform of the midpoint of two far points is the midpoint of their transforms
+  const double farA[3] = { 100, 0, 0 };
+  const double farB[3] = { 200, 0, 0 };
+  const double farMiddle[3] = { 150, 0, 0 };
+  double outA[3];
+  double outB[3];
+  transform->TransformPoint(farA, outA);
+  transform->TransformPoint(farB, outB);
+  transform->TransformPoint(farMiddle, out);
+  const double middle[3] = { (outA[0] + outB[0]) / 2, (outA[1] + outB[1]) / 2, (outA[2] + outB[2]) / 2 };
+  if (!checkPoint("Far point", out, middle, tolerance))
+  {
+    return EXIT_FAILURE;
+  }
+
+  //Between the landmarks the radial part does contribute, and the parallel transform of
+  //points agrees with the transform of a single point
+  vtkNew<vtkPoints> points;
+  points->InsertNextPoint(inside[0], inside[1], inside[2]);
+  points->InsertNextPoint(3, 4, 2);
+  points->InsertNextPoint(farA[0], farA[1], farA[2]);
+  vtkNew<vtkPoints> transformed;
+  transform->TransformPoints(points.GetPointer(), transformed.GetPointer());
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    double q[3];
+    points->GetPoint(i, p);
+    transformed->GetPoint(i, q);
+    transform->TransformPoint(p, out);
+    if (!checkPoint("Parallel transform", q, out, tolerance))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+  double nearCorner[3];
+  transform->TransformPoint(points->GetPoint(1), nearCorner);
+  if (nearCorner[2] - 2 - translation[2] <= tolerance)
+  {
+    std::cerr << "The displaced landmark does not pull the points near it" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //A spline computed for the same targets, without the decomposition, evaluates the same
+  vtkNew<vtkPlannerBendTransform> spline;
+  transform->ComputeSpline(targets.GetPointer(), spline.GetPointer());
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    double q[3];
+    points->GetPoint(i, p);
+    transformed->GetPoint(i, q);
+    spline->TransformPoint(p, out);
+    if (!checkPoint("Computed spline", out, q, tolerance))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!checkThinPlateSpline() || !checkRadialBasis())
+  {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Planner Logic includes
+#include "vtkPlannerHingeTransform.h"
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkPoints.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+bool checkPoint(const char* what, const double actual[3], const double expected[3], double tolerance)
+{
+  if (vtkMath::Distance2BetweenPoints(actual, expected) > tolerance * tolerance)
+  {
+    std::cerr << what << ": got (" << actual[0] << ", " << actual[1] << ", " << actual[2]
+      << "), expected (" << expected[0] << ", " << expected[1] << ", " << expected[2] << ")" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Rotate p by angle about the z axis through origin
+void rotate(const double origin[3], double angle, const double p[3], double out[3])
+{
+  double c = std::cos(angle);
+  double s = std::sin(angle);
+  double x = p[0] - origin[0];
+  double y = p[1] - origin[1];
+  out[0] = origin[0] + c * x - s * y;
+  out[1] = origin[1] + s * x + c * y;
+  out[2] = p[2];
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+//Exercise the blended rotation of vtkPlannerHingeTransform
+int vtkPlannerHingeTransformTest(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  const double tolerance = 1e-9;
+  const double width = 10;
+  const double angles[2] = { -0.2, 0.3 };
+
+  //Hinge along z through (5, 2, 0), the plane x = 5 contains it
+  const double origin[3] = { 5, 2, 0 };
+  const double direction[3] = { 0, 0, 3 };
+  const double normal[3] = { 2, 0, 0 };
+  vtkNew<vtkPlannerHingeTransform> transform;
+  transform->SetAxis(origin, direction);
+  transform->SetPlane(origin, normal);
+  transform->SetAngles(angles[0], angles[1]);
+  transform->SetBlendWidth(width);
+
+  //Points on the plane stay where they are
+  const double onPlane[3][3] = { { 5, 2, 0 }, { 5, 40, -7 }, { 5, -13, 22 } };
+  double out[3];
+  for (int i = 0; i < 3; i++)
+  {
+    transform->TransformPoint(onPlane[i], out);
+    if (!checkPoint("Point on the plane", out, onPlane[i], tolerance))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  //Beyond the blend band each side turns rigidly by its own angle
+  const double outside[4][3] = { { 15, 2, 0 }, { 30, -8, 4 }, { -5, 2, 1 }, { -20, 9, -3 } };
+  for (int i = 0; i < 4; i++)
+  {
+    double expected[3];
+    rotate(origin, outside[i][0] < origin[0] ? angles[0] : angles[1], outside[i], expected);
+    transform->TransformPoint(outside[i], out);
+    if (!checkPoint("Point beyond the band", out, expected, tolerance))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  //Inside the band the derivative matches central differences, and it is the rotation
+  //alone beyond the band
+  const double step = 1e-5;
+  const double probes[4][3] = { { 9, 3, 2 }, { 1, -6, 5 }, { 13.5, 20, -1 }, { 25, -4, 0 } };
+  transform->Update();
+  for (int i = 0; i < 4; i++)
+  {
+    double derivative[3][3];
+    transform->InternalTransformDerivative(probes[i], out, derivative);
+    for (int k = 0; k < 3; k++)
+    {
+      double forward[3] = { probes[i][0], probes[i][1], probes[i][2] };
+      double backward[3] = { probes[i][0], probes[i][1], probes[i][2] };
+      forward[k] += step;
+      backward[k] -= step;
+      double outForward[3];
+      double outBackward[3];
+      transform->TransformPoint(forward, outForward);
+      transform->TransformPoint(backward, outBackward);
+      double column[3];
+      double expected[3];
+      for (int j = 0; j < 3; j++)
+      {
+        column[j] = derivative[j][k];
+        expected[j] = (outForward[j] - outBackward[j]) / (2 * step);
+      }
+      if (!checkPoint("Derivative", column, expected, 1e-6))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  //The parallel transform of points agrees with the transform of a single point
+  vtkNew<vtkPoints> points;
+  for (int i = 0; i < 4; i++)
+  {
+    points->InsertNextPoint(probes[i][0], probes[i][1], probes[i][2]);
+  }
+  vtkNew<vtkPoints> transformed;
+  transform->TransformPoints(points.GetPointer(), transformed.GetPointer());
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); i++)
+  {
+    double p[3];
+    double q[3];
+    points->GetPoint(i, p);
+    transformed->GetPoint(i, q);
+    transform->TransformPoint(p, out);
+    if (!checkPoint("Parallel transform", q, out, tolerance))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Planner Logic includes
+#include "vtkPlannerTriangleIndex.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+bool checkPoint(const char* what, const double actual[3], const double expected[3], double tolerance)
+{
+  if (vtkMath::Distance2BetweenPoints(actual, expected) > tolerance * tolerance)
+  {
+    std::cerr << what << ": got (" << actual[0] << ", " << actual[1] << ", " << actual[2]
+      << "), expected (" << expected[0] << ", " << expected[1] << ", " << expected[2] << ")" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//Square [x0, x0 + size] x [0, size] at height z, in 8 x 8 quads, so the index has a
+//few levels
+void makeGrid(vtkPolyData* polyData, double x0, double size, double z)
+{
+  const int n = 8;
+  vtkNew<vtkPoints> points;
+  vtkNew<vtkCellArray> polys;
+  for (int j = 0; j <= n; j++)
+  {
+    for (int i = 0; i <= n; i++)
+    {
+      points->InsertNextPoint(x0 + size * i / n, size * j / n, z);
+    }
+  }
+  for (int j = 0; j < n; j++)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      vtkIdType quad[4] = { j * (n + 1) + i, j * (n + 1) + i + 1, (j + 1) * (n + 1) + i + 1, (j + 1) * (n + 1) + i };
+      polys->InsertNextCell(4, quad);
+    }
+  }
+  polyData->SetPoints(points.GetPointer());
+  polyData->SetPolys(polys.GetPointer());
+}
+
+//----------------------------------------------------------------------------
+//Upright rectangle in the plane x = x0, over [y0, y1] x [z0, z1], in two triangles
+void makeWall(vtkPolyData* polyData, double x0, double y0, double y1, double z0, double z1)
+{
+  vtkNew<vtkPoints> points;
+  vtkNew<vtkCellArray> polys;
+  points->InsertNextPoint(x0, y0, z0);
+  points->InsertNextPoint(x0, y1, z0);
+  points->InsertNextPoint(x0, y1, z1);
+  points->InsertNextPoint(x0, y0, z1);
+  vtkIdType first[3] = { 0, 1, 2 };
+  vtkIdType second[3] = { 0, 2, 3 };
+  polys->InsertNextCell(3, first);
+  polys->InsertNextCell(3, second);
+  polyData->SetPoints(points.GetPointer());
+  polyData->SetPolys(polys.GetPointer());
+}
+
+//----------------------------------------------------------------------------
+//Number of crossing pairs, checking that both lists got one triangle per pair
+vtkIdType countCrossings(vtkPlannerTriangleIndex* index, vtkPlannerTriangleIndex* other, vtkMatrix4x4* otherToThis)
+{
+  std::vector<vtkIdType> triangles;
+  std::vector<vtkIdType> otherTriangles;
+  vtkIdType count = index->FindIntersectingTriangles(other, otherToThis, triangles, otherTriangles);
+  if (static_cast<vtkIdType>(triangles.size()) != count || static_cast<vtkIdType>(otherTriangles.size()) != count)
+  {
+    std::cerr << "Wrong number of triangles for " << count << " crossings" << std::endl;
+    return -1;
+  }
+  return count;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+//Exercise the queries of vtkPlannerTriangleIndex on a flat grid and on surfaces placed
+//across it, against it and next to it
+int vtkPlannerTriangleIndexTest(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  const double tolerance = 1e-9;
+  vtkNew<vtkPolyData> grid;
+  makeGrid(grid.GetPointer(), 0, 10, 0);
+  vtkNew<vtkPlannerTriangleIndex> index;
+  index->Build(grid.GetPointer());
+  if (index->GetNumberOfTriangles() != 128)
+  {
+    std::cerr << "Wrong number of triangles: " << index->GetNumberOfTriangles() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //Closest points above the grid and beside it, one at a time and in a batch
+  const double queries[2][3] = { { 3.3, 4.7, 5 }, { -2, 4, 0 } };
+  const double expected[2][3] = { { 3.3, 4.7, 0 }, { 0, 4, 0 } };
+  double closestPoints[6];
+  double distances[2];
+  vtkIdType cellIds[2];
+  index->FindClosestPoints(2, &queries[0][0], closestPoints, distances, cellIds, NULL);
+  for (int i = 0; i < 2; i++)
+  {
+    double closest[3];
+    vtkIdType cellId;
+    double dist2 = index->FindClosestPoint(queries[i], closest, cellId);
+    if (!checkPoint("Closest point", closest, expected[i], tolerance) ||
+      !checkPoint("Batch closest point", closestPoints + 3 * i, expected[i], tolerance))
+    {
+      return EXIT_FAILURE;
+    }
+    double distance = std::sqrt(vtkMath::Distance2BetweenPoints(queries[i], expected[i]));
+    if (std::fabs(std::sqrt(dist2) - distance) > tolerance || std::fabs(distances[i] - distance) > tolerance ||
+      cellId < 0 || cellIds[i] != cellId)
+    {
+      std::cerr << "Wrong distance or cell of query " << i << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  //A wall through the grid crosses it
+  vtkNew<vtkPolyData> wall;
+  makeWall(wall.GetPointer(), 5.05, 2.1, 7.9, -3, 3);
+  vtkNew<vtkPlannerTriangleIndex> wallIndex;
+  wallIndex->Build(wall.GetPointer());
+  if (countCrossings(index.GetPointer(), wallIndex.GetPointer(), NULL) <= 0 ||
+    !index->IsWithinDistance(wallIndex.GetPointer(), NULL, 0))
+  {
+    std::cerr << "The wall through the grid does not cross it" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //A wall standing on the grid only touches it along its lower edge: no crossing, but
+  //the surfaces are at distance 0
+  makeWall(wall.GetPointer(), 5.05, 2.1, 7.9, 0, 3);
+  wallIndex->Build(wall.GetPointer());
+  if (countCrossings(index.GetPointer(), wallIndex.GetPointer(), NULL) != 0 ||
+    !index->IsWithinDistance(wallIndex.GetPointer(), NULL, 0))
+  {
+    std::cerr << "The wall standing on the grid is not a contact" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //A neighbouring grid in the same plane shares an edge, as the faces of two fragments
+  //along their cut
+  vtkNew<vtkPolyData> neighbour;
+  makeGrid(neighbour.GetPointer(), 10, 10, 0);
+  vtkNew<vtkPlannerTriangleIndex> neighbourIndex;
+  neighbourIndex->Build(neighbour.GetPointer());
+  if (countCrossings(index.GetPointer(), neighbourIndex.GetPointer(), NULL) != 0 ||
+    !index->IsWithinDistance(neighbourIndex.GetPointer(), NULL, 0))
+  {
+    std::cerr << "The neighbouring grid is not a contact" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //The same grid lifted by the matrix is within the distance only beyond the gap, and
+  //the wall moved below the grid no longer reaches it
+  vtkNew<vtkMatrix4x4> lift;
+  lift->SetElement(2, 3, 2);
+  if (countCrossings(index.GetPointer(), index.GetPointer(), lift.GetPointer()) != 0 ||
+    index->IsWithinDistance(index.GetPointer(), lift.GetPointer(), 1.99) ||
+    !index->IsWithinDistance(index.GetPointer(), lift.GetPointer(), 2.01))
+  {
+    std::cerr << "Wrong distance to the lifted grid" << std::endl;
+    return EXIT_FAILURE;
+  }
+  lift->SetElement(2, 3, -3.5);
+  if (countCrossings(index.GetPointer(), wallIndex.GetPointer(), lift.GetPointer()) != 0 ||
+    index->IsWithinDistance(wallIndex.GetPointer(), lift.GetPointer(), 0.49) ||
+    !index->IsWithinDistance(wallIndex.GetPointer(), lift.GetPointer(), 0.51))
+  {
+    std::cerr << "Wrong distance to the lowered wall" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -16,9 +16,12 @@
 ==============================================================================*/
 
 // Qt includes
+#include <QAtomicInt>
 #include <QDebug>
 #include <QMessageBox>
 #include <QSettings>
+#include <QThread>
+#include <QTimer>
 #include <qdatetime.h>
 
 
@@ -39,6 +42,7 @@
 #include <vtkRenderLargeImage.h>
 #include <vtkKdTreePointLocator.h>
 #include <vtkDoubleArray.h>
+#include <vtkFloatArray.h>
 
 // SlicerQt includes
 #include "qSlicerApplication.h"
@@ -72,10 +76,6 @@
 #include "vtkMRMLSelectionNode.h"
 #include "vtkThinPlateSplineTransform.h"
 #include <vtkPointData.h>
-#include "vtkMassProperties.h"
-#include "vtkCleanPolyData.h"
-#include "vtkTriangleFilter.h"
-#include "vtkTransformPolyDataFilter.h"
 #include "vtkTransform.h"
 #include "vtkMRMLLayoutNode.h"
 #include "vtkScalarBarWidget.h"
@@ -102,11 +102,162 @@
 
 //STD includes
 #include <vector>
+#include <map>
+#include <set>
 #include <sstream>
 #include <array>
+#include <cmath>
 
 #define D(x) std::cout << x << std::endl;
 
+//Gaps are measured up to this distance, in mm
+static const double MaximumGap = 10.0;
+
+//-----------------------------------------------------------------------------
+//Surface area of a model after a transform, only the points are transformed
+static double bentSurfaceArea(vtkPoints* points, const std::vector<vtkIdType>& triangles, vtkAbstractTransform* transform)
+{
+  vtkNew<vtkPoints> bentPoints;
+  bentPoints->SetDataType(points->GetDataType());
+  transform->TransformPoints(points, bentPoints.GetPointer());
+  return vtkSlicerPlannerLogic::computeSurfaceArea(bentPoints.GetPointer(), triangles);
+}
+
+//-----------------------------------------------------------------------------
+/// Computes the bent surface area of a bend preview off the GUI thread.  The transform
+/// is created on the GUI thread and shares no data with the bend state of the logic.
+class qSlicerPlannerBendPreviewThread : public QThread
+{
+public:
+  qSlicerPlannerBendPreviewThread(QObject* parent)
+    : QThread(parent), BendingTriangles(NULL), Magnitude(0), Generation(0), Area(0)
+  {
+  }
+
+  vtkSmartPointer<vtkPolyData> BendingData;
+  const std::vector<vtkIdType>* BendingTriangles;
+  double Magnitude;
+  int Generation;
+  vtkSmartPointer<vtkWarpTransform> Transform;
+  double Area;
+
+protected:
+  void run()
+  {
+    this->Area = bentSurfaceArea(this->BendingData->GetPoints(), *this->BendingTriangles, this->Transform);
+  }
+};
+
+//-----------------------------------------------------------------------------
+/// Computes a bend sweep and the bent areas of its samples off the GUI thread
+class qSlicerPlannerBendSweepThread : public QThread
+{
+public:
+  qSlicerPlannerBendSweepThread(QObject* parent)
+    : QThread(parent), BendingTriangles(NULL)
+  {
+  }
+
+  vtkSmartPointer<vtkPlannerBendSweep> Sweep;
+  vtkSmartPointer<vtkPolyData> BendingData;
+  const std::vector<vtkIdType>* BendingTriangles;
+
+protected:
+  void run()
+  {
+    for(int i = 0; i < this->Sweep->GetNumberOfSamples() && !this->Sweep->GetAborted(); i++)
+    {
+      this->Sweep->SetSampleArea(i,
+        bentSurfaceArea(this->BendingData->GetPoints(), *this->BendingTriangles, this->Sweep->GetSampleTransform(i)));
+    }
+    this->Sweep->Compute();
+  }
+};
+
+//-----------------------------------------------------------------------------
+/// Computes the exact distances of a distance preview off the GUI thread
+class qSlicerPlannerDistanceRefineThread : public QThread
+{
+public:
+  qSlicerPlannerDistanceRefineThread(QObject* parent)
+    : QThread(parent), SignedDistance(false)
+  {
+  }
+
+  vtkSmartPointer<vtkPoints> Points;
+  vtkSmartPointer<vtkImplicitPolyDataDistance> Distance;
+  bool SignedDistance;
+  vtkSmartPointer<vtkFloatArray> Distances;
+  QAtomicInt Aborted;
+
+protected:
+  void run()
+  {
+    vtkIdType numberOfPoints = this->Points->GetNumberOfPoints();
+    this->Distances = vtkSmartPointer<vtkFloatArray>::New();
+    this->Distances->SetNumberOfValues(numberOfPoints);
+    for(vtkIdType i = 0; i < numberOfPoints; i++)
+    {
+      //a new preview drops this one, check every few points
+      if(i % 1000 == 0 && this->Aborted.fetchAndAddRelaxed(0))
+      {
+        this->Distances = NULL;
+        return;
+      }
+      double distance = this->Distance->EvaluateFunction(this->Points->GetPoint(i));
+      this->Distances->SetValue(i, this->SignedDistance ? distance : std::fabs(distance));
+    }
+  }
+};
+
+//-----------------------------------------------------------------------------
+/// Builds the levels of detail and the collision indices of copies of models off the
+/// GUI thread, then tests the pairs of models that may be adjacent on their indices
+class qSlicerPlannerLevelOfDetailThread : public QThread
+{
+public:
+  qSlicerPlannerLevelOfDetailThread(QObject* parent)
+    : QThread(parent)
+  {
+  }
+
+  //for each model, the copy to build from, or NULL and its index already built
+  std::vector<std::string> ModelIDs;
+  std::vector<vtkMTimeType> GeometryMTimes;
+  std::vector<vtkSmartPointer<vtkPolyData> > Inputs;
+  std::vector<vtkSmartPointer<vtkPlannerLevelOfDetail> > Levels;
+  std::vector<vtkSmartPointer<vtkPlannerTriangleIndex> > Indices;
+
+  //pairs of models, by their position above, and the matrix from the second to the first
+  std::vector<size_t> PairModels;
+  std::vector<size_t> PairOthers;
+  std::vector<vtkSmartPointer<vtkMatrix4x4> > PairMatrices;
+  std::vector<bool> Adjacent;
+
+protected:
+  void run()
+  {
+    this->Levels.assign(this->Inputs.size(), vtkSmartPointer<vtkPlannerLevelOfDetail>());
+    for(size_t i = 0; i < this->Inputs.size(); i++)
+    {
+      if(!this->Inputs[i])
+      {
+        continue;
+      }
+      this->Levels[i] = vtkSmartPointer<vtkPlannerLevelOfDetail>::New();
+      this->Levels[i]->Build(this->Inputs[i]);
+      this->Indices[i] = vtkSmartPointer<vtkPlannerTriangleIndex>::New();
+      this->Indices[i]->Build(this->Inputs[i]);
+    }
+    this->Adjacent.assign(this->PairModels.size(), false);
+    for(size_t i = 0; i < this->PairModels.size(); i++)
+    {
+      this->Adjacent[i] = vtkSlicerPlannerLogic::areAdjacent(this->Indices[this->PairModels[i]],
+        this->Indices[this->PairOthers[i]], this->PairMatrices[i]);
+    }
+  }
+};
+
 
 
 //-----------------------------------------------------------------------------
@@ -177,12 +328,14 @@ public:
   vtkWeakPointer<vtkMRMLNode> CurrentBendNode;
   vtkSmartPointer<vtkPoints> Fiducials;
   vtkSmartPointer<vtkPolyData> BendingData;
+  std::vector<vtkIdType> BendingTriangles;
   double BendMagnitude;
   bool bendingActive;
   bool bendingOpen;
   bool placingActive;
   bool BendDoubleSide;
   bool BendASide;
+  bool BendHinge;
   vtkWeakPointer<vtkMRMLScene> scene;
 
   //move
@@ -194,16 +347,58 @@ public:
   int ActivePoint;
   void computeAndSetSourcePoints(vtkMRMLScene* scene);
   void computeTransform(vtkMRMLScene* scene);
+  void setBendOptions();
+  void applyBendTransform(vtkMRMLScene* scene, vtkAbstractTransform* transform, double area);
   void clearControlPoints(vtkMRMLScene* scene);
   void clearBendingData(vtkMRMLScene* scene);
 
   //Metrics Variables
   std::vector<vtkSmartPointer<vtkMRMLModelNode>> modelIterator;
+  //Number of references the distances on the models were last computed to
+  int DistanceReferenceCount;
+  std::string distanceArrayName(vtkMRMLModelNode* model);
   vtkWeakPointer<vtkSlicerCLIModuleLogic> distanceLogic;
   vtkSmartPointer<vtkMRMLTableNode> modelMetricsTable;
   bool PreOpSet;
   bool cliFreeze;
 
+  //Distance preview
+  vtkMRMLModelNode* distancePreviewReference();
+  vtkWeakPointer<vtkMRMLModelNode> MovingModel;
+  QTimer* DistancePreviewTimer;
+  void stopDistanceRefinement();
+  qSlicerPlannerDistanceRefineThread* DistanceRefineThread;
+
+  //Collisions and gaps: checked once per event loop pass while the moving model is dragged
+  std::vector<vtkMRMLModelNode*> otherModels(vtkMRMLModelNode* model);
+  //Fragments that touch or are close, checked instead of all the others for collisions and gaps
+  std::vector<vtkMRMLModelNode*> neighborModels(vtkMRMLModelNode* model);
+  QTimer* CollisionTimer;
+  QTimer* GapTimer;
+  vtkWeakPointer<vtkMRMLModelNode> GapModel;
+
+  //Bend preview: slider values are coalesced and computed one at a time off the GUI thread
+  void waitForBendPreview();
+  qSlicerPlannerBendPreviewThread* BendPreviewThread;
+  QTimer* BendPreviewTimer;
+  bool BendPreviewPending;
+  int BendPreviewGeneration;
+
+  //Bend sweep: the bend precomputed over the slider range, interpolated while scrubbing
+  void startBendSweep();
+  void waitForBendSweep();
+  void showBendSweep();
+  void restoreBendGeometry();
+  qSlicerPlannerBendSweepThread* BendSweepThread;
+  vtkSmartPointer<vtkPlannerBendSweep> BendSweep;
+  vtkSmartPointer<vtkPoints> BendOriginalPoints;
+  vtkSmartPointer<vtkDataArray> BendOriginalNormals;
+
+  //Levels of detail: built in the background after a cut or a load, shown while moving
+  void startLevelsOfDetail();
+  qSlicerPlannerLevelOfDetailThread* LevelOfDetailThread;
+  bool LevelOfDetailPending;
+
   //Metrics methods
   void prepScalarComputation(vtkMRMLScene* scene);
   void setScalarVisibility(bool visible);
@@ -427,7 +622,11 @@ void qSlicerPlannerModuleWidgetPrivate::clearControlPoints(vtkMRMLScene* scene)
 //Clear data used to compute bending trasforms
 void qSlicerPlannerModuleWidgetPrivate::clearBendingData(vtkMRMLScene* scene)
 {
+  //the threads use the triangles and the bent model
+  this->waitForBendPreview();
+  this->waitForBendSweep();
   this->Fiducials = NULL;
+  this->BendingTriangles.clear();
   this->logic->clearBendingData();
 
   //reset parent transform to correct node
@@ -461,14 +660,29 @@ qSlicerPlannerModuleWidgetPrivate::qSlicerPlannerModuleWidgetPrivate()
   this->bendingOpen = false;
   this->placingActive = false;
   this->cmdNode = NULL;
+  this->DistanceReferenceCount = 0;
   this->PreOpSet = false;
   this->cliFreeze = false;
+  this->MovingModel = NULL;
+  this->DistancePreviewTimer = NULL;
+  this->BendPreviewThread = NULL;
+  this->BendPreviewTimer = NULL;
+  this->BendPreviewPending = false;
+  this->BendPreviewGeneration = 0;
+  this->BendSweepThread = NULL;
+  this->LevelOfDetailThread = NULL;
+  this->LevelOfDetailPending = false;
+  this->DistanceRefineThread = NULL;
+  this->CollisionTimer = NULL;
+  this->GapTimer = NULL;
+  this->GapModel = NULL;
   this->savingActive = false;
   this->waitingOnScreenshot = false;
   this->scene = NULL;
 
   this->BendDoubleSide = true;
   this->BendASide = true;
+  this->BendHinge = false;
 
   this->BendPoints[0] = NULL;
   this->BendPoints[1] = NULL;
@@ -530,7 +744,7 @@ void qSlicerPlannerModuleWidgetPrivate::endPlacement()
   point.SetY(posa[1]);
   point.SetZ(posa[2]);  
 
-  double dist = this->logic->getDistanceToModel(point, vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode)->GetPolyData());
+  double dist = this->logic->getDistanceToModel(point, vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode));
   if (dist > 1.0)
   {
       
@@ -571,22 +785,15 @@ void qSlicerPlannerModuleWidgetPrivate::computeAndSetSourcePoints(vtkMRMLScene*
   this->Fiducials->InsertNextPoint(posb[0], posb[1], posb[2]);
   
 
+  this->logic->setBendLocal(this->LocalBendCheckBox->isChecked());
   this->logic->initializeBend(this->Fiducials, vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode));
   
-  vtkNew<vtkCleanPolyData> clean;
-  vtkNew<vtkTriangleFilter> triangulate;
-  clean->SetInputData(vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode)->GetPolyData());
-  clean->Update();
-  triangulate->SetInputData(clean->GetOutput());
-  triangulate->Update();
-  this->BendingData = triangulate->GetOutput();
-  vtkNew<vtkMassProperties> area;
-  area->SetInputData(this->BendingData);
-
-  area->Update();
+  //the same copy the logic bends
+  this->BendingData = this->logic->getPreprocessedPolyData(vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode));
+  vtkSlicerPlannerLogic::getTriangles(this->BendingData, this->BendingTriangles);
   
   std::stringstream surfaceAreaSstr;
-  surfaceAreaSstr << area->GetSurfaceArea();
+  surfaceAreaSstr << vtkSlicerPlannerLogic::computeSurfaceArea(this->BendingData->GetPoints(), this->BendingTriangles);
   const std::string& surfaceAreaString= surfaceAreaSstr.str();
   this->AreaBeforeBending->setText(surfaceAreaString.c_str());
 }
@@ -596,6 +803,44 @@ void qSlicerPlannerModuleWidgetPrivate::computeAndSetSourcePoints(vtkMRMLScene*
 //Compute thin plate spline transform based on source and target points
 void qSlicerPlannerModuleWidgetPrivate::computeTransform(vtkMRMLScene* scene)
 {
+  this->setBendOptions();
+  vtkSmartPointer<vtkWarpTransform> tps = this->logic->getBendTransform(this->BendMagnitude);
+  this->applyBendTransform(scene, tps, bentSurfaceArea(this->BendingData->GetPoints(), this->BendingTriangles, tps));
+}
+
+//-----------------------------------------------------------------------------
+//Pass the bend mode and side to the logic
+void qSlicerPlannerModuleWidgetPrivate::setBendOptions()
+{
+  if(this->BendHinge)
+  {
+    this->logic->setBendType(vtkSlicerPlannerLogic::Hinge);
+  }
+  else if(this->BendDoubleSide)
+  {
+    this->logic->setBendType(vtkSlicerPlannerLogic::Double);
+  }
+  else
+  {
+    this->logic->setBendType(vtkSlicerPlannerLogic::Single);
+  }
+
+  if(this->BendASide)
+  {
+    this->logic->setBendSide(vtkSlicerPlannerLogic::A);
+  }
+  else
+  {
+    this->logic->setBendSide(vtkSlicerPlannerLogic::B);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//Show a bend transform on the model being bent
+void qSlicerPlannerModuleWidgetPrivate::applyBendTransform(vtkMRMLScene* scene, vtkAbstractTransform* transform, double area)
+{
+  this->restoreBendGeometry();
+
   //Get direct parent transform of model
   //  
   vtkNew<vtkMRMLTransformNode> bendTemp;
@@ -614,42 +859,193 @@ void qSlicerPlannerModuleWidgetPrivate::computeTransform(vtkMRMLScene* scene)
       BendingTransformNode = parentTransform;
   }  
   
-  if(this->BendDoubleSide)
+  BendingTransformNode->SetAndObserveTransformToParent(transform);
+  vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode)->SetAndObserveTransformNodeID(BendingTransformNode->GetID());
+
+  std::stringstream surfaceAreaSstr;
+  surfaceAreaSstr << area;
+  const std::string& surfaceAreaString= surfaceAreaSstr.str();
+  this->AreaAfterBending->setText(surfaceAreaString.c_str());  
+  
+}
+
+//-----------------------------------------------------------------------------
+//Wait for the bend preview in progress and drop it, before using the bend on the GUI thread
+void qSlicerPlannerModuleWidgetPrivate::waitForBendPreview()
+{
+  this->BendPreviewTimer->stop();
+  this->BendPreviewPending = false;
+  this->BendPreviewThread->wait();
+  this->BendPreviewGeneration++;
+}
+
+//-----------------------------------------------------------------------------
+//Stop computing the exact distances of the preview, they are dropped
+void qSlicerPlannerModuleWidgetPrivate::stopDistanceRefinement()
+{
+  this->DistanceRefineThread->Aborted.fetchAndStoreRelaxed(1);
+  this->DistanceRefineThread->wait();
+  this->DistanceRefineThread->Distances = NULL;
+}
+
+//-----------------------------------------------------------------------------
+//Start sweeping the bend with the current options over the slider range
+void qSlicerPlannerModuleWidgetPrivate::startBendSweep()
+{
+  this->waitForBendSweep();
+  this->restoreBendGeometry();
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode);
+  if(!this->bendingActive || !model || !model->GetPolyData())
   {
-    this->logic->setBendType(vtkSlicerPlannerLogic::Double);
+    return;
   }
-  else
+  //a preview finishing later would replace the sweep
+  this->waitForBendPreview();
+  this->setBendOptions();
+  this->BendSweep = this->logic->createBendSweep(model->GetPolyData()->GetPoints(),
+    this->BendMagnitudeSlider->minimum(), this->BendMagnitudeSlider->maximum());
+  if(!this->BendSweep)
   {
-    this->logic->setBendType(vtkSlicerPlannerLogic::Single);
+    //the model is too large to sweep, the slider keeps the asynchronous preview
+    return;
   }
+  this->BendSweepThread->Sweep = this->BendSweep;
+  this->BendSweepThread->BendingData = this->BendingData;
+  this->BendSweepThread->BendingTriangles = &this->BendingTriangles;
+  this->BendSweepThread->start();
+}
 
-  if(this->BendASide)
+//-----------------------------------------------------------------------------
+//Stop the sweep in progress and drop it
+void qSlicerPlannerModuleWidgetPrivate::waitForBendSweep()
+{
+  if(this->BendSweep)
   {
-    this->logic->setBendSide(vtkSlicerPlannerLogic::A);
+    this->BendSweep->AbortCompute();
   }
-  else
+  this->BendSweepThread->wait();
+  this->BendSweepThread->Sweep = NULL;
+  this->BendSweep = NULL;
+}
+
+//-----------------------------------------------------------------------------
+//Build the levels of detail and the collision indices of the models of the hierarchy
+//that have none for their current geometry, and bring the adjacency graph up to date
+//with the models.  The models are copied, they may be modified during the build.
+void qSlicerPlannerModuleWidgetPrivate::startLevelsOfDetail()
+{
+  if(!this->HierarchyNode)
   {
-    this->logic->setBendSide(vtkSlicerPlannerLogic::B);
+    this->logic->clearAdjacency();
+    return;
+  }
+  if(this->LevelOfDetailThread->isRunning())
+  {
+    this->LevelOfDetailPending = true;
+    return;
+  }
+  this->LevelOfDetailPending = false;
+  this->LevelOfDetailThread->ModelIDs.clear();
+  this->LevelOfDetailThread->GeometryMTimes.clear();
+  this->LevelOfDetailThread->Inputs.clear();
+  this->LevelOfDetailThread->Indices.clear();
+  this->LevelOfDetailThread->PairModels.clear();
+  this->LevelOfDetailThread->PairOthers.clear();
+  this->LevelOfDetailThread->PairMatrices.clear();
+  bool build = false;
+  std::map<std::string, size_t> positions;
+  std::vector<vtkMRMLModelNode*> models = this->otherModels(NULL);
+  for(size_t i = 0; i < models.size(); i++)
+  {
+    vtkMRMLModelNode* childModel = models[i];
+    if(!childModel->GetID() || !childModel->GetPolyData())
+    {
+      continue;
+    }
+    vtkSmartPointer<vtkPolyData> input;
+    if(!this->logic->hasLevelsOfDetail(childModel) || !this->logic->hasCollisionIndex(childModel))
+    {
+      input = vtkSmartPointer<vtkPolyData>::New();
+      input->DeepCopy(childModel->GetPolyData());
+      build = true;
+    }
+    positions[childModel->GetID()] = this->LevelOfDetailThread->ModelIDs.size();
+    this->LevelOfDetailThread->ModelIDs.push_back(childModel->GetID());
+    this->LevelOfDetailThread->GeometryMTimes.push_back(
+      vtkSlicerPlannerLogic::getGeometryMTime(childModel->GetPolyData()));
+    this->LevelOfDetailThread->Inputs.push_back(input);
+    this->LevelOfDetailThread->Indices.push_back(input ? NULL : this->logic->getCollisionIndex(childModel));
   }
-  vtkSmartPointer<vtkThinPlateSplineTransform> tps = this->logic->getBendTransform(this->BendMagnitude);
-  BendingTransformNode->SetAndObserveTransformToParent(tps);
-  vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode)->SetAndObserveTransformNodeID(BendingTransformNode->GetID());
 
-  //
-  vtkNew<vtkTransformPolyDataFilter> transform;
-  transform->SetTransform(tps);
-  transform->SetInputData(this->BendingData);
-  transform->Update();
-  vtkNew<vtkMassProperties> area;
-  area->SetInputData(transform->GetOutput());
+  std::vector<vtkSlicerPlannerLogic::AdjacencyCandidate> candidates = this->logic->updateAdjacency(models);
+  for(size_t i = 0; i < candidates.size(); i++)
+  {
+    std::map<std::string, size_t>::const_iterator model = positions.find(candidates[i].Model->GetID());
+    std::map<std::string, size_t>::const_iterator other = positions.find(candidates[i].Other->GetID());
+    if(model != positions.end() && other != positions.end())
+    {
+      this->LevelOfDetailThread->PairModels.push_back(model->second);
+      this->LevelOfDetailThread->PairOthers.push_back(other->second);
+      this->LevelOfDetailThread->PairMatrices.push_back(candidates[i].OtherToModel);
+    }
+  }
+  if(build || !this->LevelOfDetailThread->PairModels.empty())
+  {
+    this->LevelOfDetailThread->start();
+  }
+}
+
+//-----------------------------------------------------------------------------
+//Show the bend at the current magnitude interpolated from the sweep.  The interpolated
+//points replace the model points and the bend transform until restoreBendGeometry.
+void qSlicerPlannerModuleWidgetPrivate::showBendSweep()
+{
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode);
+  vtkPolyData* polyData = model ? model->GetPolyData() : NULL;
+  if(!polyData)
+  {
+    return;
+  }
+  if(!this->BendOriginalPoints)
+  {
+    this->BendOriginalPoints = polyData->GetPoints();
+    this->BendOriginalNormals = polyData->GetPointData()->GetNormals();
+    //the sweep only holds points, shading is left to the renderer while scrubbing
+    polyData->GetPointData()->SetNormals(NULL);
+    vtkMRMLTransformNode* parentTransform = model->GetParentTransformNode();
+    if(parentTransform && !parentTransform->IsA("vtkMRMLLinearTransformNode"))
+    {
+      parentTransform->SetAndObserveTransformToParent(NULL);
+      vtkNew<vtkMatrix4x4> identity;
+      parentTransform->SetMatrixTransformFromParent(identity.GetPointer());
+    }
+  }
+  vtkNew<vtkPoints> points;
+  this->BendSweep->InterpolatePoints(this->BendMagnitude, points.GetPointer());
+  polyData->SetPoints(points.GetPointer());
 
-  area->Update();
-  
   std::stringstream surfaceAreaSstr;
-  surfaceAreaSstr << area->GetSurfaceArea();
+  surfaceAreaSstr << this->BendSweep->InterpolateArea(this->BendMagnitude);
   const std::string& surfaceAreaString= surfaceAreaSstr.str();
-  this->AreaAfterBending->setText(surfaceAreaString.c_str());  
-  
+  this->AreaAfterBending->setText(surfaceAreaString.c_str());
+}
+
+//-----------------------------------------------------------------------------
+//Put back the model points and normals replaced by showBendSweep
+void qSlicerPlannerModuleWidgetPrivate::restoreBendGeometry()
+{
+  if(!this->BendOriginalPoints)
+  {
+    return;
+  }
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(this->CurrentBendNode);
+  if(model && model->GetPolyData())
+  {
+    model->GetPolyData()->GetPointData()->SetNormals(this->BendOriginalNormals);
+    model->GetPolyData()->SetPoints(this->BendOriginalPoints);
+  }
+  this->BendOriginalPoints = NULL;
+  this->BendOriginalNormals = NULL;
 }
 //-----------------------------------------------------------------------------
 //Initialize placement of a fiducial
@@ -1331,15 +1727,8 @@ void qSlicerPlannerModuleWidgetPrivate::setScalarVisibility(bool visible)
 
       if (visible)
       {
-        if (this->UnsignedDistanceRadioButton->isChecked())
-        {
-          childModel->GetDisplayNode()->SetActiveScalarName("Absolute");
-        }
-        else
-        {
-          childModel->GetDisplayNode()->SetActiveScalarName("Signed");
-        }
-        
+        childModel->GetDisplayNode()->SetActiveScalarName(this->distanceArrayName(childModel).c_str());
+
         childModel->GetDisplayNode()->SetScalarRangeFlag(vtkMRMLDisplayNode::UseManualScalarRange);
         childModel->GetDisplayNode()->SetScalarRange(this->LUTRangeWidget->minimumValue(), this->LUTRangeWidget->maximumValue());
         const char *colorNodeID = "vtkMRMLColorTableNodeFileColdToHotRainbow.txt";
@@ -1354,6 +1743,83 @@ void qSlicerPlannerModuleWidgetPrivate::setScalarVisibility(bool visible)
 }
 
 
+//-----------------------------------------------------------------------------
+//Distance field shown on a model: its distance preview if it has one, else the one of the
+//second reference when distances to both references were computed and it is selected,
+//else the one of the single reference
+std::string qSlicerPlannerModuleWidgetPrivate::distanceArrayName(vtkMRMLModelNode* model)
+{
+  //the distance preview of a model is more recent than the distances of the metrics
+  vtkPolyData* displayed = this->logic->getDisplayedPolyData(model);
+  if (displayed && displayed->GetPointData()->GetArray(vtkSlicerPlannerLogic::getDistancePreviewArrayName()))
+  {
+    return vtkSlicerPlannerLogic::getDistancePreviewArrayName();
+  }
+  std::string name = this->UnsignedDistanceRadioButton->isChecked() ? "Absolute" : "Signed";
+  if (this->DistanceReferenceCount > 1 && this->ShownReferenceComboBox->currentIndex() == 1 &&
+    model->GetPolyData() && model->GetPolyData()->GetPointData()->GetArray((name + "_2").c_str()))
+  {
+    name += "_2";
+  }
+  return name;
+}
+
+//-----------------------------------------------------------------------------
+//Reference the distance preview is computed to, the first one if both are selected
+vtkMRMLModelNode* qSlicerPlannerModuleWidgetPrivate::distancePreviewReference()
+{
+  if (this->ReferenceRadioButton->isChecked())
+  {
+    return this->logic->getWrappedBoneTemplateModel();
+  }
+  return this->logic->getWrappedPreOpModel();
+}
+
+//-----------------------------------------------------------------------------
+//Models of the current hierarchy other than a model, all of them for NULL
+std::vector<vtkMRMLModelNode*> qSlicerPlannerModuleWidgetPrivate::otherModels(vtkMRMLModelNode* model)
+{
+  std::vector<vtkMRMLModelNode*> others;
+  std::vector<vtkMRMLHierarchyNode*> children;
+  std::vector<vtkMRMLHierarchyNode*>::const_iterator it;
+  this->HierarchyNode->GetAllChildrenNodes(children);
+  for (it = children.begin(); it != children.end(); ++it)
+  {
+    vtkMRMLModelNode* childModel =
+      vtkMRMLModelNode::SafeDownCast((*it)->GetAssociatedNode());
+    if (childModel && childModel != model)
+    {
+      others.push_back(childModel);
+    }
+  }
+  return others;
+}
+
+//-----------------------------------------------------------------------------
+//Models to check a model against: its neighbors in the adjacency graph, which may lag
+//behind the models being rebuilt in the background, and the other models of the current
+//hierarchy whose world box comes within the maximum gap of the one of the model.  All the
+//other models if the model is not in the graph.
+std::vector<vtkMRMLModelNode*> qSlicerPlannerModuleWidgetPrivate::neighborModels(vtkMRMLModelNode* model)
+{
+  std::vector<vtkMRMLModelNode*> others = this->otherModels(model);
+  if (!this->logic->hasAdjacency(model))
+  {
+    return others;
+  }
+  std::vector<vtkMRMLModelNode*> neighbors = this->logic->getNeighbors(model);
+  std::vector<vtkMRMLModelNode*> near = this->logic->getModelsNear(model, others, MaximumGap);
+  std::set<vtkMRMLModelNode*> found(neighbors.begin(), neighbors.end());
+  for (size_t i = 0; i < near.size(); i++)
+  {
+    if (found.insert(near[i]).second)
+    {
+      neighbors.push_back(near[i]);
+    }
+  }
+  return neighbors;
+}
+
 //-----------------------------------------------------------------------------
 //Hide all transforms in the current hierarchy
 void qSlicerPlannerModuleWidgetPrivate::hideTransforms()
@@ -1412,7 +1878,42 @@ void qSlicerPlannerModuleWidgetPrivate::hardenTransforms(bool hardenLinearOnly)
         if (!hardenLinearOnly)
         {
           this->updatePlanesFromModel(childModel->GetScene(), childModel);
-          childModel->ApplyTransform(transformNode->GetTransformToParent());
+          vtkAbstractTransform* toParent = transformNode->GetTransformToParent();
+          vtkPlannerBendTransform* bendTransform = vtkPlannerBendTransform::SafeDownCast(toParent);
+          vtkPlannerHingeTransform* hingeTransform = vtkPlannerHingeTransform::SafeDownCast(toParent);
+          vtkPolyData* polyData = childModel->GetPolyData();
+          if(polyData && (bendTransform || hingeTransform))
+          {
+            //bend the points and the normals in parallel, instead of one at a time
+            vtkDataArray* normals = polyData->GetPointData()->GetNormals();
+            vtkSmartPointer<vtkDataArray> bentNormals;
+            if(normals)
+            {
+              bentNormals.TakeReference(normals->NewInstance());
+              bentNormals->SetName(normals->GetName());
+            }
+            vtkNew<vtkPoints> bentPoints;
+            if(bendTransform)
+            {
+              bendTransform->TransformPointsNormals(polyData->GetPoints(), bentPoints.GetPointer(), normals, bentNormals);
+            }
+            else
+            {
+              hingeTransform->TransformPointsNormals(polyData->GetPoints(), bentPoints.GetPointer(), normals, bentNormals);
+            }
+            vtkNew<vtkPolyData> bent;
+            bent->ShallowCopy(polyData);
+            bent->SetPoints(bentPoints.GetPointer());
+            if(bentNormals)
+            {
+              bent->GetPointData()->SetNormals(bentNormals);
+            }
+            childModel->SetAndObservePolyData(bent.GetPointer());
+          }
+          else
+          {
+            childModel->ApplyTransform(transformNode->GetTransformToParent());
+          }
           transformNode->SetAndObserveTransformToParent(NULL);
           vtkNew<vtkMatrix4x4> hardeningMatrix;
           hardeningMatrix->Identity();
@@ -1487,6 +1988,22 @@ qSlicerPlannerModuleWidget::qSlicerPlannerModuleWidget(QWidget* _parent)
 qSlicerPlannerModuleWidget::~qSlicerPlannerModuleWidget()
 {
   Q_D(qSlicerPlannerModuleWidget);
+  if (d->BendPreviewThread)
+  {
+    d->BendPreviewThread->wait();
+  }
+  if (d->BendSweepThread)
+  {
+    d->waitForBendSweep();
+  }
+  if (d->LevelOfDetailThread)
+  {
+    d->LevelOfDetailThread->wait();
+  }
+  if (d->DistanceRefineThread)
+  {
+    d->stopDistanceRefinement();
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -1593,6 +2110,31 @@ void qSlicerPlannerModuleWidget::setup()
   d->VTKScalarBar->setDisplay(false);
   d->ShowsScalarsCheckbox->setEnabled(false);
 
+  //Distance preview: wait for the model to stop moving briefly, then refine in the background
+  d->DistancePreviewTimer = new QTimer(this);
+  d->DistancePreviewTimer->setSingleShot(true);
+  d->DistancePreviewTimer->setInterval(100);
+  d->DistanceRefineThread = new qSlicerPlannerDistanceRefineThread(this);
+  d->DistancePreviewLabel->setVisible(false);
+
+  //Collisions: coalesce the transform events of the moving model
+  d->CollisionTimer = new QTimer(this);
+  d->CollisionTimer->setSingleShot(true);
+  d->CollisionTimer->setInterval(0);
+  d->CollisionLabel->setVisible(false);
+  d->GapTimer = new QTimer(this);
+  d->GapTimer->setSingleShot(true);
+  d->GapTimer->setInterval(0);
+  d->GapLabel->setVisible(false);
+
+  //Bend preview: coalesce slider values, compute the latest one in the background
+  d->BendPreviewTimer = new QTimer(this);
+  d->BendPreviewTimer->setSingleShot(true);
+  d->BendPreviewTimer->setInterval(20);
+  d->BendPreviewThread = new qSlicerPlannerBendPreviewThread(this);
+  d->BendSweepThread = new qSlicerPlannerBendSweepThread(this);
+  d->LevelOfDetailThread = new qSlicerPlannerLevelOfDetailThread(this);
+
   // Connect
   this->connect(d->SaveDirectoryButton, SIGNAL(directoryChanged(const QString &)), this, SLOT(saveDirectoryChanged(const QString &)));
   this->connect(sceneModel, SIGNAL(transformOn(vtkMRMLNode*)), this, SLOT(transformActivated(vtkMRMLNode*)));
@@ -1639,6 +2181,8 @@ void qSlicerPlannerModuleWidget::setup()
     d->ShowsScalarsCheckbox, SIGNAL(stateChanged(int)), this, SLOT(updateMRMLFromWidget()));
   this->connect(
     d->LUTRangeWidget, SIGNAL(valuesChanged(double, double)), this, SLOT(updateMRMLFromWidget()));
+  this->connect(
+    d->ShownReferenceComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(updateMRMLFromWidget()));
   this->connect(
     d->TemplateReferenceColorPickerButton, SIGNAL(colorChanged(QColor)),
     this, SLOT(updateMRMLFromWidget()));
@@ -1650,8 +2194,10 @@ void qSlicerPlannerModuleWidget::setup()
     this, SLOT(onOpenTemplateReference()));
 
   this->connect(d->BendMagnitudeSlider, SIGNAL(valueChanged(double)), this, SLOT(bendMagnitudeSliderUpdated()));
+  this->connect(d->OptimizeBendButton, SIGNAL(clicked()), this, SLOT(optimizeBendClicked()));
   this->connect(d->DoubleSidedButton, SIGNAL(toggled(bool)), this, SLOT(updateBendButtonClicked()));
   this->connect(d->ASideButton, SIGNAL(toggled(bool)), this, SLOT(updateBendButtonClicked()));
+  this->connect(d->RigidHingeCheckBox, SIGNAL(toggled(bool)), this, SLOT(updateBendButtonClicked()));
   this->connect(d->BSideButton, SIGNAL(toggled(bool)), this, SLOT(updateBendButtonClicked()));
   this->connect(d->FinishButton, SIGNAL(clicked()), this, SLOT(finishPlanButtonClicked()));
 
@@ -1659,6 +2205,15 @@ void qSlicerPlannerModuleWidget::setup()
   this->connect(bends, SIGNAL(buttonIndexClicked(const QModelIndex &)), this, SLOT(modelCallback(const QModelIndex &)));
   this->connect(d->EnableSavingCheckbox, SIGNAL(toggled(bool)), this, SLOT(enabledSavingCheckboxToggled(bool)));
   this->connect(d->ScreenshotButton, SIGNAL(clicked()), this, SLOT(takeScreenshotButtonClicked()));
+  this->connect(d->DistancePreviewTimer, SIGNAL(timeout()), this, SLOT(updateDistancePreview()));
+  this->connect(d->BendPreviewTimer, SIGNAL(timeout()), this, SLOT(startBendPreview()));
+  this->connect(d->BendPreviewThread, SIGNAL(finished()), this, SLOT(finishBendPreview()));
+  this->connect(d->LevelOfDetailThread, SIGNAL(finished()), this, SLOT(finishLevelsOfDetail()));
+  this->connect(d->DistanceRefineThread, SIGNAL(finished()), this, SLOT(finishDistanceRefinement()));
+  this->connect(d->CollisionTimer, SIGNAL(timeout()), this, SLOT(updateCollisions()));
+  this->connect(d->CollisionCheckBox, SIGNAL(toggled(bool)), this, SLOT(updateCollisions()));
+  this->connect(d->GapTimer, SIGNAL(timeout()), this, SLOT(updateGaps()));
+  this->connect(d->GapCheckBox, SIGNAL(toggled(bool)), this, SLOT(updateGaps()));
 
   this->updateWidgetFromMRML();
 }
@@ -1669,6 +2224,7 @@ void qSlicerPlannerModuleWidget::setCurrentNode(vtkMRMLNode* node)
   Q_D(qSlicerPlannerModuleWidget);
   vtkMRMLModelHierarchyNode* hNode = vtkMRMLModelHierarchyNode::SafeDownCast(node);
   d->HierarchyNode = hNode;
+  d->startLevelsOfDetail();
   this->updateWidgetFromMRML();
 }
 
@@ -1688,6 +2244,10 @@ void qSlicerPlannerModuleWidget::setMRMLScene(vtkMRMLScene* scene)
   this->qvtkReconnect(
     this->mrmlScene(), vtkMRMLScene::StartCloseEvent,
     this, SLOT(finishPlanButtonClicked()));
+
+  this->qvtkReconnect(
+    this->mrmlScene(), vtkMRMLScene::StartSaveEvent,
+    this, SLOT(showExactBend()));
 }
 
 //-----------------------------------------------------------------------------
@@ -1819,14 +2379,18 @@ void qSlicerPlannerModuleWidget::updateWidgetFromMRML()
   d->BendingMenu->setVisible(d->bendingOpen);
   d->CuttingMenu->setVisible(d->cuttingActive);
   d->MoveMenu->setVisible(d->moveActive);
+  d->DistancePreviewCheckBox->setEnabled(d->ShowsScalarsCheckbox->isEnabled());
   d->ScreenshotMenu->setVisible(d->waitingOnScreenshot);
   d->ScreenshotMenu->setEnabled(d->waitingOnScreenshot);
   d->CutConfirmButton->setEnabled(d->cuttingActive);
   d->CutCancelButton->setEnabled(d->cuttingActive);
   d->CutPreviewButton->setEnabled(d->cuttingActive);
   d->BendMagnitudeSlider->setEnabled(d->bendingActive);
+  //the support of the spline is chosen when the bend is initialized
+  d->LocalBendCheckBox->setEnabled(!d->bendingActive);
   d->CancelBendButton->setEnabled(d->bendingOpen);
   d->HardenBendButton->setEnabled(d->bendingActive);
+  d->OptimizeBendButton->setEnabled(d->bendingActive && this->plannerLogic()->getWrappedBoneTemplateModel());
   d->SaveDirectoryButton->setEnabled(!d->savingActive);
 
   bool performingAction = d->cuttingActive || d->bendingOpen || d->moveActive || d->waitingOnScreenshot;
@@ -1872,18 +2436,32 @@ void qSlicerPlannerModuleWidget::updateWidgetFromMRML()
   }
 
   //Sort out radio buttons  
+  //a hinge turns a single side
+  if (d->RigidHingeCheckBox->isChecked() && d->DoubleSidedButton->isChecked())
+  {
+    d->ASideButton->setChecked(true);
+  }
+  d->DoubleSidedButton->setEnabled(!d->RigidHingeCheckBox->isChecked());
   d->BendDoubleSide = d->DoubleSidedButton->isChecked();
   d->BendASide = d->ASideButton->isChecked();
+  d->BendHinge = d->RigidHingeCheckBox->isChecked();
 
   if (!this->plannerLogic()->getWrappedBoneTemplateModel())
   {
     d->ReferenceRadioButton->setChecked(false);
     d->ReferenceRadioButton->setEnabled(false);
+    if (d->BothReferencesRadioButton->isChecked())
+    {
+      d->InitialStateRadioButton->setChecked(true);
+    }
+    d->BothReferencesRadioButton->setEnabled(false);
   }
   else
   {
     d->ReferenceRadioButton->setEnabled(true);
+    d->BothReferencesRadioButton->setEnabled(true);
   }
+  d->ShownReferenceComboBox->setEnabled(d->DistanceReferenceCount > 1);
 
   //Freeze UI if needed
   if (d->cliFreeze)
@@ -2028,6 +2606,7 @@ void qSlicerPlannerModuleWidget::confirmCutButtonClicked()
   Q_D(qSlicerPlannerModuleWidget);
   d->completeCut(this->mrmlScene());
   d->cuttingActive = false;
+  d->startLevelsOfDetail();
   if (d->savingActive)
   {
     d->waitingOnScreenshot = true;
@@ -2084,6 +2663,9 @@ void qSlicerPlannerModuleWidget::cancelBendButtonClicked()
   Q_D(qSlicerPlannerModuleWidget);
   d->BendMagnitude = 0;
   d->BendMagnitudeSlider->setValue(0);
+  d->waitForBendPreview();
+  d->waitForBendSweep();
+  d->restoreBendGeometry();
   if(d->bendingActive)
   {
     d->computeTransform(this->mrmlScene());
@@ -2129,10 +2711,12 @@ void qSlicerPlannerModuleWidget::updateCurrentBendNode(vtkMRMLNode* node)
 void qSlicerPlannerModuleWidget::initBendButtonClicked()
 {
   Q_D(qSlicerPlannerModuleWidget);
+  d->waitForBendPreview();
   d->hideTransforms();
   d->hardenTransforms(true);
   d->computeAndSetSourcePoints(this->mrmlScene());
   d->bendingActive = true;
+  d->startBendSweep();
   this->updateWidgetFromMRML();
 }
 
@@ -2141,7 +2725,16 @@ void qSlicerPlannerModuleWidget::initBendButtonClicked()
 void qSlicerPlannerModuleWidget::updateBendButtonClicked()
 {
   Q_D(qSlicerPlannerModuleWidget);
+  d->BendHinge = d->RigidHingeCheckBox->isChecked();
+  if(!d->bendingActive)
+  {
+    this->updateWidgetFromMRML();
+    return;
+  }
+  d->waitForBendPreview();
   d->computeTransform(this->mrmlScene());
+  //the bend options may have changed, sweep again
+  d->startBendSweep();
   d->HardenBendButton->setEnabled(true);
   this->updateWidgetFromMRML();
 }
@@ -2152,16 +2745,113 @@ void qSlicerPlannerModuleWidget::bendMagnitudeSliderUpdated()
 {
   Q_D(qSlicerPlannerModuleWidget);
   d->BendMagnitude = d->BendMagnitudeSlider->value();
-  this->updateBendButtonClicked();
+  if(d->bendingActive && d->BendSweep && d->BendSweep->GetComplete())
+  {
+    d->waitForBendPreview();
+    d->showBendSweep();
+    d->HardenBendButton->setEnabled(true);
+    return;
+  }
+  d->BendPreviewTimer->start();
+}
+
+//-----------------------------------------------------------------------------
+//Set the magnitude that best fits the bent model to the wrapped bone template
+void qSlicerPlannerModuleWidget::optimizeBendClicked()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  vtkMRMLModelNode* boneTemplate = this->plannerLogic()->getWrappedBoneTemplateModel();
+  if(!d->bendingActive || !boneTemplate)
+  {
+    return;
+  }
+  d->waitForBendPreview();
+  d->setBendOptions();
+  double magnitude = this->plannerLogic()->optimizeBendMagnitude(boneTemplate,
+    d->BendMagnitudeSlider->minimum(), d->BendMagnitudeSlider->maximum());
+  d->BendMagnitudeSlider->setValue(magnitude);
+
+  //the slider shows an interpolated or delayed bend, show the exact one
+  d->BendMagnitude = magnitude;
+  d->waitForBendPreview();
+  d->computeTransform(this->mrmlScene());
+  d->HardenBendButton->setEnabled(true);
   this->updateWidgetFromMRML();
 }
 
+//-----------------------------------------------------------------------------
+//Start computing the bend for the current magnitude, unless a bend is being computed already
+void qSlicerPlannerModuleWidget::startBendPreview()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  if(!d->bendingActive)
+  {
+    return;
+  }
+  if(d->BendPreviewThread->isRunning())
+  {
+    d->BendPreviewPending = true;
+    return;
+  }
+  d->BendPreviewPending = false;
+  d->setBendOptions();
+  d->BendPreviewThread->Transform = d->logic->createBendTransform(d->BendMagnitude);
+  d->BendPreviewThread->BendingData = d->BendingData;
+  d->BendPreviewThread->BendingTriangles = &d->BendingTriangles;
+  d->BendPreviewThread->Magnitude = d->BendMagnitude;
+  d->BendPreviewThread->Generation = d->BendPreviewGeneration;
+  d->BendPreviewThread->start();
+}
+
+//-----------------------------------------------------------------------------
+//Show the finished bend, then start on the latest magnitude if the slider moved meanwhile
+void qSlicerPlannerModuleWidget::finishBendPreview()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  if(d->BendPreviewThread->isRunning() || d->BendPreviewThread->Generation != d->BendPreviewGeneration ||
+    !d->bendingActive)
+  {
+    //dropped, or superseded by a bend computed on the GUI thread
+    return;
+  }
+  d->applyBendTransform(this->mrmlScene(), d->BendPreviewThread->Transform, d->BendPreviewThread->Area);
+  d->BendPreviewThread->Transform = NULL;
+  d->HardenBendButton->setEnabled(true);
+  if(d->BendPreviewPending || d->BendPreviewThread->Magnitude != d->BendMagnitude)
+  {
+    this->startBendPreview();
+  }
+  this->updateWidgetFromMRML();
+}
+
+//-----------------------------------------------------------------------------
+//Replace the bend interpolated from the sweep by the exact one, so the model is saved
+//with its own points and the bend transform
+void qSlicerPlannerModuleWidget::showExactBend()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  if(!d->bendingActive || !d->BendOriginalPoints)
+  {
+    return;
+  }
+  d->waitForBendPreview();
+  d->computeTransform(this->mrmlScene());
+}
+
 //-----------------------------------------------------------------------------
 //Finish and harden current bending action
 void qSlicerPlannerModuleWidget::finshBendClicked()
 {
   Q_D(qSlicerPlannerModuleWidget);
   
+  //the preview may lag behind the slider or be interpolated, harden the exact bend
+  d->waitForBendPreview();
+  d->waitForBendSweep();
+  d->restoreBendGeometry();
+  if(d->bendingActive)
+  {
+    d->computeTransform(this->mrmlScene());
+  }
   d->hardenTransforms(false);
   d->BendMagnitude = 0;
   d->BendMagnitudeSlider->setValue(0);
@@ -2169,6 +2859,7 @@ void qSlicerPlannerModuleWidget::finshBendClicked()
   d->clearBendingData(this->mrmlScene());
   d->bendingActive = false;
   d->bendingOpen = false;
+  d->startLevelsOfDetail();
   qvtkDisconnect(qSlicerCoreApplication::application()->applicationLogic()->GetInteractionNode(), vtkMRMLInteractionNode::EndPlacementEvent, this, SLOT(cancelFiducialButtonClicked()));
   if (d->savingActive)
   {
@@ -2305,13 +2996,19 @@ void qSlicerPlannerModuleWidget::launchDistance()
     return;
   }
 
-  //select the reference
+  //select the reference, both references are handled by a single CLI run
   vtkMRMLModelNode* distanceReference;
+  vtkMRMLModelNode* secondDistanceReference = NULL;
 
   if (d->InitialStateRadioButton->isChecked())
   {
     distanceReference = this->plannerLogic()->getWrappedPreOpModel();
   }
+  else if (d->BothReferencesRadioButton->isChecked())
+  {
+    distanceReference = this->plannerLogic()->getWrappedPreOpModel();
+    secondDistanceReference = this->plannerLogic()->getWrappedBoneTemplateModel();
+  }
   else
   {
     distanceReference = this->plannerLogic()->getWrappedBoneTemplateModel();
@@ -2333,7 +3030,14 @@ void qSlicerPlannerModuleWidget::launchDistance()
     std::cout << "3" << std::endl;
     d->cmdNode->SetParameterAsString("vtkFile1", this->plannerLogic()->getWrappedCurrentModel()->GetID());
     d->cmdNode->SetParameterAsString("vtkFile2", distanceReference->GetID());
+    if (secondDistanceReference)
+    {
+      d->cmdNode->SetParameterAsString("vtkFile3", secondDistanceReference->GetID());
+    }
     d->cmdNode->SetParameterAsString("vtkOutput", temp->GetID());      
+    //float fields are plenty for display and halve the memory used on large wraps
+    d->cmdNode->SetParameterAsBool("singlePrecision", true);
+    d->cmdNode->SetParameterAsBool("dropOriginalField", true);
     if (d->UnsignedDistanceRadioButton->isChecked())
     {
       d->cmdNode->SetParameterAsString("distanceType", "absolute_closest_point");
@@ -2367,15 +3071,32 @@ void qSlicerPlannerModuleWidget::finishDistance()
   std::cout << "Building Locator" << std::endl;
   locator->BuildLocator();
   std::cout << "Built" << std::endl;
-  vtkDoubleArray * absolute_wrapped;
+  std::string distanceName;
   if (d->UnsignedDistanceRadioButton->isChecked())
   {
-    absolute_wrapped = vtkDoubleArray::SafeDownCast(distanceNode->GetPolyData()->GetPointData()->GetScalars("Absolute"));
+    distanceName = "Absolute";
   }
   else
   {
-    absolute_wrapped = vtkDoubleArray::SafeDownCast(distanceNode->GetPolyData()->GetPointData()->GetScalars("Signed"));
+    distanceName = "Signed";
+  }
+  //distances to the second reference, if any, come in the "_2" field.  The CLI run by the
+  //planner takes at most two references.
+  std::vector<vtkDataArray*> wrappedDistances;
+  std::vector<std::string> distanceNames;
+  distanceNames.push_back(distanceName);
+  distanceNames.push_back(distanceName + "_2");
+  for (size_t a = 0; a < distanceNames.size(); a++)
+  {
+    vtkDataArray* wrapped = distanceNode->GetPolyData()->GetPointData()->GetArray(distanceNames[a].c_str());
+    if (!wrapped)
+    {
+      distanceNames.resize(a);
+      break;
+    }
+    wrappedDistances.push_back(wrapped);
   }
+  d->DistanceReferenceCount = static_cast<int>(wrappedDistances.size());
   
   
   std::cout << "Got Scalars" << std::endl;
@@ -2390,37 +3111,40 @@ void qSlicerPlannerModuleWidget::finishDistance()
     if (childModel)
     {
       int m = childModel->StartModify();
-      std::cout << "Probing model" << std::endl;
-      //probe->SetInputData(childModel->GetPolyData());
-      //probe->Update();
-      vtkNew<vtkDoubleArray> absolute;
-      if (d->UnsignedDistanceRadioButton->isChecked())
+      //fields of an earlier run, possibly to another number of references, are dropped
+      const char* staleNames[] = { "Absolute", "Signed", "Absolute_2", "Signed_2",
+        vtkSlicerPlannerLogic::getDistancePreviewArrayName() };
+      for (int a = 0; a < 5; a++)
       {
-        absolute->SetName("Absolute");
+        childModel->GetPolyData()->GetPointData()->RemoveArray(staleNames[a]);
       }
-      else
+      std::cout << "Probing model" << std::endl;
+      int n = childModel->GetPolyData()->GetNumberOfPoints();
+      std::vector<vtkSmartPointer<vtkFloatArray> > distances;
+      for (size_t a = 0; a < wrappedDistances.size(); a++)
       {
-        absolute->SetName("Signed");
+        vtkNew<vtkFloatArray> distance;
+        distance->SetName(distanceNames[a].c_str());
+        distance->SetNumberOfValues(n);
+        distances.push_back(distance.GetPointer());
       }
-      int n = childModel->GetPolyData()->GetNumberOfPoints();
-      absolute->SetNumberOfValues(n);
       std::cout << "number of points: " << n << std::endl;
       
+      //one locator query per point, shared by all the references
       for (int i = 0; i < n; i++)
       {
         double* p = childModel->GetPolyData()->GetPoints()->GetPoint(i);
         int id = locator->FindClosestPoint(p);
-        absolute->SetValue(i,  absolute_wrapped->GetValue(id));
-        //std::cout << id << " " << absolute_wrapped->GetValue(id) << std::endl;
+        for (size_t a = 0; a < wrappedDistances.size(); a++)
+        {
+          distances[a]->SetValue(i, wrappedDistances[a]->GetTuple1(id));
+        }
+      }
+      for (size_t a = 0; a < distances.size(); a++)
+      {
+        childModel->GetPolyData()->GetPointData()->AddArray(distances[a]);
       }
-      //childModel->GetPolyData()->GetPointData()->RemoveArray("Absolute");
-      childModel->GetPolyData()->GetPointData()->AddArray(absolute.GetPointer());
-      //childModel->SetAndObservePolyData(probe->GetPolyDataOutput());
       childModel->EndModify(m);
-      //childModel->Modified();
-      //childModel->GetPolyData()->GetPointData()->SetActiveAttribute("Absolute", 0);
-      //childModel->GetDisplayNode()->Modified();
-      //break;
     }
   }
   d->cliFreeze = false;
@@ -2504,6 +3228,9 @@ void qSlicerPlannerModuleWidget::launchMetrics()
 void qSlicerPlannerModuleWidget::finishPlanButtonClicked()
 {
   Q_D(qSlicerPlannerModuleWidget);
+  //the plan may be finished by closing the scene in the middle of a bend
+  d->waitForBendPreview();
+  d->waitForBendSweep();
 
   
   if (d->HierarchyNode)
@@ -2581,6 +3308,18 @@ void qSlicerPlannerModuleWidget::transformActivated(vtkMRMLNode* node)
   d->moveActive = true;
   d->ActionInProgress[0] = node->GetName();
   d->ActionInProgress[1] = "Move";
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(node);
+  this->qvtkReconnect(d->MovingModel, model, vtkMRMLTransformableNode::TransformModifiedEvent,
+                      this, SLOT(movingModelTransformModified()));
+  if (d->MovingModel != model)
+  {
+    this->plannerLogic()->showFullResolution(d->MovingModel);
+  }
+  d->MovingModel = model;
+  this->plannerLogic()->showLevelOfDetail(model);
+  d->startLevelsOfDetail();
+  this->updateCollisions();
+  this->updateGaps();
   this->updateWidgetFromMRML();
 }
 
@@ -2592,8 +3331,16 @@ void qSlicerPlannerModuleWidget::confirmMoveButtonClicked()
     return;
   }
   d->hideTransforms();
+  this->plannerLogic()->showFullResolution(d->MovingModel);
   d->hardenTransforms(false);
   d->moveActive = false;
+  this->updateDistancePreview();
+  this->qvtkDisconnect(d->MovingModel, vtkMRMLTransformableNode::TransformModifiedEvent,
+                       this, SLOT(movingModelTransformModified()));
+  d->MovingModel = NULL;
+  this->updateCollisions();
+  this->updateGaps();
+  d->startLevelsOfDetail();
   if (d->savingActive)
   {
     d->waitingOnScreenshot = true;
@@ -2614,8 +3361,15 @@ void qSlicerPlannerModuleWidget::cancelMoveButtonClicked()
     return;
   }
   d->hideTransforms();
+  this->plannerLogic()->showFullResolution(d->MovingModel);
   d->clearTransforms();
   d->moveActive = false;
+  this->updateDistancePreview();
+  this->qvtkDisconnect(d->MovingModel, vtkMRMLTransformableNode::TransformModifiedEvent,
+                       this, SLOT(movingModelTransformModified()));
+  d->MovingModel = NULL;
+  this->updateCollisions();
+  this->updateGaps();
   d->ActionInProgress.fill("");
   this->updateWidgetFromMRML();  
 }
@@ -2668,3 +3422,214 @@ void qSlicerPlannerModuleWidget::takeScreenshotButtonClicked()
   this->updateWidgetFromMRML();
 }
 
+//-----------------------------------------------------------------------------
+//Restart the preview delay each time the moving model is moved
+void qSlicerPlannerModuleWidget::movingModelTransformModified()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  //the gaps take the scalars of the moving model over from the distance preview
+  if (d->DistancePreviewCheckBox->isChecked() && d->ShowsScalarsCheckbox->isChecked() &&
+    !d->GapCheckBox->isChecked())
+  {
+    d->DistancePreviewTimer->start();
+  }
+  if (d->CollisionCheckBox->isChecked() && !d->CollisionTimer->isActive())
+  {
+    d->CollisionTimer->start();
+  }
+  if (d->GapCheckBox->isChecked() && !d->GapTimer->isActive())
+  {
+    d->GapTimer->start();
+  }
+}
+
+//-----------------------------------------------------------------------------
+//Highlight where the moving model crosses the other models of the hierarchy
+void qSlicerPlannerModuleWidget::updateCollisions()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  d->CollisionTimer->stop();
+  if (!d->moveActive || !d->MovingModel || !d->HierarchyNode || !d->CollisionCheckBox->isChecked())
+  {
+    this->plannerLogic()->clearCollisions();
+    d->CollisionLabel->setVisible(false);
+    return;
+  }
+
+  std::vector<vtkMRMLModelNode*> hits =
+    this->plannerLogic()->computeCollisions(d->MovingModel, d->neighborModels(d->MovingModel));
+  QStringList names;
+  for (size_t i = 0; i < hits.size(); i++)
+  {
+    names << hits[i]->GetName();
+  }
+  if (!names.isEmpty())
+  {
+    d->CollisionLabel->setText(QString("Collides with: %1").arg(names.join(", ")));
+  }
+  else
+  {
+    //the index of the moving model is still being built in the background
+    d->CollisionLabel->setText(this->plannerLogic()->hasCollisionIndex(d->MovingModel) ?
+      QString("No collision") : QString("Checking collisions..."));
+  }
+  d->CollisionLabel->setVisible(true);
+}
+
+//-----------------------------------------------------------------------------
+//Color the moving model by its gap to the other models of the hierarchy
+void qSlicerPlannerModuleWidget::updateGaps()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  d->GapTimer->stop();
+  bool showGaps = d->moveActive && d->MovingModel && d->HierarchyNode && d->GapCheckBox->isChecked();
+  if (d->GapModel && (!showGaps || d->GapModel != d->MovingModel))
+  {
+    //gaps are not shown on that model anymore, show the scalars of the metrics again
+    this->plannerLogic()->clearGaps(d->GapModel);
+    if (d->HierarchyNode)
+    {
+      d->setScalarVisibility(d->ShowsScalarsCheckbox->isChecked());
+    }
+    d->GapModel = NULL;
+  }
+  if (!showGaps)
+  {
+    d->GapLabel->setVisible(false);
+    return;
+  }
+
+  vtkMRMLModelNode* closest = NULL;
+  double gap = this->plannerLogic()->computeGaps(d->MovingModel, d->neighborModels(d->MovingModel), MaximumGap, closest);
+  vtkMRMLDisplayNode* display = d->MovingModel->GetDisplayNode();
+  if (display && d->GapModel != d->MovingModel)
+  {
+    int wasModifying = display->StartModify();
+    display->SetActiveScalarName("Gap");
+    display->SetScalarRangeFlag(vtkMRMLDisplayNode::UseManualScalarRange);
+    display->SetScalarRange(0, MaximumGap);
+    display->SetAndObserveColorNodeID("vtkMRMLColorTableNodeFileColdToHotRainbow.txt");
+    display->SetScalarVisibility(true);
+    display->EndModify(wasModifying);
+  }
+  d->GapModel = d->MovingModel;
+  if (closest)
+  {
+    d->GapLabel->setText(QString("Smallest gap: %1 mm, to %2").arg(gap, 0, 'f', 2).arg(closest->GetName()));
+  }
+  else
+  {
+    d->GapLabel->setText(QString("No neighboring model within %1 mm").arg(MaximumGap, 0, 'f', 0));
+  }
+  d->GapLabel->setVisible(true);
+}
+
+//-----------------------------------------------------------------------------
+//Show approximate distances on the moving model, and start computing the exact ones
+void qSlicerPlannerModuleWidget::updateDistancePreview()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  d->DistancePreviewTimer->stop();
+  d->stopDistanceRefinement();
+  vtkMRMLModelNode* reference = d->distancePreviewReference();
+  if (!d->MovingModel || !reference || !d->DistancePreviewCheckBox->isChecked() ||
+    !d->ShowsScalarsCheckbox->isChecked())
+  {
+    this->plannerLogic()->clearDistancePreview();
+    if (d->MovingModel && this->plannerLogic()->removeDistancePreview(d->MovingModel) && d->HierarchyNode)
+    {
+      d->setScalarVisibility(d->ShowsScalarsCheckbox->isChecked());
+    }
+    d->DistancePreviewLabel->setVisible(false);
+    return;
+  }
+  double errorBound = this->plannerLogic()->computeDistancePreview(d->MovingModel, reference,
+    d->SignedDistanceRadioButton->isChecked());
+  if (d->HierarchyNode)
+  {
+    //the preview has its own array, which the moving model shows from now on
+    d->setScalarVisibility(true);
+  }
+  d->DistancePreviewLabel->setText(QString("Distance preview within %1 mm, refining...").arg(errorBound, 0, 'f', 2));
+  d->DistancePreviewLabel->setVisible(true);
+  if (this->plannerLogic()->getDistancePreviewInputs(d->DistanceRefineThread->Points,
+    d->DistanceRefineThread->Distance, d->DistanceRefineThread->SignedDistance))
+  {
+    d->DistanceRefineThread->Aborted.fetchAndStoreRelaxed(0);
+    d->DistanceRefineThread->start();
+  }
+}
+
+//-----------------------------------------------------------------------------
+//Keep the levels of detail, the collision indices and the adjacency found in the
+//background, check the moving model with them, and build the ones of the models
+//modified meanwhile
+void qSlicerPlannerModuleWidget::finishLevelsOfDetail()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  if (d->LevelOfDetailThread->isRunning() || !d->HierarchyNode || !this->mrmlScene())
+  {
+    return;
+  }
+  std::vector<vtkMRMLModelNode*> models;
+  for (size_t i = 0; i < d->LevelOfDetailThread->ModelIDs.size(); i++)
+  {
+    vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(
+      this->mrmlScene()->GetNodeByID(d->LevelOfDetailThread->ModelIDs[i]));
+    models.push_back(model);
+    if (!d->LevelOfDetailThread->Inputs[i])
+    {
+      continue;
+    }
+    this->plannerLogic()->setLevelsOfDetail(model, d->LevelOfDetailThread->GeometryMTimes[i],
+      d->LevelOfDetailThread->Levels[i]);
+    this->plannerLogic()->setCollisionIndex(model, d->LevelOfDetailThread->GeometryMTimes[i],
+      d->LevelOfDetailThread->Indices[i]);
+    if (model && d->moveActive && model == d->MovingModel)
+    {
+      this->plannerLogic()->showLevelOfDetail(model);
+    }
+  }
+  for (size_t i = 0; i < d->LevelOfDetailThread->Adjacent.size(); i++)
+  {
+    vtkMRMLModelNode* model = models[d->LevelOfDetailThread->PairModels[i]];
+    vtkMRMLModelNode* other = models[d->LevelOfDetailThread->PairOthers[i]];
+    if (d->LevelOfDetailThread->Adjacent[i] && model && other)
+    {
+      this->plannerLogic()->setAdjacent(model, other);
+    }
+  }
+  d->LevelOfDetailThread->Inputs.clear();
+  d->LevelOfDetailThread->Levels.clear();
+  d->LevelOfDetailThread->Indices.clear();
+  d->LevelOfDetailThread->PairMatrices.clear();
+  d->LevelOfDetailThread->Adjacent.clear();
+  if (d->moveActive && d->MovingModel)
+  {
+    this->updateCollisions();
+    this->updateGaps();
+  }
+  if (d->LevelOfDetailPending)
+  {
+    d->startLevelsOfDetail();
+  }
+}
+
+//-----------------------------------------------------------------------------
+//Replace the preview by the exact distances computed in the background
+void qSlicerPlannerModuleWidget::finishDistanceRefinement()
+{
+  Q_D(qSlicerPlannerModuleWidget);
+  if (d->DistanceRefineThread->isRunning())
+  {
+    return;
+  }
+  if (d->DistanceRefineThread->Distances &&
+    this->plannerLogic()->setExactDistancePreview(d->DistanceRefineThread->Points, d->DistanceRefineThread->Distances))
+  {
+    d->DistancePreviewLabel->setText("Distance preview: exact");
+  }
+  d->DistanceRefineThread->Points = NULL;
+  d->DistanceRefineThread->Distance = NULL;
+  d->DistanceRefineThread->Distances = NULL;
+}
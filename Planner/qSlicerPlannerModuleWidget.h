@@ -77,6 +77,7 @@ protected slots:
   void initBendButtonClicked();
   void updateBendButtonClicked();
   void bendMagnitudeSliderUpdated();
+  void optimizeBendClicked();
   void finshBendClicked();
   void finishPlanButtonClicked();
   void transformActivated(vtkMRMLNode* node);
@@ -103,6 +104,23 @@ protected slots:
   void runModelDistance(vtkMRMLModelNode* distRef);
   void launchDistance();
 
+  //Distance preview slots
+  void movingModelTransformModified();
+  void updateDistancePreview();
+  void finishDistanceRefinement();
+
+  //Level of detail slots
+  void finishLevelsOfDetail();
+
+  //Collision and gap slots
+  void updateCollisions();
+  void updateGaps();
+
+  //Bend preview slots
+  void startBendPreview();
+  void finishBendPreview();
+  void showExactBend();
+
 
 protected:
   virtual void setup();